@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations using LL/SC. If the SC fails because somebody
+ * else touched the word between the LL and the SC, go around again.
+ *
+ * See include/atomic.h for further information.
+ */
+
+ATOMIC_INLINE
+void *
+atomic_cas_ptr(void *volatile *ptr, void *oldval, void *newval)
+{
+	void *x;
+	unsigned ok;
+
+	/*
+	 * OK starts out nonzero so that if the comparison fails and
+	 * we skip the SC, we don't loop.
+	 */
+	do {
+		ok = 1;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *ptr */
+			"bne %0, %3, 1f;"	/*   if (x != oldval) goto 1 */
+			"move %1, %4;"		/*   ok = newval */
+			"sc %1, 0(%2);"		/*   *ptr = ok; ok = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (ok)
+			: "r" (ptr), "r" (oldval), "r" (newval)
+			: "memory");
+	} while (ok == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+void *
+atomic_swap_ptr(void *volatile *ptr, void *newval)
+{
+	void *x;
+	unsigned ok;
+
+	do {
+		ok = (unsigned)newval;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *ptr */
+			"sc %1, 0(%2);"		/*   *ptr = ok; ok = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (ok) : "r" (ptr) : "memory");
+	} while (ok == 0);
+	return x;
+}
+
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -113,6 +113,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 
 	    /* process calls */
 
@@ -178,6 +183,48 @@ syscall(struct trapframe *tf)
 			tf->tf_a2,
 			&retval);
 		break;
+	    case SYS_readv:
+		err = sys_readv(
+			tf->tf_a0,
+			(const_userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+	    case SYS_writev:
+		err = sys_writev(
+			tf->tf_a0,
+			(const_userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+	    case SYS_pread:
+	    case SYS_pwrite:
+		{
+			/*
+			 * The 64-bit position is aligned to an even
+			 * argument slot, which is past a3 (left unused),
+			 * so it's on the stack.
+			 */
+			off_t pos;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &pos, sizeof(pos));
+			if (err) {
+				break;
+			}
+
+			if (callno == SYS_pread) {
+				err = sys_pread(tf->tf_a0,
+						(userptr_t)tf->tf_a1,
+						tf->tf_a2, pos, &retval);
+			}
+			else {
+				err = sys_pwrite(tf->tf_a0,
+						 (userptr_t)tf->tf_a1,
+						 tf->tf_a2, pos, &retval);
+			}
+		}
+		break;
 	    case SYS_lseek:
 		{
 			/*
@@ -211,6 +258,30 @@ syscall(struct trapframe *tf)
 		}
 		break;
 
+	    case SYS_fsync:
+		err = sys_fsync(tf->tf_a0);
+		break;
+
+	    case SYS_getdirentry:
+		err = sys_getdirentry(
+			tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
+	    case SYS_getdirentries:
+		err = sys_getdirentries(
+			tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
+	    case SYS_sync:
+		err = sys_sync();
+		break;
+
 	    case SYS_chdir:
 		err = sys_chdir((userptr_t)tf->tf_a0);
 		break;
@@ -227,6 +298,22 @@ syscall(struct trapframe *tf)
         err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
         break;
 
+	    /* user-level synchronization */
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			(const_userptr_t)tf->tf_a2);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			&retval);
+		break;
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
@@ -400,3 +400,36 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	*ret = new;
 	return 0;
 }
+
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret, int *perms)
+{
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	stacktop = USERSTACK;
+
+	/* A zero base means as_prepare_load hasn't given it memory yet */
+	if (vaddr >= vbase1 && vaddr < vtop1 && as->as_pbase1 != 0) {
+		*ret = (vaddr - vbase1) + as->as_pbase1;
+	}
+	else if (vaddr >= vbase2 && vaddr < vtop2 && as->as_pbase2 != 0) {
+		*ret = (vaddr - vbase2) + as->as_pbase2;
+	}
+	else if (vaddr >= stackbase && vaddr < stacktop &&
+		 as->as_stackpbase != 0) {
+		*ret = (vaddr - stackbase) + as->as_stackpbase;
+	}
+	else {
+		return EFAULT;
+	}
+	if (perms != NULL) {
+		/* dumbvm maps every page writable */
+		*perms = AS_PERM_READ | AS_PERM_WRITE | AS_PERM_EXEC;
+	}
+	return 0;
+}
@@ -75,6 +75,37 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Longest we'll let the on-chip timer go without interrupting. The
+ * compare register is 32 bits; stay well inside that.
+ */
+#define MAX_ONESHOT_USECS 60000000 /* 60 seconds */
+
+/*
+ * Reprogram the on-chip timer for one interrupt USECS from now. The
+ * interrupt handler below puts it back to the normal hardclock rate.
+ */
+void
+mainbus_timer_oneshot(uint32_t usecs)
+{
+	if (usecs > MAX_ONESHOT_USECS) {
+		usecs = MAX_ONESHOT_USECS;
+	}
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	mips_timer_set(usecs * (CPU_FREQUENCY / 1000000));
+}
+
+/*
+ * Go back to interrupting HZ times a second.
+ */
+void
+mainbus_timer_periodic(void)
+{
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
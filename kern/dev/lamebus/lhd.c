@@ -36,9 +36,9 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <iosched.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -96,15 +96,81 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the transfer of the next sector of the current request. If
+ * writing, the data has to be put in the on-card buffer first.
+ */
+static
+void
+lhd_startsector(struct lhd_softc *lh)
+{
+	struct ioreq *req = lh->lh_req;
+	uint32_t statval = LHD_WORKING;
+	int result;
+
+	if (req->ior_uio->uio_rw == UIO_WRITE) {
+		/* Can't fail; it's a kernel uio */
+		result = uiomove(lh->lh_buf, LHD_SECTSIZE, req->ior_uio);
+		KASSERT(result == 0);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->ior_block + lh->lh_sectdone);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Start a request. Called by the scheduler when the device is free.
+ */
+static
+void
+lhd_start(void *vlh, struct ioreq *req)
+{
+	struct lhd_softc *lh = vlh;
+
+	KASSERT(lh->lh_req == NULL);
+	KASSERT(req->ior_nblocks > 0);
+
+	lh->lh_req = req;
+	lh->lh_sectdone = 0;
+	lhd_startsector(lh);
+}
+
+/*
+ * Record that a sector has completed. If reading, collect the data
+ * from the on-card buffer. Then go on to the next sector, or if the
+ * request is finished (or failed), hand it back to the scheduler,
+ * which will start the next one.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct ioreq *req = lh->lh_req;
+
+	if (req == NULL) {
+		/* Spurious */
+		return;
+	}
+
+	if (err == 0 && req->ior_uio->uio_rw == UIO_READ) {
+		membar_load_load();
+		err = uiomove(lh->lh_buf, LHD_SECTSIZE, req->ior_uio);
+	}
+
+	if (err == 0) {
+		lh->lh_sectdone++;
+		if (lh->lh_sectdone < req->ior_nblocks) {
+			lhd_startsector(lh);
+			return;
+		}
+	}
+
+	lh->lh_req = NULL;
+	iosched_done(lh->lh_sched, err);
 }
 
 /*
@@ -180,7 +246,8 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * I/O function (for both reads and writes). The request goes through
+ * the scheduler, which starts it with lhd_start when its turn comes.
  */
 static
 int
@@ -192,9 +259,6 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -207,67 +271,55 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
-		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
+	return iosched_io(lh->lh_sched, uio);
+}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+/*
+ * Asynchronous I/O. dev_submit has already checked alignment and
+ * filled in the block range.
+ */
+static
+int
+lhd_submit(struct device *d, struct ioreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
 
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
+	/* Don't allow I/O past the end of the disk. */
+	if (req->ior_block + req->ior_nblocks > lh->lh_dev.d_blocks) {
+		return EINVAL;
+	}
+	if (req->ior_nblocks == 0) {
+		req->ior_result = 0;
+		req->ior_done = true;
+		if (req->ior_callback != NULL) {
+			req->ior_callback(req);
 		}
+		return 0;
 	}
 
+	iosched_submit(lh->lh_sched, req);
 	return 0;
 }
 
+static
+int
+lhd_wait(struct device *d, struct ioreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
+
+	return iosched_wait(lh->lh_sched, req);
+}
+
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_submit = lhd_submit,
+	.devop_wait = lhd_wait,
 };
 
 /*
@@ -284,15 +336,13 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* No request yet. */
+	lh->lh_req = NULL;
+	lh->lh_sectdone = 0;
+
+	/* Create the request scheduler. */
+	lh->lh_sched = iosched_create(name, LHD_SECTSIZE, lhd_start, lh);
+	if (lh->lh_sched == NULL) {
 		return ENOMEM;
 	}
 
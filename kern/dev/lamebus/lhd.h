@@ -51,9 +51,9 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct iosched *lh_sched;	/* Request queue */
+	struct ioreq *lh_req;		/* Request on the device, if any */
+	uint32_t lh_sectdone;		/* Sectors of lh_req done so far */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -655,6 +655,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_isdir,
 	.vop_getdirentry = semfs_getdirentry,
+	.vop_getdirentries = vfs_getdirentries_byname,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_dirstat,
@@ -688,6 +689,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_read = semfs_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
 	.vop_write = semfs_write,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_semstat,
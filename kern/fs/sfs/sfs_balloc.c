@@ -35,42 +35,80 @@
 #include <types.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. There's no need to read the old contents,
+ * so just get a buffer for it and clear that. Blocks that will hold
+ * metadata (META) get the zeros journaled; for data, and indirect
+ * blocks that get journaled as soon as they're filled in, it's enough
+ * that they're written before the next commit.
  */
 static
 int
-sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
+sfs_clearblock(struct sfs_fs *sfs, daddr_t block, bool meta)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct buf *b;
+	int result;
+
+	result = buffer_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero(buffer_map(b), SFS_BLOCKSIZE);
+	buffer_mark_valid(b);
+	if (meta) {
+		return sfs_putbuf(sfs, b, true);
+	}
+	buffer_mark_dirty(b);
+	buffer_release(b);
+	return 0;
+}
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+/*
+ * Note that the freemap bit for BLOCK has changed, so the freemap
+ * block holding it needs to be written.
+ */
+static
+void
+sfs_freemap_dirty(struct sfs_fs *sfs, daddr_t block)
+{
+	uint32_t j = block / SFS_BITSPERBLOCK;
+
+	if (!bitmap_isset(sfs->sfs_freemapdirtyblocks, j)) {
+		bitmap_mark(sfs->sfs_freemapdirtyblocks, j);
+	}
+	sfs->sfs_freemapdirty = true;
 }
 
 /*
- * Allocate a block.
+ * Allocate a block, preferably GOAL or the first free block after it,
+ * so that things allocated together end up together on disk. If
+ * there's nothing free past GOAL, wrap around to the start of the
+ * volume. A GOAL of 0 means no preference.
  */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_balloc_clear(struct sfs_fs *sfs, daddr_t goal, bool meta,
+		 daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	result = bitmap_alloc_hint(sfs->sfs_freemap, goal, diskblock);
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_dirty(sfs, *diskblock);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
 
 	/* Clear block before returning it */
-	result = sfs_clearblock(sfs, *diskblock);
+	result = sfs_clearblock(sfs, *diskblock, meta);
 	if (result) {
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
 	}
@@ -78,13 +116,132 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 }
 
 /*
- * Free a block.
+ * Allocate a block for metadata, such as an inode.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	return sfs_balloc_clear(sfs, goal, true, diskblock);
+}
+
+/*
+ * Allocate a block (data or indirect) for file SV. Blocks are placed
+ * right after the last one allocated for the file, or after the inode
+ * for a new file. If the file is open for writing, the next
+ * SFS_PREALLOC free blocks after the one allocated are set aside so
+ * that concurrent writers don't interleave; later allocations use
+ * them up in order.
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block, goal;
+	unsigned i;
+	bool meta;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	/* Directory contents are metadata */
+	meta = (sv->sv_i.sfi_type == SFS_TYPE_DIR);
+
+	if (sv->sv_pacount > 0) {
+		/* Take the next preallocated block; now it's really used */
+		block = sv->sv_pastart++;
+		sv->sv_pacount--;
+		sfs_freemap_dirty(sfs, block);
+		result = sfs_clearblock(sfs, block, meta);
+		if (result) {
+			sfs_bfree(sfs, block);
+			return result;
+		}
+	}
+	else {
+		goal = sv->sv_allocgoal != 0 ? sv->sv_allocgoal : sv->sv_ino + 1;
+		result = sfs_balloc_clear(sfs, goal, meta, &block);
+		if (result) {
+			return result;
+		}
+
+		if (sv->sv_prealloc) {
+			/* Set aside the free blocks that follow */
+			sv->sv_pastart = block + 1;
+			for (i=0; i<SFS_PREALLOC; i++) {
+				if (block + 1 + i >= sfs->sfs_sb.sb_nblocks ||
+				    bitmap_isset(sfs->sfs_freemap,
+						 block + 1 + i)) {
+					break;
+				}
+				bitmap_mark(sfs->sfs_freemap, block + 1 + i);
+			}
+			sv->sv_pacount = i;
+		}
+	}
+
+	sv->sv_allocgoal = block + 1;
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Give back any blocks preallocated for SV but not used.
+ */
+void
+sfs_prealloc_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	while (sv->sv_pacount > 0) {
+		sfs_bfree(sfs, sv->sv_pastart++);
+		sv->sv_pacount--;
+	}
+}
+
+/*
+ * Fix up the image of freemap block J about to be written: blocks
+ * preallocated for loaded vnodes but not yet taken are free as far
+ * as the disk is concerned.
+ */
+void
+sfs_prealloc_fixfreemap(struct sfs_fs *sfs, uint32_t j, void *data)
+{
+	unsigned char *bits = data;
+	struct sfs_vnode *sv;
+	daddr_t block;
+	unsigned i, k;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<SFS_VNODE_HASHSIZE; i++) {
+		for (sv = sfs->sfs_vnodes[i]; sv != NULL;
+		     sv = sv->sv_hashnext) {
+			for (k=0; k<sv->sv_pacount; k++) {
+				block = sv->sv_pastart + k;
+				if (block / SFS_BITSPERBLOCK != j) {
+					continue;
+				}
+				block %= SFS_BITSPERBLOCK;
+				bits[block / CHAR_BIT] &=
+					~(1 << (block % CHAR_BIT));
+			}
+		}
+	}
+}
+
+/*
+ * Free a block. If the journal still has an image of it, it stays
+ * allocated in memory until the journal is checkpointed.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	if (!sfs_journal_deferfree(sfs, diskblock)) {
+		bitmap_unmark(sfs->sfs_freemap, diskblock);
+	}
+	sfs_freemap_dirty(sfs, diskblock);
 }
 
 /*
@@ -36,37 +36,150 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Walk the indirect block tree whose root pointer is *ROOTP, which
+ * is LEVELS deep (1 for the single indirect block, 2 for the double
+ * indirect block, 3 for the triple), to find block OFFSET within the
+ * region it maps. If DOALLOC is set, allocate any missing indirect
+ * blocks and the data block itself; otherwise a missing block
+ * anywhere along the way yields block 0.
+ *
+ * Each level holds at most one buffer; the one above it is released
+ * before the next is fetched. The lowest-level indirect block, which
+ * maps file blocks from LEAFBASE on, is copied into the vnode's block
+ * map cache on the way out.
+ */
+static
+int
+sfs_bmap_tree(struct sfs_vnode *sv, uint32_t *rootp, unsigned levels,
+	      uint32_t offset, uint32_t leafbase, bool doalloc,
+	      daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf = NULL;
+	bool iddirty = false;
+	uint32_t *iddata;
+	uint32_t *slot;
+	uint32_t span;
+	daddr_t block;
+	unsigned i;
+	int result;
+
+	/* Number of file blocks mapped by each entry of the top block */
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
+	}
+
+	slot = rootp;
+	for (; levels > 0; levels--) {
+		block = *slot;
+
+		if (block == 0 && !doalloc) {
+			/*
+			 * Nothing allocated below here. Pretend the
+			 * missing indirect block was all zeros.
+			 */
+			if (idbuf != NULL) {
+				buffer_release(idbuf);
+			}
+			*diskblock = 0;
+			return 0;
+		}
+		else if (block == 0) {
+			/* Allocate the indirect block (it comes zeroed) */
+			result = sfs_balloc_file(sv, &block);
+			if (result) {
+				if (idbuf != NULL) {
+					sfs_putbuf(sfs, idbuf, iddirty);
+				}
+				return result;
+			}
+
+			/* Remember it in whatever pointed to it */
+			*slot = block;
+			if (idbuf == NULL) {
+				sv->sv_dirty = true;
+			}
+			else {
+				iddirty = true;
+			}
+		}
+
+		/* Done with the parent; move down into this block */
+		if (idbuf != NULL) {
+			result = sfs_putbuf(sfs, idbuf, iddirty);
+			if (result) {
+				return result;
+			}
+		}
+		result = sfs_getbuf(sfs, block, &idbuf);
+		if (result) {
+			return result;
+		}
+		iddirty = false;
+		iddata = buffer_map(idbuf);
+
+		slot = &iddata[offset / span];
+		offset %= span;
+		span /= SFS_DBPERIDB;
+	}
+
+	/* SLOT now points into the lowest-level indirect block */
+	block = *slot;
+	if (block == 0 && doalloc) {
+		result = sfs_balloc_file(sv, &block);
+		if (result) {
+			buffer_release(idbuf);
+			return result;
+		}
+		*slot = block;
+		iddirty = true;
+	}
+
+	/* Remember the whole indirect block for next time */
+	if (sv->sv_bmcache == NULL) {
+		sv->sv_bmcache = kmalloc(SFS_BLOCKSIZE);
+	}
+	if (sv->sv_bmcache != NULL) {
+		memcpy(sv->sv_bmcache, iddata, SFS_BLOCKSIZE);
+		sv->sv_bmcachebase = leafbase;
+		sv->sv_bmcachevalid = true;
+	}
+
+	result = sfs_putbuf(sfs, idbuf, iddirty);
+	if (result) {
+		return result;
+	}
+
+	*diskblock = block;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * Blocks past the direct blocks are found through the single, then
+ * the double, then the triple indirect block.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t *rootp;
+	unsigned levels;
 	daddr_t block;
-	daddr_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t offset;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/*
@@ -82,7 +195,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc_file(sv, &block);
 			if (result) {
 				return result;
 			}
@@ -104,95 +217,148 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * If it's in the indirect block we used last, the cached copy
+	 * has the answer without touching the buffer cache. A hole
+	 * we've been asked to fill still has to go the long way.
 	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	if (sv->sv_bmcachevalid && fileblock >= sv->sv_bmcachebase &&
+	    fileblock - sv->sv_bmcachebase < SFS_DBPERIDB) {
+		block = sv->sv_bmcache[fileblock - sv->sv_bmcachebase];
+		if (block != 0 || !doalloc) {
+			goto done;
+		}
+	}
 
 	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * It's not a direct block. Subtract off the number of direct
+	 * blocks, then the size of each indirect region in turn,
+	 * until OFFSET falls inside one of them.
 	 */
-	if (idnum >= SFS_NINDIRECT) {
-		return EFBIG;
+	offset = fileblock - SFS_NDIRECT;
+	if (offset < SFS_DBPERIDB) {
+		rootp = &sv->sv_i.sfi_indirect;
+		levels = 1;
+	}
+	else {
+		offset -= SFS_DBPERIDB;
+		if (offset < SFS_DBPERIDB * SFS_DBPERIDB) {
+			rootp = &sv->sv_i.sfi_dindirect;
+			levels = 2;
+		}
+		else {
+			offset -= SFS_DBPERIDB * SFS_DBPERIDB;
+			if (offset >= SFS_DBPERIDB * SFS_DBPERIDB *
+			    SFS_DBPERIDB) {
+				/* Past the end of the triple indirect block */
+				return EFBIG;
+			}
+			rootp = &sv->sv_i.sfi_tindirect;
+			levels = 3;
+		}
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
-
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
-		return 0;
+	result = sfs_bmap_tree(sv, rootp, levels, offset,
+			       fileblock - offset % SFS_DBPERIDB,
+			       doalloc, &block);
+	if (result) {
+		return result;
 	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
-		if (result) {
-			return result;
-		}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+ done:
+	/* Hand back the result and return. */
+	if (block != 0 && !sfs_bused(sfs, block)) {
+		panic("sfs: Data block %u (block %u of file %u) marked free\n",
+		      block, fileblock, sv->sv_ino);
+	}
+	*diskblock = block;
+	return 0;
+}
 
-		/* Mark the inode dirty */
-		sv->sv_dirty = true;
+/*
+ * Truncate the indirect block tree whose root pointer is *BLOCKP,
+ * which is LEVELS deep and whose first entry maps file block BASE,
+ * discarding every data block at or past BLOCKLEN. Indirect blocks
+ * left empty are freed too, and *BLOCKP is cleared if the whole tree
+ * goes; *CHANGED is set if *BLOCKP was modified.
+ *
+ * Subtrees lying entirely below BLOCKLEN are skipped without being
+ * read, so shrinking a large file only touches its tail.
+ */
+static
+int
+sfs_itrunc_tree(struct sfs_fs *sfs, uint32_t *blockp, unsigned levels,
+		uint32_t base, uint32_t blocklen, bool *changed)
+{
+	struct buf *idbuf;
+	uint32_t *iddata;
+	uint32_t span, j;
+	bool hasnonzero, iddirty, subchanged;
+	int result;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	if (*blockp == 0) {
+		return 0;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+
+	/* Number of file blocks mapped by each entry of this block */
+	span = 1;
+	for (j=1; j<levels; j++) {
+		span *= SFS_DBPERIDB;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	if (base + span * SFS_DBPERIDB <= blocklen) {
+		/* The whole tree is before the new EOF */
+		return 0;
+	}
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
+	result = sfs_getbuf(sfs, *blockp, &idbuf);
+	if (result) {
+		return result;
+	}
+	iddata = buffer_map(idbuf);
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (iddata[j] != 0 && base + (j+1) * span > blocklen) {
+			/* Some or all of this entry is past the new EOF */
+			if (levels == 1) {
+				sfs_bfree(sfs, iddata[j]);
+				iddata[j] = 0;
+				iddirty = true;
+			}
+			else {
+				subchanged = false;
+				result = sfs_itrunc_tree(sfs, &iddata[j],
+							 levels - 1,
+							 base + j * span,
+							 blocklen,
+							 &subchanged);
+				if (subchanged) {
+					iddirty = true;
+				}
+				if (result) {
+					sfs_putbuf(sfs, idbuf, iddirty);
+					return result;
+				}
+			}
 		}
-
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
-
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+		/* Remember if we see any nonzero blocks in here */
+		if (iddata[j] != 0) {
+			hasnonzero = true;
 		}
 	}
 
-	/* Hand back the result and return. */
-	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: Data block %u (block %u of file %u) marked free\n",
-		      block, fileblock, sv->sv_ino);
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		buffer_release(idbuf);
+		sfs_bfree(sfs, *blockp);
+		*blockp = 0;
+		*changed = true;
+		return 0;
 	}
-	*diskblock = block;
-	return 0;
+
+	/* If the indirect block is dirty, write it back */
+	return sfs_putbuf(sfs, idbuf, iddirty);
 }
 
 /*
@@ -201,101 +367,97 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	uint32_t i;
+	daddr_t block;
+	uint32_t baseblock;
+	bool changed;
 	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
 
 	vfs_biglock_acquire();
 
 	/*
-	 * Go through the direct blocks. Discard any that are
-	 * past the limit we're truncating to.
+	 * An inline file that stays small enough just zeros the tail
+	 * of its inline area; one growing past it moves to a data
+	 * block and carries on below.
 	 */
-	for (i=0; i<SFS_NDIRECT; i++) {
-		block = sv->sv_i.sfi_direct[i];
-		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
-			sv->sv_i.sfi_direct[i] = 0;
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		if (len <= SFS_INLINESIZE) {
+			if (len < (off_t)sv->sv_i.sfi_size) {
+				bzero(sv->sv_i.sfi_inline + len,
+				      sv->sv_i.sfi_size - len);
+			}
+			sv->sv_i.sfi_size = len;
 			sv->sv_dirty = true;
+			vfs_biglock_release();
+			return 0;
 		}
-	}
-
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_uninline(sv);
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
+	}
 
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
+	/* The cached indirect block may be about to change */
+	sv->sv_bmcachevalid = false;
 
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
+	/*
+	 * Go through the triple, double, and single indirect trees,
+	 * each of which starts where the one before it leaves off.
+	 * Work from the end of the file backwards so that if
+	 * something fails we haven't punched a hole in the middle.
+	 */
+	baseblock = SFS_NDIRECT + SFS_DBPERIDB + SFS_DBPERIDB * SFS_DBPERIDB;
+	changed = false;
+	result = sfs_itrunc_tree(sfs, &sv->sv_i.sfi_tindirect, 3,
+				 baseblock, blocklen, &changed);
+	if (result == 0) {
+		baseblock = SFS_NDIRECT + SFS_DBPERIDB;
+		result = sfs_itrunc_tree(sfs, &sv->sv_i.sfi_dindirect, 2,
+					 baseblock, blocklen, &changed);
+	}
+	if (result == 0) {
+		baseblock = SFS_NDIRECT;
+		result = sfs_itrunc_tree(sfs, &sv->sv_i.sfi_indirect, 1,
+					 baseblock, blocklen, &changed);
+	}
+	if (changed) {
+		sv->sv_dirty = true;
+	}
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	/*
+	 * Now the direct blocks. Discard any that are
+	 * past the limit we're truncating to.
+	 */
+	for (i=0; i<SFS_NDIRECT; i++) {
+		block = sv->sv_i.sfi_direct[i];
+		if (i >= blocklen && block != 0) {
+			sfs_bfree(sfs, block);
+			sv->sv_i.sfi_direct[i] = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
 	}
 
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
+	/* A regular file emptied of blocks can start over inline */
+	if (len == 0 && sv->sv_i.sfi_type == SFS_TYPE_FILE) {
+		sv->sv_i.sfi_flags |= SFS_IFLAG_INLINE;
+	}
+
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
 	vfs_biglock_release();
 	return 0;
 }
-
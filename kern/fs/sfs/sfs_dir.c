@@ -27,6 +27,7 @@
  * SUCH DAMAGE.
  */
 
+
 /*
  * SFS filesystem
  *
@@ -36,6 +37,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -95,50 +97,471 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 }
 
 /*
- * Search a directory for a particular filename in a directory, and
- * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * Get the buffer holding block DIRBLOCK of a directory and a pointer
+ * to the entries in it. If the block is a hole (all empty slots) and
+ * DOALLOC isn't set, hand back NULL.
  */
+static
 int
-sfs_dir_findname(struct sfs_vnode *sv, const char *name,
-		uint32_t *ino, int *slot, int *emptyslot)
+sfs_dir_getblock(struct sfs_vnode *sv, unsigned dirblock, bool doalloc,
+		 struct buf **ret, struct sfs_direntry **sds)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t diskblock;
+	int result;
+
+	result = sfs_bmap(sv, dirblock, doalloc, &diskblock);
+	if (result) {
+		return result;
+	}
+	if (diskblock == 0) {
+		*ret = NULL;
+		*sds = NULL;
+		return 0;
+	}
+
+	result = sfs_getbuf(sfs, diskblock, ret);
+	if (result) {
+		return result;
+	}
+	*sds = buffer_map(*ret);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Hashed directories
+
+/*
+ * Hash a name. This must match the definition in <kern/sfs.h>, which
+ * the userland tools also use.
+ */
+static
+uint32_t
+sfs_dir_hash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_INIT;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= SFS_DIRHASH_PRIME;
+	}
+	return h;
+}
+
+static
+bool
+sfs_dir_ishashed(struct sfs_vnode *sv)
+{
+	return (sv->sv_i.sfi_flags & SFS_IFLAG_HASHDIR) != 0;
+}
+
+static
+unsigned
+sfs_dir_nbuckets(struct sfs_vnode *sv)
+{
+	return sv->sv_i.sfi_size / SFS_BLOCKSIZE;
+}
+
+/*
+ * Find an empty slot for NAME in a hashed directory: in its home
+ * bucket, or, if PROBE is set and that's full, in the next bucket
+ * along that has room, in which case the directory is marked as
+ * overflowed. Returns ENOSPC if there's no room.
+ */
+static
+int
+sfs_dir_hashslot(struct sfs_vnode *sv, const char *name, bool probe,
+		 int *slot)
+{
+	struct buf *b;
+	struct sfs_direntry *sds;
+	unsigned nb, home, i, bucket, j;
+	int result;
+
+	nb = sfs_dir_nbuckets(sv);
+	if (nb == 0) {
+		return ENOSPC;
+	}
+	home = sfs_dir_hash(name) & (nb - 1);
+
+	for (i=0; i < (probe ? nb : 1); i++) {
+		bucket = (home + i) & (nb - 1);
+		result = sfs_dir_getblock(sv, bucket, false, &b, &sds);
+		if (result) {
+			return result;
+		}
+		j = 0;
+		if (b != NULL) {
+			while (j < SFS_DIRSLOTSPERBLOCK &&
+			       sds[j].sfd_ino != SFS_NOINO) {
+				j++;
+			}
+			buffer_release(b);
+		}
+		if (j < SFS_DIRSLOTSPERBLOCK) {
+			*slot = bucket * SFS_DIRSLOTSPERBLOCK + j;
+			if (i > 0) {
+				sv->sv_i.sfi_flags |= SFS_IFLAG_DIROVFL;
+				sv->sv_dirty = true;
+			}
+			return 0;
+		}
+	}
+	return ENOSPC;
+}
+
+/*
+ * Double the number of buckets in a hashed directory. With twice as
+ * many buckets, each entry in bucket B belongs either in B or in the
+ * new bucket B+NB, so this is one pass over the old buckets. Entries
+ * that had overflowed out of their home bucket stay where they are;
+ * if there weren't any, the directory is no longer overflowed.
+ */
+static
+int
+sfs_dir_grow(struct sfs_vnode *sv)
 {
-	struct sfs_direntry tsd;
-	int found, nentries, i, result;
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *ob, *nbuf;
+	struct sfs_direntry *osds, *nsds;
+	unsigned nb, bucket, j, k, nstrays;
+	uint32_t hash;
+	daddr_t diskblock;
+	int result;
+
+	nb = sfs_dir_nbuckets(sv);
+	if (nb * 2 > SFS_DIRHASH_MAXBUCKETS) {
+		return EFBIG;
+	}
+
+	/*
+	 * Allocate the new buckets first (they come zeroed), so that
+	 * if we run out of space nothing has changed.
+	 */
+	for (bucket = nb; bucket < (nb == 0 ? 1 : 2*nb); bucket++) {
+		result = sfs_bmap(sv, bucket, true, &diskblock);
+		if (result) {
+			(void)sfs_itrunc(sv, (off_t)nb * SFS_BLOCKSIZE);
+			return result;
+		}
+	}
+	sv->sv_i.sfi_size = (nb == 0 ? 1 : 2*nb) * SFS_BLOCKSIZE;
+	sv->sv_dirty = true;
+
+	nstrays = 0;
+	for (bucket = 0; bucket < nb; bucket++) {
+		result = sfs_dir_getblock(sv, bucket, false, &ob, &osds);
+		if (result) {
+			return result;
+		}
+		if (ob == NULL) {
+			continue;
+		}
+		result = sfs_dir_getblock(sv, bucket + nb, false, &nbuf, &nsds);
+		if (result) {
+			buffer_release(ob);
+			return result;
+		}
+		KASSERT(nbuf != NULL);
+
+		k = 0;
+		for (j=0; j<SFS_DIRSLOTSPERBLOCK; j++) {
+			if (osds[j].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			hash = sfs_dir_hash(osds[j].sfd_name);
+			if ((hash & (nb - 1)) != bucket) {
+				nstrays++;
+			}
+			else if ((hash & (2*nb - 1)) != bucket) {
+				nsds[k++] = osds[j];
+				bzero(&osds[j], sizeof(osds[j]));
+			}
+		}
+
+		sfs_putbuf(sfs, nbuf, k > 0);
+		sfs_putbuf(sfs, ob, k > 0);
+	}
+
+	if (nstrays == 0 &&
+	    (sv->sv_i.sfi_flags & SFS_IFLAG_DIROVFL) != 0) {
+		sv->sv_i.sfi_flags &= ~SFS_IFLAG_DIROVFL;
+		sv->sv_dirty = true;
+	}
+	return 0;
+}
+
+/*
+ * Turn a linear directory into a hashed one with enough buckets to
+ * be about half full: read all the entries, lay them out by hash in
+ * memory, and write that over the directory. The memory and disk
+ * space needed are all gotten before anything is overwritten, so
+ * failing with ENOMEM, ENOSPC, or EFBIG leaves the directory as it
+ * was.
+ */
+static
+int
+sfs_dir_convert(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_direntry *ents, *newsds;
+	struct sfs_direntry *sds;
+	struct buf *b;
+	int nentries, nlive, i;
+	unsigned nb, oldnb, bucket, home, j, k;
+	off_t oldsize;
+	daddr_t diskblock;
+	bool ovfl;
+	int result;
 
 	nentries = sfs_dir_nentries(sv);
+	KASSERT(nentries > 0);
+
+	ents = kmalloc(nentries * sizeof(*ents));
+	if (ents == NULL) {
+		return ENOMEM;
+	}
 
-	/* For each slot... */
-	found = 0;
+	nlive = 0;
 	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &ents[nlive]);
+		if (result) {
+			kfree(ents);
+			return result;
+		}
+		if (ents[nlive].sfd_ino != SFS_NOINO) {
+			nlive++;
+		}
+	}
+
+	/* Leave room for the entry we're about to add, too */
+	nb = 1;
+	while (nb * SFS_DIRSLOTSPERBLOCK < 2 * ((unsigned)nlive + 1)) {
+		nb *= 2;
+	}
+	if (nb > SFS_DIRHASH_MAXBUCKETS) {
+		kfree(ents);
+		return EFBIG;
+	}
+
+	/*
+	 * Place each entry the way sfs_dir_hashslot would: in its
+	 * home bucket, or failing that the next one with room. At
+	 * most half full, there's always room somewhere.
+	 */
+	newsds = kmalloc(nb * SFS_BLOCKSIZE);
+	if (newsds == NULL) {
+		kfree(ents);
+		return ENOMEM;
+	}
+	bzero(newsds, nb * SFS_BLOCKSIZE);
+	ovfl = false;
+	for (i=0; i<nlive; i++) {
+		home = sfs_dir_hash(ents[i].sfd_name) & (nb - 1);
+		for (k=0; k<nb; k++) {
+			sds = &newsds[((home + k) & (nb - 1)) *
+				      SFS_DIRSLOTSPERBLOCK];
+			for (j=0; j<SFS_DIRSLOTSPERBLOCK; j++) {
+				if (sds[j].sfd_ino == SFS_NOINO) {
+					break;
+				}
+			}
+			if (j < SFS_DIRSLOTSPERBLOCK) {
+				break;
+			}
+		}
+		KASSERT(k < nb);
+		if (k > 0) {
+			ovfl = true;
+		}
+		sds[j] = ents[i];
+	}
+	kfree(ents);
+
+	/*
+	 * Allocate all NB blocks, including any holes, so that running
+	 * out of space here changes nothing (new blocks come zeroed,
+	 * and any past the old end are given back).
+	 */
+	oldsize = sv->sv_i.sfi_size;
+	oldnb = DIVROUNDUP(oldsize, SFS_BLOCKSIZE);
+	for (bucket = 0; bucket < nb; bucket++) {
+		result = sfs_bmap(sv, bucket, true, &diskblock);
+		if (result) {
+			if (nb > oldnb) {
+				(void)sfs_itrunc(sv, oldsize);
+			}
+			kfree(newsds);
+			return result;
+		}
+	}
 
-		/* Read the entry from that slot */
-		result = sfs_readdir(sv, i, &tsd);
+	/* Now write the new layout over the directory. */
+	for (bucket = 0; bucket < nb; bucket++) {
+		result = sfs_dir_getblock(sv, bucket, false, &b, &sds);
 		if (result) {
+			/*
+			 * Too late to put things back; sfsck will
+			 * find the lost files.
+			 */
+			kfree(newsds);
 			return result;
 		}
-		if (tsd.sfd_ino == SFS_NOINO) {
+		KASSERT(b != NULL);
+		memcpy(sds, &newsds[bucket * SFS_DIRSLOTSPERBLOCK],
+		       SFS_BLOCKSIZE);
+		sfs_putbuf(sfs, b, true);
+	}
+	kfree(newsds);
+
+	sv->sv_i.sfi_size = nb * SFS_BLOCKSIZE;
+	sv->sv_i.sfi_flags |= SFS_IFLAG_HASHDIR;
+	if (ovfl) {
+		sv->sv_i.sfi_flags |= SFS_IFLAG_DIROVFL;
+	}
+	else {
+		sv->sv_i.sfi_flags &= ~SFS_IFLAG_DIROVFL;
+	}
+	sv->sv_dirty = true;
+
+	/*
+	 * Every entry past the new end has been moved already, so if
+	 * giving back the blocks there fails they just leak until the
+	 * volume is checked.
+	 */
+	if (oldnb > nb) {
+		(void)sfs_itrunc(sv, (off_t)nb * SFS_BLOCKSIZE);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Lookup and update
+
+/*
+ * Check if the name in a directory entry is NAME. The on-disk name
+ * might not be null-terminated, so don't run off the end of it.
+ */
+static
+bool
+sfs_dir_namematch(const struct sfs_direntry *sd, const char *name)
+{
+	size_t i;
+
+	for (i=0; i<sizeof(sd->sfd_name); i++) {
+		if (sd->sfd_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Search slots FIRST through LAST-1 of a directory for NAME, a block
+ * at a time, as for sfs_dir_findname. Sets *FOUND if it's there.
+ */
+static
+int
+sfs_dir_search(struct sfs_vnode *sv, int first, int last, const char *name,
+	       uint32_t *ino, int *slot, int *emptyslot, bool *found)
+{
+	struct buf *b = NULL;
+	struct sfs_direntry *sds = NULL;
+	int i, j;
+	int result;
+
+	for (i=first; i<last; i++) {
+		j = i % SFS_DIRSLOTSPERBLOCK;
+		if (i == first || j == 0) {
+			if (b != NULL) {
+				buffer_release(b);
+			}
+			result = sfs_dir_getblock(sv, i / SFS_DIRSLOTSPERBLOCK,
+						  false, &b, &sds);
+			if (result) {
+				return result;
+			}
+		}
+
+		if (b == NULL || sds[j].sfd_ino == SFS_NOINO) {
 			/* Free slot - report it back if one was requested */
 			if (emptyslot != NULL) {
 				*emptyslot = i;
 			}
+			continue;
 		}
-		else {
-			/* Ensure null termination, just in case */
-			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
-			if (!strcmp(tsd.sfd_name, name)) {
 
-				/* Each name may legally appear only once... */
-				KASSERT(found==0);
+		if (sfs_dir_namematch(&sds[j], name)) {
 
-				found = 1;
-				if (slot != NULL) {
-					*slot = i;
-				}
-				if (ino != NULL) {
-					*ino = tsd.sfd_ino;
-				}
+			/* Each name may legally appear only once... */
+			KASSERT(*found == false);
+
+			*found = true;
+			if (slot != NULL) {
+				*slot = i;
 			}
+			if (ino != NULL) {
+				*ino = sds[j].sfd_ino;
+			}
+		}
+	}
+
+	if (b != NULL) {
+		buffer_release(b);
+	}
+	return 0;
+}
+
+/*
+ * Search a directory for a particular filename in a directory, and
+ * return its inode number, its slot, and/or the slot number of an
+ * empty directory slot if one is found.
+ *
+ * In a hashed directory only the name's home bucket is searched
+ * (unless the directory has overflowed and the name isn't there),
+ * and only an empty slot in the home bucket is reported.
+ */
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		uint32_t *ino, int *slot, int *emptyslot)
+{
+	bool found = false;
+	int nentries, first;
+	unsigned nb;
+	int result;
+
+	nentries = sfs_dir_nentries(sv);
+
+	if (!sfs_dir_ishashed(sv)) {
+		result = sfs_dir_search(sv, 0, nentries, name,
+					ino, slot, emptyslot, &found);
+		if (result) {
+			return result;
+		}
+		return found ? 0 : ENOENT;
+	}
+
+	nb = sfs_dir_nbuckets(sv);
+	if (nb == 0) {
+		return ENOENT;
+	}
+
+	first = (sfs_dir_hash(name) & (nb - 1)) * SFS_DIRSLOTSPERBLOCK;
+	result = sfs_dir_search(sv, first, first + SFS_DIRSLOTSPERBLOCK, name,
+				ino, slot, emptyslot, &found);
+	if (result) {
+		return result;
+	}
+
+	if (!found && (sv->sv_i.sfi_flags & SFS_IFLAG_DIROVFL) != 0) {
+		/* It could be anywhere */
+		result = sfs_dir_search(sv, 0, nentries, name,
+					ino, slot, NULL, &found);
+		if (result) {
+			return result;
 		}
 	}
 
@@ -148,12 +571,15 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
+ *
+ * This may move other entries around (when a hashed directory
+ * grows), so slots gotten before calling it are no longer valid.
  */
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
 	int emptyslot = -1;
-	int result;
+	int result, growresult;
 	struct sfs_direntry sd;
 
 	/* Look up the name. We want to make sure it *doesn't* exist. */
@@ -169,8 +595,44 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
-	if (emptyslot < 0) {
+	/*
+	 * If a linear directory is full and big, index it instead of
+	 * making it bigger. If it's too big to convert, or there isn't
+	 * room, leave it be.
+	 */
+	if (!sfs_dir_ishashed(sv) && emptyslot < 0 &&
+	    sfs_dir_nentries(sv) >= (int)SFS_DIRHASH_THRESHOLD) {
+		result = sfs_dir_convert(sv);
+		if (result && result != ENOMEM && result != EFBIG &&
+		    result != ENOSPC) {
+			return result;
+		}
+	}
+
+	if (sfs_dir_ishashed(sv)) {
+		if (emptyslot < 0) {
+			/*
+			 * The name's bucket is full (or this was just
+			 * converted). Try it again, growing the
+			 * directory if it's still full; failing that,
+			 * put it in another bucket.
+			 */
+			result = sfs_dir_hashslot(sv, name, false, &emptyslot);
+			if (result == ENOSPC) {
+				growresult = sfs_dir_grow(sv);
+				result = sfs_dir_hashslot(sv, name, true,
+							  &emptyslot);
+				if (result == ENOSPC && growresult) {
+					result = growresult;
+				}
+			}
+			if (result) {
+				return result;
+			}
+		}
+	}
+	else if (emptyslot < 0) {
+		/* If we didn't get an empty slot, add the entry at the end. */
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -204,6 +666,52 @@ sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 	return sfs_writedir(sv, slot, &sd);
 }
 
+/*
+ * Find the first entry in use at or after slot *SLOT, for reading a
+ * directory. Hands back the slot in *SLOT and the entry in SD, or -1
+ * in *SLOT if there are no more entries.
+ */
+int
+sfs_dir_next(struct sfs_vnode *sv, int *slot, struct sfs_direntry *sd)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_direntry *sds;
+	struct buf *b;
+	int s, nentries;
+	unsigned dirblock, i;
+	int result;
+
+	nentries = sfs_dir_nentries(sv);
+	s = *slot;
+
+	while (s < nentries) {
+		dirblock = s / SFS_DIRSLOTSPERBLOCK;
+		result = sfs_dir_getblock(sv, dirblock, false, &b, &sds);
+		if (result) {
+			return result;
+		}
+		if (b == NULL) {
+			/* A hole; nothing in this block */
+			s = (dirblock + 1) * SFS_DIRSLOTSPERBLOCK;
+			continue;
+		}
+		for (i = s % SFS_DIRSLOTSPERBLOCK;
+		     i < SFS_DIRSLOTSPERBLOCK && s < nentries; i++, s++) {
+			if (sds[i].sfd_ino != SFS_NOINO) {
+				*sd = sds[i];
+				sd->sfd_name[sizeof(sd->sfd_name)-1] = 0;
+				sfs_putbuf(sfs, b, false);
+				*slot = s;
+				return 0;
+			}
+		}
+		sfs_putbuf(sfs, b, false);
+	}
+
+	*slot = -1;
+	return 0;
+}
+
 /*
  * Look for a name in a directory and hand back a vnode for the
  * file, if there is one.
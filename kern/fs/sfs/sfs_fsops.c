@@ -41,6 +41,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -52,8 +53,9 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reads do the whole bitmap at once (this happens at mount); writes
+ * do only the blocks marked in sfs_freemapdirtyblocks, since most
+ * syncs change just one or two of them.
  *
  * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
  * sectors of bits, one bit for each sector on the filesystem. The
@@ -66,6 +68,12 @@
  *
  * The sectors used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
+ *
+ * With a journal, blocks whose frees are deferred (see sfs_journal.c)
+ * are written as free. So are blocks preallocated for files being
+ * written (see sfs_balloc_file): they are marked in the in-memory
+ * freemap only to keep other allocations off them, and are not in
+ * use until a file actually takes one.
  */
 static
 int
@@ -73,6 +81,7 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 {
 	uint32_t j, freemapblocks;
 	char *freemapdata;
+	struct buf *b;
 	int result;
 
 	/* Number of blocks in the free block bitmap. */
@@ -84,6 +93,12 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 	/* For each block in the free block bitmap... */
 	for (j=0; j<freemapblocks; j++) {
 
+		/* Skip it if writing and it hasn't changed */
+		if (rw == UIO_WRITE &&
+		    !bitmap_isset(sfs->sfs_freemapdirtyblocks, j)) {
+			continue;
+		}
+
 		/* Get a pointer to its data */
 		void *ptr = freemapdata + j*SFS_BLOCKSIZE;
 
@@ -93,14 +108,30 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 					       SFS_BLOCKSIZE);
 		}
 		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
+			result = buffer_get(sfs->sfs_device,
+					    SFS_FREEMAP_START+j, &b);
+			if (result == 0) {
+				memcpy(buffer_map(b), ptr, SFS_BLOCKSIZE);
+				sfs_journal_fixfreemap(sfs, j, buffer_map(b));
+				sfs_prealloc_fixfreemap(sfs, j, buffer_map(b));
+				buffer_mark_valid(b);
+				result = sfs_putbuf(sfs, b, true);
+			}
 		}
 
 		/* If we failed, stop. */
 		if (result) {
 			return result;
 		}
+
+		if (rw == UIO_WRITE) {
+			bitmap_unmark(sfs->sfs_freemapdirtyblocks, j);
+		}
+	}
+
+	/* The bitmap's search summary needs rebuilding after a read */
+	if (rw == UIO_READ) {
+		bitmap_datachanged(sfs->sfs_freemap);
 	}
 	return 0;
 }
@@ -114,7 +145,8 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs;
-	unsigned i, num;
+	struct sfs_vnode *sv;
+	unsigned i;
 	int result;
 
 	vfs_biglock_acquire();
@@ -151,11 +183,28 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	/*
+	 * Go over the table of loaded vnodes, writing their inodes into
+	 * the buffer cache as we go. (Not VOP_FSYNC, which would flush
+	 * the whole cache once per vnode; we do that once below.)
+	 *
+	 * Also give back their unused preallocated blocks. Vnodes can
+	 * stay loaded long after the last writer has closed them (the
+	 * name cache holds references), and the windows would otherwise
+	 * be lost until reclaim. A file still being written just sets
+	 * aside a new window on its next allocation, normally right
+	 * where the old one was.
+	 */
+	for (i=0; i<SFS_VNODE_HASHSIZE; i++) {
+		for (sv = sfs->sfs_vnodes[i]; sv != NULL;
+		     sv = sv->sv_hashnext) {
+			sfs_prealloc_release(sv);
+			result = sfs_sync_inode(sv);
+			if (result) {
+				vfs_biglock_release();
+				return result;
+			}
+		}
 	}
 
 	/* If the free block map needs to be written, write it. */
@@ -179,10 +228,53 @@ sfs_sync(struct fs *fs)
 		sfs->sfs_superdirty = false;
 	}
 
+	/*
+	 * Finally, push out anything still dirty in the buffer cache.
+	 * With a journal, the metadata changed since the last sync is
+	 * held back, and gets committed to the log only after the file
+	 * data it refers to is on disk. Metadata from earlier
+	 * transactions is safe in the log already and can wait.
+	 */
+	if (sfs->sfs_jslots > 0) {
+		result = buffer_sync_unlogged(sfs->sfs_device);
+		if (result == 0) {
+			result = sfs_journal_commit(sfs);
+		}
+	}
+	else {
+		result = buffer_sync(sfs->sfs_device);
+	}
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Write the superblock and get it to disk (or committed to the
+ * journal) right away, for changes to sb_flags that must not wait
+ * for the syncer.
+ */
+static
+int
+sfs_writesuper(struct sfs_fs *sfs)
+{
+	int result;
+
+	result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				sizeof(sfs->sfs_sb));
+	if (result) {
+		return result;
+	}
+	if (sfs->sfs_jslots > 0) {
+		return sfs_journal_commit(sfs);
+	}
+	return buffer_sync(sfs->sfs_device);
+}
+
 /*
  * Routine to retrieve the volume name. Filesystems can be referred
  * to by their volume name followed by a colon as well as the name
@@ -212,7 +304,11 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	if (sfs->sfs_freemapdirtyblocks != NULL) {
+		bitmap_destroy(sfs->sfs_freemapdirtyblocks);
+	}
+	sfs_journal_cleanup(sfs);
+	KASSERT(sfs->sfs_nvnodes == 0);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -227,11 +323,12 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
 	vfs_biglock_acquire();
 
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
+	if (sfs->sfs_nvnodes > 0) {
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -240,6 +337,28 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Record that the volume was unmounted cleanly */
+	sfs->sfs_sb.sb_flags |= SFS_SB_CLEAN;
+	result = sfs_writesuper(sfs);
+
+	/* Empty the journal, and write home what it left in the cache */
+	if (result == 0) {
+		result = sfs_journal_checkpoint(sfs);
+	}
+	if (result == 0 && sfs->sfs_jslots > 0) {
+		result = buffer_sync(sfs->sfs_device);
+	}
+	if (result) {
+		/* Still mounted; put the flag back the way it was */
+		sfs->sfs_sb.sb_flags &= ~SFS_SB_CLEAN;
+		sfs->sfs_superdirty = true;
+		vfs_biglock_release();
+		return result;
+	}
+
+	/* Discard our cached blocks */
+	buffer_drop(sfs->sfs_device);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -271,6 +390,7 @@ struct sfs_fs *
 sfs_fs_create(void)
 {
 	struct sfs_fs *sfs;
+	unsigned i;
 
 	/*
 	 * Make sure our on-disk structures aren't messed up
@@ -301,19 +421,32 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
-		goto cleanup_object;
+	for (i=0; i<SFS_VNODE_HASHSIZE; i++) {
+		sfs->sfs_vnodes[i] = NULL;
 	}
+	sfs->sfs_nvnodes = 0;
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemapdirtyblocks = NULL;
+
+	/* journal (none until mount finds one) */
+	sfs->sfs_jslots = 0;
+	sfs->sfs_jhead = 0;
+	sfs->sfs_jfirstseq = 0;
+	sfs->sfs_jseq = 0;
+	sfs->sfs_jbufs = NULL;
+	sfs->sfs_jmaxbufs = 0;
+	sfs->sfs_joverflow = false;
+	sfs->sfs_jlogged = NULL;
+	sfs->sfs_jdeferred = NULL;
+	sfs->sfs_jndeferred = 0;
+	sfs->sfs_jmaxdeferred = 0;
+	sfs->sfs_jstage = NULL;
 
 	return sfs;
 
-cleanup_object:
-	kfree(sfs);
 fail:
 	return NULL;
 }
@@ -337,6 +470,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
+	bool recovered;
 
 	vfs_biglock_acquire();
 
@@ -371,9 +505,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 			       sizeof(sfs->sfs_sb));
 	if (result) {
-		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
-		return result;
+		goto fail;
 	}
 
 	/* Make some simple sanity checks */
@@ -383,9 +515,8 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n",
 			sfs->sfs_sb.sb_magic,
 			SFS_MAGIC);
-		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
-		return EINVAL;
+		result = EINVAL;
+		goto fail;
 	}
 
 	if (sfs->sfs_sb.sb_nblocks > dev->d_blocks) {
@@ -396,18 +527,43 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Set up the journal, replaying anything committed to it */
+	result = sfs_journal_mount(sfs, &recovered);
+	if (result) {
+		goto fail;
+	}
+	if (recovered) {
+		/* Recovery wrote to the disk directly; start over */
+		buffer_drop(dev);
+		result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				       sizeof(sfs->sfs_sb));
+		if (result) {
+			goto fail;
+		}
+		sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
-	if (sfs->sfs_freemap == NULL) {
-		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
-		return ENOMEM;
+	sfs->sfs_freemapdirtyblocks =
+		bitmap_create(SFS_FS_FREEMAPBLOCKS(sfs));
+	if (sfs->sfs_freemap == NULL ||
+	    sfs->sfs_freemapdirtyblocks == NULL) {
+		result = ENOMEM;
+		goto fail;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
-		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
-		return result;
+		goto fail;
+	}
+
+	/* Until it is unmounted again, the volume may need checking */
+	if (sfs->sfs_sb.sb_flags & SFS_SB_CLEAN) {
+		sfs->sfs_sb.sb_flags &= ~SFS_SB_CLEAN;
+		result = sfs_writesuper(sfs);
+		if (result) {
+			goto fail;
+		}
 	}
 
 	/* Hand back the abstract fs */
@@ -415,6 +571,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	vfs_biglock_release();
 	return 0;
+
+ fail:
+	/* Don't leave blocks of a volume we didn't mount in the cache */
+	buffer_drop(dev);
+	sfs->sfs_device = NULL;
+	sfs_fs_destroy(sfs);
+	vfs_biglock_release();
+	return result;
 }
 
 /*
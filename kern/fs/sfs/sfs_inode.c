@@ -36,10 +36,55 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
+/*
+ * Vnode table. Loaded vnodes are kept in hash chains by inode number;
+ * each vnode knows the link that points to it, so it can be taken out
+ * without searching.
+ */
+static
+unsigned
+sfs_vnode_hash(uint32_t ino)
+{
+	return ino & (SFS_VNODE_HASHSIZE - 1);
+}
+
+static
+void
+sfs_vnode_insert(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **head;
+
+	head = &sfs->sfs_vnodes[sfs_vnode_hash(sv->sv_ino)];
+	sv->sv_hashnext = *head;
+	if (*head != NULL) {
+		(*head)->sv_hashprevp = &sv->sv_hashnext;
+	}
+	sv->sv_hashprevp = head;
+	*head = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnode_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(*sv->sv_hashprevp == sv);
+	KASSERT(sfs->sfs_nvnodes > 0);
+
+	*sv->sv_hashprevp = sv->sv_hashnext;
+	if (sv->sv_hashnext != NULL) {
+		sv->sv_hashnext->sv_hashprevp = sv->sv_hashprevp;
+	}
+	sv->sv_hashnext = NULL;
+	sv->sv_hashprevp = NULL;
+	sfs->sfs_nvnodes--;
+}
+
 /*
  * Write an on-disk inode structure back out to disk.
  */
@@ -70,7 +115,6 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
 	vfs_biglock_acquire();
@@ -93,6 +137,9 @@ sfs_reclaim(struct vnode *v)
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/* Give back any blocks set aside for writing */
+	sfs_prealloc_release(sv);
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
@@ -115,27 +162,18 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
+	if (sv->sv_hashprevp == NULL) {
 		panic("sfs: reclaim vnode %u not in vnode pool\n",
 		      sv->sv_ino);
 	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnode_remove(sfs, sv);
 
 	vnode_cleanup(&sv->sv_absvn);
 
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
+	kfree(sv->sv_bmcache);
 	kfree(sv);
 
 	/* Done */
@@ -150,29 +188,22 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
 	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
-
-		/* Every inode in memory must be in an allocated block */
-		if (!sfs_bused(sfs, sv->sv_ino)) {
-			panic("sfs: Found inode %u in unallocated block\n",
-			      sv->sv_ino);
-		}
-
+	for (sv = sfs->sfs_vnodes[sfs_vnode_hash(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
 		if (sv->sv_ino==ino) {
 			/* Found */
 
+			/* Every inode in memory must be in an allocated block */
+			if (!sfs_bused(sfs, sv->sv_ino)) {
+				panic("sfs: Found inode %u in unallocated "
+				      "block\n", sv->sv_ino);
+			}
+
 			/* forcetype is only allowed when creating objects */
 			KASSERT(forcetype==SFS_TYPE_INVAL);
 
@@ -205,6 +236,22 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No reads yet; a first read at the start looks sequential */
+	sv->sv_ranext = 0;
+	sv->sv_raissued = 0;
+	sv->sv_rawindow = 0;
+
+	/* Nothing allocated or set aside yet */
+	sv->sv_allocgoal = 0;
+	sv->sv_prealloc = false;
+	sv->sv_pastart = 0;
+	sv->sv_pacount = 0;
+
+	/* No indirect block cached */
+	sv->sv_bmcache = NULL;
+	sv->sv_bmcachebase = 0;
+	sv->sv_bmcachevalid = false;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out by sfs_balloc and
@@ -214,6 +261,10 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		KASSERT(sv->sv_i.sfi_type == SFS_TYPE_INVAL);
 		sv->sv_i.sfi_type = forcetype;
 		sv->sv_dirty = true;
+		if (forcetype == SFS_TYPE_FILE) {
+			/* New files start out inline */
+			sv->sv_i.sfi_flags |= SFS_IFLAG_INLINE;
+		}
 	}
 
 	/*
@@ -243,12 +294,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnode_insert(sfs, sv);
 
 	/* Hand it back */
 	*ret = sv;
@@ -256,20 +302,52 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 }
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Get the type (SFS_TYPE_*) of inode INO without loading a vnode for
+ * it. A loaded vnode's copy is used if there is one, since the type
+ * of a new object may not have been written back yet.
+ */
+int
+sfs_inodetype(struct sfs_fs *sfs, uint32_t ino, int *type)
+{
+	struct sfs_vnode *sv;
+	struct buf *b;
+	int result;
+
+	for (sv = sfs->sfs_vnodes[sfs_vnode_hash(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			*type = sv->sv_i.sfi_type;
+			return 0;
+		}
+	}
+
+	result = sfs_getbuf(sfs, ino, &b);
+	if (result) {
+		return result;
+	}
+	*type = ((struct sfs_dinode *)buffer_map(b))->sfi_type;
+	return sfs_putbuf(sfs, b, false);
+}
+
+/*
+ * Create a new filesystem object in directory DIR and hand back its
+ * vnode.
  */
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, struct sfs_vnode *dir, int type,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
 
 	/*
 	 * First, get an inode. (Each inode is a block, and the inode
-	 * number is the block number, so just get a block.)
+	 * number is the block number, so just get a block.) Put it
+	 * near the directory's inode so lookups and the files in the
+	 * directory stay close together.
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, dir->sv_ino + 1, &ino);
 	if (result) {
 		return result;
 	}
@@ -38,6 +38,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -46,6 +47,10 @@
 // Basic block-level I/O routines
 
 /*
+ * All block I/O goes through the buffer cache (see buf.h); these
+ * routines copy whole blocks in and out of it for callers that want
+ * their own copy, such as the superblock and inodes.
+ *
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
@@ -53,79 +58,74 @@
  */
 
 /*
- * Read or write a block, retrying I/O errors.
+ * Read a block.
  */
-static
 int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
+	struct buf *b;
 	int result;
-	int tries=0;
-
-	KASSERT(vfs_biglock_do_i_hold());
 
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	KASSERT(len == SFS_BLOCKSIZE);
 
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
-	if (result == EINVAL) {
-		/*
-		 * This means the sector we requested was out of range,
-		 * or the seek address we gave wasn't sector-aligned,
-		 * or a couple of other things that are our fault.
-		 */
-		panic("sfs: DEVOP_IO returned EINVAL\n");
-	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: block %llu I/O error, retrying\n",
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
-		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
-		}
-		else {
-			kprintf("sfs: block %llu I/O error, giving up after "
-				"%d retries\n",
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
-		}
+	result = buffer_read(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
 	}
-	return result;
+	memcpy(data, buffer_map(b), len);
+	buffer_release(b);
+	return 0;
 }
 
 /*
- * Read a block.
+ * Write a block of metadata. This only puts it in the buffer cache
+ * (and the open journal transaction, if any); it goes to disk when
+ * the syncer or an fsync gets to it.
  */
 int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *b;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = buffer_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(buffer_map(b), data, len);
+	buffer_mark_valid(b);
+	buffer_mark_dirty(b);
+	sfs_journal_add(sfs, b);
+	buffer_release(b);
+	return 0;
 }
 
 /*
- * Write a block.
+ * Get the buffer for a block of metadata, reading it if needed. The
+ * caller modifies it in place and releases it with sfs_putbuf.
  */
 int
-sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_getbuf(struct sfs_fs *sfs, daddr_t block, struct buf **ret)
 {
-	struct iovec iov;
-	struct uio ku;
-
-	KASSERT(len == SFS_BLOCKSIZE);
+	return buffer_read(sfs->sfs_device, block, ret);
+}
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+/*
+ * Release a buffer from sfs_getbuf. If DIRTY is set, the contents
+ * were changed and need to be written back eventually, and go in the
+ * journal.
+ */
+int
+sfs_putbuf(struct sfs_fs *sfs, struct buf *b, bool dirty)
+{
+	if (dirty) {
+		buffer_mark_dirty(b);
+		sfs_journal_add(sfs, b);
+	}
+	buffer_release(b);
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -133,32 +133,27 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 // File-level I/O
 
 /*
- * Do I/O to a block of a file that doesn't cover the whole block.  We
- * need to read in the original block first, even if we're writing, so
- * we don't clobber the portion of the block we're not intending to
- * write over.
+ * Do I/O to one block of a file, through the buffer cache.
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
  * the sector; LEN is the number of bytes to actually read or write.
  * UIO is the area to do the I/O into.
+ *
+ * If we're writing only part of the block, we need to read in the
+ * original block first so we don't clobber the portion we're not
+ * intending to write over. If we're writing the whole thing, we
+ * don't.
  */
 static
 int
-sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
-	      uint32_t skipstart, uint32_t len)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio,
+	    uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
+	bool wholeblock;
 	int result;
 
 	/* Allocate missing blocks if and only if we're writing */
@@ -166,9 +161,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -181,107 +173,268 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * We must be reading, or sfs_bmap would have allocated
+		 * a block for us, so just produce zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		return uiomovezeros(len, uio);
+	}
+
+	wholeblock = (skipstart == 0 && len == SFS_BLOCKSIZE);
+	if (uio->uio_rw == UIO_WRITE && wholeblock) {
+		result = buffer_get(sfs->sfs_device, diskblock, &b);
 	}
 	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		result = buffer_read(sfs->sfs_device, diskblock, &b);
+	}
+	if (result) {
+		return result;
 	}
 
 	/*
 	 * Now perform the requested operation into/out of the buffer.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = uiomove((char *)buffer_map(b) + skipstart, len, uio);
 	if (result) {
+		buffer_release(b);
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, write back the modified block. This is
+	 * file data, so it doesn't go in the journal.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
+		if (wholeblock) {
+			buffer_mark_valid(b);
 		}
+		buffer_mark_dirty(b);
 	}
 
+	buffer_release(b);
 	return 0;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Read a run of whole blocks of a file, up to NBLOCKS of them. As
+ * many as are physically consecutive on disk (up to BUFFER_MAXRUN)
+ * are fetched together, so a cache miss over a contiguous stretch of
+ * the file costs one device request rather than one per block.
+ * A run of at least SFS_DIRECTMIN blocks going to user memory, none
+ * of which is cached, is read by the device straight into the
+ * user's buffer instead of passing through the cache. If that
+ * fails partway, or some block is cached, the rest comes through
+ * the cache as usual. Hands back the number of blocks done in DONE.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_readrun(struct sfs_vnode *sv, struct uio *uio, uint32_t nblocks,
+	    uint32_t *done)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
-	uint32_t fileblock;
+	struct buf *bufs[BUFFER_MAXRUN];
+	daddr_t diskblock, nextblock;
+	uint32_t fileblock, i, num;
 	int result;
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
-	/* Get the block number within the file */
+	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
+
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
-	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
 	if (result) {
 		return result;
 	}
-
 	if (diskblock == 0) {
-		/*
-		 * No block - fill with zeros.
-		 *
-		 * We must be reading, or sfs_bmap would have
-		 * allocated a block for us.
-		 */
-		KASSERT(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		/* A hole; let sfs_blockio produce the zeros. */
+		*done = 1;
+		return sfs_blockio(sv, uio, 0, SFS_BLOCKSIZE);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	for (num=1; num<nblocks && num<BUFFER_MAXRUN; num++) {
+		result = sfs_bmap(sv, fileblock + num, false, &nextblock);
+		if (result) {
+			return result;
+		}
+		if (nextblock != diskblock + num) {
+			break;
+		}
+	}
 
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	if (num >= SFS_DIRECTMIN && uio->uio_segflg != UIO_SYSSPACE) {
+		result = buffer_read_direct(sfs->sfs_device, diskblock, num,
+					    uio, done);
+		if (result == 0 || *done > 0) {
+			/* Leave any error for the next call to retry */
+			return 0;
+		}
+		if (result != EAGAIN && result != EIO) {
+			return result;
+		}
+	}
 
-	result = sfs_rwblock(sfs, uio);
+	result = buffer_read_multi(sfs->sfs_device, diskblock, num, bufs);
+	if (result) {
+		return result;
+	}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	for (i=0; i<num; i++) {
+		result = uiomove(buffer_map(bufs[i]), SFS_BLOCKSIZE, uio);
+		if (result) {
+			break;
+		}
+	}
+	*done = i;
+
+	for (i=0; i<num; i++) {
+		buffer_release(bufs[i]);
+	}
+	return result;
+}
+
+/*
+ * Read-ahead.
+ *
+ * A read that starts in the block the previous read ended in, or the
+ * one after, is sequential. Each sequential read doubles the window
+ * (from SFS_RAMIN up to SFS_RAMAX blocks); anything else closes it.
+ * While the window is open we keep it filled past the end of the
+ * latest read, handing the blocks to the buffer cache to read in the
+ * background.
+ *
+ * FIRST and LAST are the file blocks the read just covered.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, uint32_t first, uint32_t last)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t blocks[SFS_RAMAX];
+	daddr_t diskblock;
+	uint32_t from, to, eofblock, i;
+	unsigned num;
+
+	if (first == sv->sv_ranext || first + 1 == sv->sv_ranext) {
+		if (sv->sv_rawindow == 0) {
+			sv->sv_rawindow = SFS_RAMIN;
+		}
+		else if (sv->sv_rawindow < SFS_RAMAX) {
+			sv->sv_rawindow *= 2;
+		}
+	}
+	else {
+		sv->sv_rawindow = 0;
+		sv->sv_raissued = 0;
+	}
+	sv->sv_ranext = last + 1;
+
+	if (sv->sv_rawindow == 0 || sv->sv_i.sfi_size == 0) {
+		return;
+	}
+
+	from = last + 1;
+	if (from < sv->sv_raissued) {
+		from = sv->sv_raissued;
+	}
+	to = last + sv->sv_rawindow;
+	eofblock = (sv->sv_i.sfi_size - 1) / SFS_BLOCKSIZE;
+	if (to > eofblock) {
+		to = eofblock;
+	}
+	if (from > to) {
+		return;
+	}
+
+	num = 0;
+	for (i=from; i<=to; i++) {
+		if (sfs_bmap(sv, i, false, &diskblock)) {
+			break;
+		}
+		if (diskblock != 0) {
+			blocks[num++] = diskblock;
+		}
+	}
+	sv->sv_raissued = i;
+
+	if (num > 0) {
+		buffer_readahead(sfs->sfs_device, blocks, num);
+	}
+}
+
+/*
+ * Do I/O to an inline file (see kern/sfs.h). The caller has already
+ * clamped reads to the file size and checked that writes fit.
+ */
+static
+int
+sfs_inlineio(struct sfs_vnode *sv, struct uio *uio)
+{
+	int result;
+
+	KASSERT(uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE);
 
+	result = uiomove(sv->sv_i.sfi_inline + uio->uio_offset,
+			 uio->uio_resid, uio);
+	if (uio->uio_rw == UIO_WRITE) {
+		sv->sv_dirty = true;
+	}
 	return result;
 }
 
+/*
+ * Move the contents of an inline file out to its first data block
+ * and make it an ordinary file, so it can grow past SFS_INLINESIZE.
+ */
+int
+sfs_uninline(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t size = sv->sv_i.sfi_size;
+	struct buf *b;
+	daddr_t diskblock;
+	char *ptr;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(sv->sv_i.sfi_flags & SFS_IFLAG_INLINE);
+	KASSERT(size <= SFS_INLINESIZE);
+
+	sv->sv_i.sfi_flags &= ~SFS_IFLAG_INLINE;
+	sv->sv_dirty = true;
+
+	if (size == 0) {
+		/* Nothing to move; the inline area is already all 0 */
+		return 0;
+	}
+
+	result = sfs_bmap(sv, 0, true, &diskblock);
+	if (result) {
+		sv->sv_i.sfi_flags |= SFS_IFLAG_INLINE;
+		return result;
+	}
+
+	result = buffer_get(sfs->sfs_device, diskblock, &b);
+	if (result) {
+		sfs_bfree(sfs, diskblock);
+		sv->sv_i.sfi_direct[0] = 0;
+		sv->sv_bmcachevalid = false;
+		sv->sv_i.sfi_flags |= SFS_IFLAG_INLINE;
+		return result;
+	}
+
+	/* This is file data, so like sfs_blockio it skips the journal */
+	ptr = buffer_map(b);
+	memcpy(ptr, sv->sv_i.sfi_inline, size);
+	bzero(ptr + size, SFS_BLOCKSIZE - size);
+	buffer_mark_valid(b);
+	buffer_mark_dirty(b);
+	buffer_release(b);
+
+	bzero(sv->sv_i.sfi_inline, sizeof(sv->sv_i.sfi_inline));
+	return 0;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -289,11 +442,13 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, i, done;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t origoffset;
 
 	origresid = uio->uio_resid;
+	origoffset = uio->uio_offset;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -315,6 +470,27 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			uio->uio_resid -= extraresid;
 		}
 	}
+	else if (uio->uio_offset + uio->uio_resid > SFS_MAXFILESIZE) {
+		/* Would write past the largest file we can map */
+		return EFBIG;
+	}
+
+	/*
+	 * Inline files are read and written in the inode, unless a
+	 * write would take them past the inline area; then they move
+	 * out to a data block first and continue as ordinary files.
+	 */
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		if (uio->uio_rw == UIO_READ ||
+		    uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE) {
+			result = sfs_inlineio(sv, uio);
+			goto out;
+		}
+		result = sfs_uninline(sv);
+		if (result) {
+			return result;
+		}
+	}
 
 	/*
 	 * First, do any leading partial block.
@@ -332,8 +508,8 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			len = uio->uio_resid;
 		}
 
-		/* Call sfs_partialio() to do it. */
-		result = sfs_partialio(sv, uio, skip, len);
+		/* Call sfs_blockio() to do it. */
+		result = sfs_blockio(sv, uio, skip, len);
 		if (result) {
 			goto out;
 		}
@@ -349,8 +525,15 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	for (i=0; i<nblocks; i+=done) {
+		if (uio->uio_rw == UIO_READ) {
+			result = sfs_readrun(sv, uio, nblocks - i, &done);
+		}
+		else {
+			/* Writes get coalesced when the cache flushes them */
+			result = sfs_blockio(sv, uio, 0, SFS_BLOCKSIZE);
+			done = 1;
+		}
 		if (result) {
 			goto out;
 		}
@@ -362,7 +545,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
 
 	if (uio->uio_resid > 0) {
-		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
+		result = sfs_blockio(sv, uio, 0, uio->uio_resid);
 		if (result) {
 			goto out;
 		}
@@ -378,6 +561,21 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/*
+	 * If reading and we did anything, keep the readahead going.
+	 * Reads big enough to go straight to user memory don't need
+	 * it: each is already one large device request, and blocks
+	 * read ahead into the cache would only push the next such
+	 * read back through the cache.
+	 */
+	if (uio->uio_resid != origresid && uio->uio_rw == UIO_READ &&
+	    (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) == 0 &&
+	    (uio->uio_segflg == UIO_SYSSPACE ||
+	     origresid < SFS_DIRECTMIN * SFS_BLOCKSIZE)) {
+		sfs_readahead(sv, origoffset / SFS_BLOCKSIZE,
+			      (uio->uio_offset - 1) / SFS_BLOCKSIZE);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -389,12 +587,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 // Metadata I/O
 
 /*
- * This is much the same as sfs_partialio, but intended for use with
+ * This is much the same as sfs_blockio, but intended for use with
  * metadata (e.g. directory entries). It assumes the objects being
  * handled are smaller than whole blocks, do not cross block
  * boundaries, and originate in the kernel.
  *
- * It is separate from sfs_partialio because, although there is no
+ * It is separate from sfs_blockio because, although there is no
  * such code in this version of SFS, it is often desirable when doing
  * more advanced things to handle metadata and user data I/O
  * differently.
@@ -404,6 +602,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
+	char *ptr;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -411,16 +611,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
@@ -443,23 +633,24 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = sfs_getbuf(sfs, diskblock, &b);
 	if (result) {
 		return result;
 	}
+	ptr = buffer_map(b);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, ptr + blockoffset, len);
+		buffer_release(b);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
+		memcpy(ptr + blockoffset, data, len);
 
 		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
+		result = sfs_putbuf(sfs, b, true);
 		if (result) {
 			return result;
 		}
@@ -0,0 +1,708 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Metadata journal. See <kern/sfs.h> for the on-disk format.
+ *
+ * Every metadata buffer changed through sfs_putbuf or sfs_writeblock
+ * joins the open transaction and is held (see buf.h) so it can't
+ * reach its home block early. At sync time, after the file data has
+ * been written, sfs_journal_commit writes the transaction's images
+ * to the log and releases the buffers, which then go home lazily.
+ * When the log fills up, sfs_journal_checkpoint copies it home and
+ * starts it over.
+ *
+ * A block that has an image in the log can't be reused until the
+ * log is checkpointed, or recovery could put the old image back over
+ * the new contents. Such blocks stay allocated in memory when freed,
+ * but are shown as free in the freemap images we write.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <array.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <buf.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/*
+ * Do I/O directly on NBLOCKS consecutive blocks, bypassing the cache.
+ */
+static
+int
+sfs_jio(struct sfs_fs *sfs, daddr_t block, void *data, unsigned nblocks,
+	enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	uio_kinit(&iov, &ku, data, nblocks * SFS_BLOCKSIZE,
+		  (off_t)block * SFS_BLOCKSIZE, rw);
+	return DEVOP_IO(sfs->sfs_device, &ku);
+}
+
+/*
+ * I/O on log slots.
+ */
+static
+int
+sfs_jslotio(struct sfs_fs *sfs, unsigned slot, void *data, unsigned nslots,
+	    enum uio_rw rw)
+{
+	KASSERT(slot + nslots <= sfs->sfs_jslots);
+	return sfs_jio(sfs, sfs->sfs_sb.sb_journalstart + 1 + slot, data,
+		       nslots, rw);
+}
+
+/*
+ * Add the words of a block image to a checksum.
+ */
+static
+uint32_t
+sfs_jsum(uint32_t sum, const void *data)
+{
+	const uint32_t *words = data;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE / sizeof(uint32_t); i++) {
+		sum += words[i];
+	}
+	return sum;
+}
+
+/*
+ * Write the journal header, marking SEQ as the first transaction.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs, uint32_t seq)
+{
+	struct sfs_jheader *jh;
+
+	jh = (struct sfs_jheader *)sfs->sfs_jstage;
+	bzero(jh, SFS_BLOCKSIZE);
+	jh->jh_magic = SFS_JOURNAL_MAGIC;
+	jh->jh_seq = seq;
+	return sfs_jio(sfs, sfs->sfs_sb.sb_journalstart, jh, 1, UIO_WRITE);
+}
+
+/*
+ * Check whether a complete transaction SEQ starts at log slot SLOT.
+ * If so, hand back the number of slots it takes up; if not, 0.
+ *
+ * Descriptors are read into the first block of the staging area, and
+ * images into the rest.
+ */
+static
+int
+sfs_jscan(struct sfs_fs *sfs, unsigned slot, uint32_t seq, unsigned *ret)
+{
+	struct sfs_jdesc *jd = (struct sfs_jdesc *)sfs->sfs_jstage;
+	struct sfs_jcommit *jc = (struct sfs_jcommit *)sfs->sfs_jstage;
+	char *images = sfs->sfs_jstage + SFS_BLOCKSIZE;
+	unsigned pos, total, n, i, k, chunk;
+	uint32_t sum;
+	int result;
+
+	*ret = 0;
+	total = 0;
+	sum = 0;
+	for (pos = slot; pos < sfs->sfs_jslots; ) {
+		result = sfs_jslotio(sfs, pos, jd, 1, UIO_READ);
+		if (result) {
+			return result;
+		}
+		if (jd->jd_magic == SFS_JCOMMIT_MAGIC && jc->jc_seq == seq) {
+			if (total > 0 && jc->jc_nblocks == total &&
+			    jc->jc_checksum == sum) {
+				*ret = pos + 1 - slot;
+			}
+			return 0;
+		}
+		if (jd->jd_magic != SFS_JDESC_MAGIC || jd->jd_seq != seq) {
+			return 0;
+		}
+
+		n = jd->jd_nblocks;
+		if (n == 0 || n > SFS_JDESC_MAX ||
+		    pos + 1 + n > sfs->sfs_jslots) {
+			return 0;
+		}
+		for (i=0; i<n; i++) {
+			if (jd->jd_blocks[i] >= sfs->sfs_sb.sb_nblocks) {
+				return 0;
+			}
+		}
+		pos++;
+
+		for (k=0; k<n; k += chunk) {
+			chunk = n - k;
+			if (chunk > SFS_JSTAGE - 1) {
+				chunk = SFS_JSTAGE - 1;
+			}
+			result = sfs_jslotio(sfs, pos, images, chunk,
+					     UIO_READ);
+			if (result) {
+				return result;
+			}
+			for (i=0; i<chunk; i++) {
+				sum = sfs_jsum(sum, images + i*SFS_BLOCKSIZE);
+			}
+			pos += chunk;
+		}
+		total += n;
+	}
+	return 0;
+}
+
+/*
+ * Copy the images of the transaction in the LEN slots starting at
+ * SLOT, which sfs_jscan has checked, to their home blocks. Images
+ * for consecutive blocks go in one write. Forget that those blocks
+ * are in the log.
+ */
+static
+int
+sfs_japply(struct sfs_fs *sfs, unsigned slot, unsigned len)
+{
+	struct sfs_jdesc *jd = (struct sfs_jdesc *)sfs->sfs_jstage;
+	char *images = sfs->sfs_jstage + SFS_BLOCKSIZE;
+	unsigned pos, end, n, i, j, k, chunk;
+	int result;
+
+	/* The last slot is the commit block */
+	end = slot + len - 1;
+	for (pos = slot; pos < end; pos += n) {
+		result = sfs_jslotio(sfs, pos, jd, 1, UIO_READ);
+		if (result) {
+			return result;
+		}
+		KASSERT(jd->jd_magic == SFS_JDESC_MAGIC);
+		n = jd->jd_nblocks;
+		pos++;
+
+		for (k=0; k<n; k += chunk) {
+			chunk = n - k;
+			if (chunk > SFS_JSTAGE - 1) {
+				chunk = SFS_JSTAGE - 1;
+			}
+			result = sfs_jslotio(sfs, pos + k, images, chunk,
+					     UIO_READ);
+			if (result) {
+				return result;
+			}
+			for (i=0; i<chunk; i=j) {
+				for (j=i+1; j<chunk; j++) {
+					if (jd->jd_blocks[k+j] !=
+					    jd->jd_blocks[k+j-1] + 1) {
+						break;
+					}
+				}
+				result = sfs_jio(sfs, jd->jd_blocks[k+i],
+						 images + i*SFS_BLOCKSIZE,
+						 j - i, UIO_WRITE);
+				if (result) {
+					return result;
+				}
+			}
+			if (sfs->sfs_jlogged != NULL) {
+				for (i=0; i<chunk; i++) {
+					if (bitmap_isset(sfs->sfs_jlogged,
+							 jd->jd_blocks[k+i])) {
+						bitmap_unmark(sfs->sfs_jlogged,
+							 jd->jd_blocks[k+i]);
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Replay the log: apply each complete transaction, starting with
+ * sequence number SEQ in the first slot. Hands back the sequence
+ * number after the last transaction found and the number of slots
+ * they took up.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs, uint32_t seq, uint32_t *retseq,
+	    unsigned *retslots)
+{
+	unsigned slot, len;
+	int result;
+
+	slot = 0;
+	while (slot < sfs->sfs_jslots) {
+		result = sfs_jscan(sfs, slot, seq, &len);
+		if (result) {
+			return result;
+		}
+		if (len == 0) {
+			break;
+		}
+		result = sfs_japply(sfs, slot, len);
+		if (result) {
+			return result;
+		}
+		slot += len;
+		seq++;
+	}
+	*retseq = seq;
+	*retslots = slot;
+	return 0;
+}
+
+/*
+ * Release deferred frees of blocks that no longer have images in the
+ * log or the open transaction.
+ */
+static
+void
+sfs_jrelease_deferred(struct sfs_fs *sfs)
+{
+	unsigned i, j;
+	daddr_t block;
+
+	for (i=j=0; i<sfs->sfs_jndeferred; i++) {
+		block = sfs->sfs_jdeferred[i];
+		if (bitmap_isset(sfs->sfs_jlogged, block)) {
+			sfs->sfs_jdeferred[j++] = block;
+			continue;
+		}
+		/* The freemap on disk already shows it free */
+		bitmap_unmark(sfs->sfs_freemap, block);
+	}
+	sfs->sfs_jndeferred = j;
+}
+
+/*
+ * Empty the log: copy everything in it home and start over at the
+ * first slot. The open transaction stays open.
+ */
+int
+sfs_journal_checkpoint(struct sfs_fs *sfs)
+{
+	unsigned i, num, slots;
+	uint32_t seq;
+	daddr_t block;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_jslots == 0) {
+		return 0;
+	}
+
+	if (sfs->sfs_jhead > 0) {
+		result = sfs_jreplay(sfs, sfs->sfs_jfirstseq, &seq, &slots);
+		if (result) {
+			return result;
+		}
+		KASSERT(seq == sfs->sfs_jseq);
+		KASSERT(slots == sfs->sfs_jhead);
+
+		result = sfs_jwriteheader(sfs, seq);
+		if (result) {
+			return result;
+		}
+		sfs->sfs_jfirstseq = seq;
+		sfs->sfs_jhead = 0;
+	}
+
+	/* The open transaction's blocks are still going to be logged */
+	num = array_num(sfs->sfs_jbufs);
+	for (i=0; i<num; i++) {
+		block = buffer_blockno(array_get(sfs->sfs_jbufs, i));
+		if (!bitmap_isset(sfs->sfs_jlogged, block)) {
+			bitmap_mark(sfs->sfs_jlogged, block);
+		}
+	}
+	sfs_jrelease_deferred(sfs);
+	return 0;
+}
+
+/*
+ * Release the buffers of the open transaction and start a new one.
+ */
+static
+void
+sfs_jrelease(struct sfs_fs *sfs)
+{
+	unsigned i, num;
+
+	num = array_num(sfs->sfs_jbufs);
+	for (i=0; i<num; i++) {
+		buffer_unhold(array_get(sfs->sfs_jbufs, i));
+	}
+	array_setsize(sfs->sfs_jbufs, 0);
+	sfs->sfs_joverflow = false;
+}
+
+/*
+ * Transactions that don't fit in the log are written in place, like
+ * without a journal. Empty the log first, so nothing older in it can
+ * be replayed over the new contents later.
+ */
+static
+int
+sfs_jcommit_inplace(struct sfs_fs *sfs)
+{
+	unsigned i, num;
+	daddr_t block;
+	int result;
+
+	kprintf("sfs: %s: transaction too large for journal; "
+		"writing it in place\n", sfs->sfs_sb.sb_volname);
+
+	result = sfs_journal_checkpoint(sfs);
+	if (result) {
+		return result;
+	}
+
+	num = array_num(sfs->sfs_jbufs);
+	for (i=0; i<num; i++) {
+		block = buffer_blockno(array_get(sfs->sfs_jbufs, i));
+		bitmap_unmark(sfs->sfs_jlogged, block);
+	}
+	sfs_jrelease(sfs);
+
+	result = buffer_sync(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
+	sfs_jrelease_deferred(sfs);
+	return 0;
+}
+
+/*
+ * Get the next block of the staging area to put a log block in,
+ * first writing out the full ones if there's no room left.
+ */
+static
+int
+sfs_jnext(struct sfs_fs *sfs, unsigned *nstaged, void **ret)
+{
+	int result;
+
+	if (*nstaged == SFS_JSTAGE) {
+		result = sfs_jslotio(sfs, sfs->sfs_jhead, sfs->sfs_jstage,
+				     *nstaged, UIO_WRITE);
+		if (result) {
+			return result;
+		}
+		sfs->sfs_jhead += *nstaged;
+		*nstaged = 0;
+	}
+	*ret = sfs->sfs_jstage + *nstaged * SFS_BLOCKSIZE;
+	(*nstaged)++;
+	return 0;
+}
+
+/*
+ * Commit the open transaction: write its descriptors, images and
+ * commit block to the log, then let its buffers go. The caller must
+ * have written any file data the transaction refers to already.
+ */
+int
+sfs_journal_commit(struct sfs_fs *sfs)
+{
+	struct sfs_jdesc *jd;
+	struct sfs_jcommit *jc;
+	struct buf *b;
+	unsigned start, nstaged, num, need, i, j, n;
+	uint32_t sum;
+	void *ptr;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_jslots == 0) {
+		return 0;
+	}
+	num = array_num(sfs->sfs_jbufs);
+	if (sfs->sfs_joverflow || num > sfs->sfs_jmaxbufs) {
+		return sfs_jcommit_inplace(sfs);
+	}
+	if (num == 0) {
+		return 0;
+	}
+
+	need = num + DIVROUNDUP(num, SFS_JDESC_MAX) + 1;
+	if (sfs->sfs_jhead + need > sfs->sfs_jslots) {
+		result = sfs_journal_checkpoint(sfs);
+		if (result) {
+			return result;
+		}
+	}
+	KASSERT(sfs->sfs_jhead + need <= sfs->sfs_jslots);
+
+	start = sfs->sfs_jhead;
+	nstaged = 0;
+	sum = 0;
+	for (i=0; i<num; i += n) {
+		n = num - i;
+		if (n > SFS_JDESC_MAX) {
+			n = SFS_JDESC_MAX;
+		}
+		result = sfs_jnext(sfs, &nstaged, &ptr);
+		if (result) {
+			goto fail;
+		}
+		jd = ptr;
+		bzero(jd, SFS_BLOCKSIZE);
+		jd->jd_magic = SFS_JDESC_MAGIC;
+		jd->jd_seq = sfs->sfs_jseq;
+		jd->jd_nblocks = n;
+		for (j=0; j<n; j++) {
+			b = array_get(sfs->sfs_jbufs, i+j);
+			jd->jd_blocks[j] = buffer_blockno(b);
+		}
+
+		for (j=0; j<n; j++) {
+			result = sfs_jnext(sfs, &nstaged, &ptr);
+			if (result) {
+				goto fail;
+			}
+			b = array_get(sfs->sfs_jbufs, i+j);
+			memcpy(ptr, buffer_map(b), SFS_BLOCKSIZE);
+			sum = sfs_jsum(sum, ptr);
+		}
+	}
+
+	result = sfs_jnext(sfs, &nstaged, &ptr);
+	if (result) {
+		goto fail;
+	}
+	jc = ptr;
+	bzero(jc, SFS_BLOCKSIZE);
+	jc->jc_magic = SFS_JCOMMIT_MAGIC;
+	jc->jc_seq = sfs->sfs_jseq;
+	jc->jc_nblocks = num;
+	jc->jc_checksum = sum;
+
+	/* Write the rest; the commit block goes last */
+	result = sfs_jslotio(sfs, sfs->sfs_jhead, sfs->sfs_jstage, nstaged,
+			     UIO_WRITE);
+	if (result) {
+		goto fail;
+	}
+	sfs->sfs_jhead += nstaged;
+	KASSERT(sfs->sfs_jhead == start + need);
+
+	sfs_jrelease(sfs);
+	sfs->sfs_jseq++;
+	return 0;
+
+ fail:
+	/* Leave the transaction open; the next commit overwrites this */
+	sfs->sfs_jhead = start;
+	return result;
+}
+
+/*
+ * Add a changed metadata buffer to the open transaction.
+ */
+void
+sfs_journal_add(struct sfs_fs *sfs, struct buf *b)
+{
+	daddr_t block;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_jslots == 0 || !buffer_hold(b)) {
+		return;
+	}
+	if (array_add(sfs->sfs_jbufs, b, NULL)) {
+		/* Out of memory; this transaction won't be atomic */
+		buffer_unhold(b);
+		buffer_mark_dirty(b);
+		sfs->sfs_joverflow = true;
+		return;
+	}
+	block = buffer_blockno(b);
+	if (!bitmap_isset(sfs->sfs_jlogged, block)) {
+		bitmap_mark(sfs->sfs_jlogged, block);
+	}
+}
+
+/*
+ * Called when BLOCK is freed. If it has an image in the log (or is
+ * about to), keep it allocated until the next checkpoint and return
+ * true. If we can't remember to free it later, it leaks until the
+ * volume is checked.
+ */
+bool
+sfs_journal_deferfree(struct sfs_fs *sfs, daddr_t block)
+{
+	daddr_t *newlist;
+	unsigned newmax;
+
+	if (sfs->sfs_jslots == 0 || !bitmap_isset(sfs->sfs_jlogged, block)) {
+		return false;
+	}
+	if (sfs->sfs_jndeferred == sfs->sfs_jmaxdeferred) {
+		newmax = sfs->sfs_jmaxdeferred ? sfs->sfs_jmaxdeferred*2 : 32;
+		newlist = kmalloc(newmax * sizeof(daddr_t));
+		if (newlist == NULL) {
+			return true;
+		}
+		if (sfs->sfs_jndeferred > 0) {
+			memcpy(newlist, sfs->sfs_jdeferred,
+			       sfs->sfs_jndeferred * sizeof(daddr_t));
+		}
+		kfree(sfs->sfs_jdeferred);
+		sfs->sfs_jdeferred = newlist;
+		sfs->sfs_jmaxdeferred = newmax;
+	}
+	sfs->sfs_jdeferred[sfs->sfs_jndeferred++] = block;
+	return true;
+}
+
+/*
+ * Fix up the image of freemap block J about to be written: blocks
+ * whose frees were deferred are free as far as the disk is concerned.
+ */
+void
+sfs_journal_fixfreemap(struct sfs_fs *sfs, uint32_t j, void *data)
+{
+	unsigned char *bits = data;
+	unsigned i;
+	daddr_t block;
+
+	for (i=0; i<sfs->sfs_jndeferred; i++) {
+		block = sfs->sfs_jdeferred[i];
+		if (block / SFS_BITSPERBLOCK != j) {
+			continue;
+		}
+		block %= SFS_BITSPERBLOCK;
+		bits[block / CHAR_BIT] &= ~(1 << (block % CHAR_BIT));
+	}
+}
+
+/*
+ * Set up the journal at mount time, after the superblock has been
+ * read, and recover anything committed in it. Sets RECOVERED if any
+ * blocks were changed behind the buffer cache's back.
+ */
+int
+sfs_journal_mount(struct sfs_fs *sfs, bool *recovered)
+{
+	struct sfs_superblock *sb = &sfs->sfs_sb;
+	struct sfs_jheader *jh;
+	uint32_t seq;
+	unsigned n, slots;
+	int result;
+
+	*recovered = false;
+	if (sb->sb_journalblocks == 0) {
+		return 0;
+	}
+	if (sb->sb_journalblocks < SFS_JOURNAL_MIN ||
+	    sb->sb_journalstart < SFS_FREEMAP_START +
+	    SFS_FREEMAPBLOCKS(sb->sb_nblocks) ||
+	    sb->sb_journalstart > sb->sb_nblocks ||
+	    sb->sb_journalblocks > sb->sb_nblocks - sb->sb_journalstart) {
+		kprintf("sfs: %s: Invalid journal location %u-%u\n",
+			sb->sb_volname, sb->sb_journalstart,
+			sb->sb_journalstart + sb->sb_journalblocks - 1);
+		return EINVAL;
+	}
+
+	sfs->sfs_jstage = kmalloc(SFS_JSTAGE * SFS_BLOCKSIZE);
+	sfs->sfs_jbufs = array_create();
+	sfs->sfs_jlogged = bitmap_create(SFS_FREEMAPBITS(sb->sb_nblocks));
+	if (sfs->sfs_jstage == NULL || sfs->sfs_jbufs == NULL ||
+	    sfs->sfs_jlogged == NULL) {
+		return ENOMEM;
+	}
+
+	/* Largest transaction that fits: images plus descriptors and commit */
+	sfs->sfs_jslots = sb->sb_journalblocks - 1;
+	n = sfs->sfs_jslots - 2;
+	while (n + DIVROUNDUP(n, SFS_JDESC_MAX) + 1 > sfs->sfs_jslots) {
+		n--;
+	}
+	sfs->sfs_jmaxbufs = n;
+
+	jh = (struct sfs_jheader *)sfs->sfs_jstage;
+	result = sfs_jio(sfs, sb->sb_journalstart, jh, 1, UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (jh->jh_magic != SFS_JOURNAL_MAGIC) {
+		kprintf("sfs: %s: Wrong magic number in journal header "
+			"(0x%x, should be 0x%x)\n", sb->sb_volname,
+			jh->jh_magic, SFS_JOURNAL_MAGIC);
+		return EINVAL;
+	}
+	seq = jh->jh_seq;
+
+	result = sfs_jreplay(sfs, seq, &sfs->sfs_jseq, &slots);
+	if (result) {
+		return result;
+	}
+	if (slots > 0) {
+		kprintf("sfs: %s: Recovered %u transactions from the journal\n",
+			sb->sb_volname, sfs->sfs_jseq - seq);
+		result = sfs_jwriteheader(sfs, sfs->sfs_jseq);
+		if (result) {
+			return result;
+		}
+		*recovered = true;
+	}
+	sfs->sfs_jfirstseq = sfs->sfs_jseq;
+	sfs->sfs_jhead = 0;
+	return 0;
+}
+
+/*
+ * Free the journal state. The open transaction must be empty.
+ */
+void
+sfs_journal_cleanup(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jbufs != NULL) {
+		KASSERT(array_num(sfs->sfs_jbufs) == 0);
+		array_destroy(sfs->sfs_jbufs);
+	}
+	if (sfs->sfs_jlogged != NULL) {
+		bitmap_destroy(sfs->sfs_jlogged);
+	}
+	kfree(sfs->sfs_jdeferred);
+	kfree(sfs->sfs_jstage);
+	sfs->sfs_jslots = 0;
+}
@@ -39,6 +39,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -52,16 +53,26 @@ static
 int
 sfs_eachopen(struct vnode *v, int openflags)
 {
+	struct sfs_vnode *sv = v->vn_data;
+
 	/*
 	 * At this level we do not need to handle O_CREAT, O_EXCL,
 	 * O_TRUNC, or O_APPEND.
 	 *
 	 * Any of O_RDONLY, O_WRONLY, and O_RDWR are valid, so we don't need
 	 * to check that either.
+	 *
+	 * If the file is being opened for writing, start setting
+	 * blocks aside for it when it grows. This lasts until the
+	 * vnode is reclaimed, though blocks not yet used are given back
+	 * at each sync.
 	 */
 
-	(void)v;
-	(void)openflags;
+	if ((openflags & O_ACCMODE) != O_RDONLY) {
+		vfs_biglock_acquire();
+		sv->sv_prealloc = true;
+		vfs_biglock_release();
+	}
 
 	return 0;
 }
@@ -213,18 +224,31 @@ sfs_isseekable(struct vnode *v)
 }
 
 /*
- * Called for fsync(), and also on filesystem unmount, global sync(),
- * and some other cases.
+ * Called for fsync(). Write the inode into the buffer cache and then
+ * push the cache out to disk. The cache doesn't know which buffers
+ * belong to which file, so this flushes the whole volume's dirty
+ * buffers, which is more than necessary but never less.
+ *
+ * With a journal, the file's metadata is held until the open
+ * transaction commits, so sync the whole volume instead.
  */
 static
 int
 sfs_fsync(struct vnode *v)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
+	if (sfs->sfs_jslots > 0) {
+		return FSOP_SYNC(v->vn_fs);
+	}
+
 	vfs_biglock_acquire();
 	result = sfs_sync_inode(sv);
+	if (result == 0) {
+		result = buffer_sync(sfs->sfs_device);
+	}
 	vfs_biglock_release();
 
 	return result;
@@ -250,9 +274,108 @@ sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
 
+	if (len > SFS_MAXFILESIZE) {
+		return EFBIG;
+	}
 	return sfs_itrunc(sv, len);
 }
 
+/*
+ * Called for getdirentry(). The offset is a slot number; hand back
+ * the name in the first slot in use at or after it.
+ */
+static
+int
+sfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_direntry sd;
+	int slot, result;
+
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
+
+	vfs_biglock_acquire();
+
+	/* Past the last slot is the end of the directory */
+	if (uio->uio_offset >=
+	    (off_t)(sv->sv_i.sfi_size / sizeof(struct sfs_direntry))) {
+		vfs_biglock_release();
+		return 0;
+	}
+
+	slot = uio->uio_offset;
+	result = sfs_dir_next(sv, &slot, &sd);
+	if (result == 0 && slot >= 0) {
+		result = uiomove(sd.sfd_name, strlen(sd.sfd_name), uio);
+		uio->uio_offset = slot + 1;
+	}
+
+	vfs_biglock_release();
+	return result;
+}
+
+/*
+ * Called for getdirentries(). Like sfs_getdirentry, but packs as
+ * many entries as fit, with their inode numbers and types.
+ */
+static
+int
+sfs_getdirentries(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_direntry sd;
+	int slot, type, result;
+	mode_t mode;
+	bool full, any = false;
+
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
+
+	vfs_biglock_acquire();
+
+	/* Past the last slot is the end of the directory */
+	if (uio->uio_offset >=
+	    (off_t)(sv->sv_i.sfi_size / sizeof(struct sfs_direntry))) {
+		vfs_biglock_release();
+		return 0;
+	}
+
+	while (1) {
+		slot = uio->uio_offset;
+		result = sfs_dir_next(sv, &slot, &sd);
+		if (result || slot < 0) {
+			break;
+		}
+
+		result = sfs_inodetype(sfs, sd.sfd_ino, &type);
+		if (result) {
+			break;
+		}
+		mode = (type == SFS_TYPE_FILE) ? S_IFREG :
+			(type == SFS_TYPE_DIR) ? S_IFDIR : 0;
+
+		result = vfs_putdirent(uio, sd.sfd_ino, mode, sd.sfd_name,
+				       slot + 1, &full);
+		if (result) {
+			break;
+		}
+		if (full) {
+			if (!any) {
+				result = EINVAL;
+			}
+			break;
+		}
+		any = true;
+	}
+
+	vfs_biglock_release();
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -316,7 +439,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, sv, SFS_TYPE_FILE, &newguy);
 	if (result) {
 		vfs_biglock_release();
 		return result;
@@ -468,6 +591,12 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
 
+	/* Linking may have moved the old entry; find it again */
+	result = sfs_dir_findname(sv, n1, NULL, &slot1, NULL);
+	if (result) {
+		goto puke_harder;
+	}
+
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
 	if (result) {
@@ -589,6 +718,7 @@ const struct vnode_ops sfs_fileops = {
 	.vop_read = sfs_read,
 	.vop_readlink = vopfail_uio_notdir,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
 	.vop_write = sfs_write,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
@@ -622,7 +752,8 @@ const struct vnode_ops sfs_dirops = {
 
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_inval,
-	.vop_getdirentry = vopfail_uio_nosys,
+	.vop_getdirentry = sfs_getdirentry,
+	.vop_getdirentries = sfs_getdirentries,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
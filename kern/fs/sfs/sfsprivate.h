@@ -32,18 +32,52 @@
 
 #include <uio.h> /* for uio_rw */
 
+struct buf; /* in buf.h */
+
 
 /* ops tables (in sfs_vnops.c) */
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
+/* Readahead window limits, in blocks */
+#define SFS_RAMIN  4
+#define SFS_RAMAX  32
+
+/* Shortest uncached run of blocks read straight into a user buffer */
+#define SFS_DIRECTMIN  8
+
+/* Number of blocks to set aside for a file open for writing */
+#define SFS_PREALLOC     8
+
+/* Largest file, in blocks and bytes: direct, then 1x, 2x, 3x indirect */
+#define SFS_MAXFILEBLOCKS \
+    (SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB + \
+     SFS_NDINDIRECT * SFS_DBPERIDB * SFS_DBPERIDB + \
+     SFS_NTINDIRECT * SFS_DBPERIDB * SFS_DBPERIDB * SFS_DBPERIDB)
+#define SFS_MAXFILESIZE ((off_t)SFS_MAXFILEBLOCKS * SFS_BLOCKSIZE)
+
+/*
+ * Hashed directories (see <kern/sfs.h>). A linear directory is
+ * converted when it would grow past SFS_DIRHASH_THRESHOLD slots; a
+ * hashed one doubles its buckets when a name's bucket is full, up to
+ * SFS_DIRHASH_MAXBUCKETS (64K entries).
+ */
+#define SFS_DIRHASH_THRESHOLD   (4 * SFS_DIRSLOTSPERBLOCK)
+#define SFS_DIRHASH_MAXBUCKETS  8192
+
+/* Blocks of journal I/O done at once (see sfs_journal.c) */
+#define SFS_JSTAGE  16
+
 /* Macro for initializing a uio structure */
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
+int sfs_balloc_file(struct sfs_vnode *sv, daddr_t *diskblock);
+void sfs_prealloc_release(struct sfs_vnode *sv);
+void sfs_prealloc_fixfreemap(struct sfs_fs *sfs, uint32_t j, void *data);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
@@ -58,6 +92,7 @@ int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
+int sfs_dir_next(struct sfs_vnode *sv, int *slot, struct sfs_direntry *sd);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
@@ -67,15 +102,29 @@ int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
-int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_inodetype(struct sfs_fs *sfs, uint32_t ino, int *type);
+int sfs_makeobj(struct sfs_fs *sfs, struct sfs_vnode *dir, int type,
+		struct sfs_vnode **ret);
 struct vnode *sfs_getroot(struct fs *fs);
 
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_getbuf(struct sfs_fs *sfs, daddr_t block, struct buf **ret);
+int sfs_putbuf(struct sfs_fs *sfs, struct buf *b, bool dirty);
+int sfs_uninline(struct sfs_vnode *sv);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
+/* Functions in sfs_journal.c */
+int sfs_journal_mount(struct sfs_fs *sfs, bool *recovered);
+void sfs_journal_cleanup(struct sfs_fs *sfs);
+void sfs_journal_add(struct sfs_fs *sfs, struct buf *b);
+int sfs_journal_commit(struct sfs_fs *sfs);
+int sfs_journal_checkpoint(struct sfs_fs *sfs);
+bool sfs_journal_deferfree(struct sfs_fs *sfs, daddr_t block);
+void sfs_journal_fixfreemap(struct sfs_fs *sfs, uint32_t j, void *data);
+
 
 #endif /* _SFSPRIVATE_H_ */
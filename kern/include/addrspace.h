@@ -81,6 +81,7 @@ struct addrspace {
     vaddr_t as_stack_start, as_stack_end;
 
     struct pagetable_entry *as_pages;
+    size_t as_ptsize;       /* number of entries in as_pages */
 
 #endif
 };
@@ -122,10 +123,21 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_translate - look up the physical address backing a virtual
+ *                address in the address space, and (if PERMS isn't
+ *                NULL) the page's AS_PERM_* permissions. Returns
+ *                EFAULT if it is not mapped or has no memory behind
+ *                it yet.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
 
+/* Page permissions reported by as_translate (the ELF PF_* bits) */
+#define AS_PERM_READ	4
+#define AS_PERM_WRITE	2
+#define AS_PERM_EXEC	1
+
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(void);
@@ -140,6 +152,8 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_translate(struct addrspace *as, vaddr_t vaddr,
+                               paddr_t *ret, int *perms);
 
 
 /*
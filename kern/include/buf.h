@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Block buffer cache.
+ *
+ * Buffers hold one BUFFER_SIZE block of a block device and are named
+ * by (device, block number). They live in a hash table for lookup and,
+ * while nobody holds them, on an LRU list from which the least
+ * recently used one is recycled when a new block is needed and the
+ * cache is full.
+ *
+ * Getting a buffer takes a reference to it. A buffer with references
+ * is pinned: it will not be evicted or reused for another block until
+ * the last reference is released. Metadata that is being worked on
+ * (an inode, an indirect block) should be held this way rather than
+ * copied out.
+ *
+ * Writes are delayed: marking a buffer dirty only remembers that it
+ * needs to go to disk. A syncer thread does a vfs_sync every
+ * buffer_syncinterval seconds, and flushes dirty buffers early if
+ * more than buffer_dirtyratio percent of BUFFER_MAXBUFS are dirty.
+ * Dirty buffers are also written when they're evicted, and by
+ * buffer_write and buffer_sync. Whenever a dirty buffer is written,
+ * dirty buffers for the adjacent blocks go with it in one device
+ * request of up to BUFFER_MAXRUN blocks.
+ *
+ * A journaling filesystem can hold a dirty buffer back with buffer_hold
+ * until the transaction that changed it is safely in its log; then
+ * buffer_unhold lets it go to its home block whenever convenient.
+ * Such "logged" buffers are written by buffer_sync and when evicted
+ * or under pressure, but buffer_sync_unlogged leaves them alone.
+ *
+ * Readahead and flushing use the asynchronous device interface
+ * (dev_submit), so several requests can be queued at the device at
+ * once: readahead returns as soon as its reads are submitted, and
+ * buffer_sync keeps a batch of writes in flight.
+ *
+ * The buffer cache does not lock the contents of buffers; two threads
+ * that get the same buffer see the same memory. Callers must
+ * serialize access to the data themselves. (SFS does this with the
+ * VFS big lock.)
+ *
+ * Functions:
+ *     buffer_bootstrap - set up; call once at boot.
+ *     buffer_read    - get the buffer for BLOCK of DEV, reading it from
+ *                      disk if it isn't already in memory.
+ *     buffer_read_multi - get the buffers for NUM consecutive blocks,
+ *                      reading the missing ones in as few device
+ *                      requests as possible. NUM <= BUFFER_MAXRUN.
+ *     buffer_read_direct - read NUM consecutive blocks of DEV straight
+ *                      into a uio without caching them, if none of
+ *                      them is in the cache; EAGAIN if one is.
+ *     buffer_get     - get the buffer for BLOCK of DEV without reading
+ *                      it. Use this when about to overwrite the whole
+ *                      block; then call buffer_mark_valid.
+ *     buffer_readahead - start reading NUM blocks of DEV into the cache
+ *                      in the background. A hint; may do nothing.
+ *     buffer_release - drop a reference gotten from buffer_read or
+ *                      buffer_get.
+ *     buffer_map     - get a pointer to the data in a buffer.
+ *     buffer_mark_valid - note that the data in a buffer is now good.
+ *     buffer_mark_dirty - note that the data in a buffer has been
+ *                      changed and needs to be written back.
+ *     buffer_hold    - don't write a buffer until buffer_unhold; takes
+ *                      its own reference. Returns false if already
+ *                      held.
+ *     buffer_unhold  - allow writing a held buffer again, marking it
+ *                      logged if dirty, and drop the hold's reference.
+ *     buffer_blockno - get the block number of a buffer.
+ *     buffer_write   - write a buffer to disk now if it's dirty.
+ *     buffer_sync    - write out all dirty buffers belonging to DEV.
+ *     buffer_sync_unlogged - same, but skip logged buffers.
+ *     buffer_drop    - throw away all buffers belonging to DEV (e.g.
+ *                      at unmount). None may be in use; call
+ *                      buffer_sync first.
+ *     buffer_setsyncer - change the syncer interval (seconds) and
+ *                      dirty ratio (percent).
+ *     buffer_printstats - print hit/miss and I/O counts.
+ */
+
+#define BUFFER_SIZE	512	/* Size of a block */
+#define BUFFER_MAXBUFS	128	/* Soft limit on number of buffers */
+#define BUFFER_MAXRUN	16	/* Most blocks in one device request */
+
+#define BUFFER_SYNCINTERVAL	5	/* Default syncer interval, seconds */
+#define BUFFER_DIRTYRATIO	50	/* Default dirty threshold, percent */
+
+struct device;
+struct uio;
+struct buf;		/* Opaque */
+
+void buffer_bootstrap(void);
+
+int buffer_read(struct device *dev, daddr_t block, struct buf **ret);
+int buffer_read_multi(struct device *dev, daddr_t block, unsigned num,
+		      struct buf **bufs);
+int buffer_read_direct(struct device *dev, daddr_t block, unsigned num,
+		       struct uio *uio, unsigned *done);
+int buffer_get(struct device *dev, daddr_t block, struct buf **ret);
+void buffer_readahead(struct device *dev, const daddr_t *blocks, unsigned num);
+void buffer_release(struct buf *b);
+
+void *buffer_map(struct buf *b);
+void buffer_mark_valid(struct buf *b);
+void buffer_mark_dirty(struct buf *b);
+bool buffer_hold(struct buf *b);
+void buffer_unhold(struct buf *b);
+daddr_t buffer_blockno(struct buf *b);
+int buffer_write(struct buf *b);
+
+int buffer_sync(struct device *dev);
+int buffer_sync_unlogged(struct device *dev);
+void buffer_drop(struct device *dev);
+
+int buffer_setsyncer(unsigned interval, unsigned ratio);
+
+void buffer_printstats(void);
+
+
+#endif /* _BUF_H_ */
@@ -48,6 +48,15 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/*
+ * hardclock_idle() is called by the idle loop just before idling the
+ * cpu. It stops the periodic hardclock until the next pending timer
+ * deadline on this cpu. hardclock_unidle() starts it again once there
+ * is work to do.
+ */
+void hardclock_idle(void);
+void hardclock_unidle(void);
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -35,6 +35,8 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct timerwheel;	/* from <timer.h> */
+
 
 /*
  * Per-cpu structure
@@ -53,6 +55,7 @@ struct cpu {
 	struct cpu *c_self;		/* Canonical address of this struct */
 	unsigned c_number;		/* This cpu's cpu number */
 	unsigned c_hardware_number;	/* Hardware-defined cpu number */
+	struct timerwheel *c_timers;	/* Pending timers (see timer.h) */
 
 	/*
 	 * Accessed only by this cpu.
@@ -70,6 +73,16 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus without locking.
+	 *
+	 * Threads woken from other cpus are pushed onto this
+	 * lock-free stack (linked through t_inboxnext) instead of
+	 * taking c_runqueue_lock; the owning cpu moves them onto
+	 * c_runqueue in thread_switch.
+	 */
+	struct thread *volatile c_inbox;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
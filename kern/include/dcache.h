@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+/*
+ * Directory name lookup cache.
+ *
+ * Remembers the results of looking up single path components: the
+ * vnode for NAME in directory DIR, or, for a negative entry, that
+ * there isn't one. vfs_lookup consults it before calling VOP_LOOKUP,
+ * so resolving the same name again doesn't touch the filesystem.
+ *
+ * Each entry holds a reference to its directory and (if positive) to
+ * the vnode it names, so neither can be reclaimed and have its
+ * address reused while the entry exists. Past DCACHE_MAXENTRIES the
+ * least recently used entry is dropped. Anything that adds or
+ * removes a name in a directory must call dcache_purge for it; the
+ * operations in vfspath.c do. Entries for a filesystem are dropped
+ * with dcache_purgefs before it's unmounted.
+ *
+ * All of this runs under the VFS big lock.
+ *
+ * Directories that aren't part of a filesystem (device vnodes) are
+ * never cached.
+ *
+ * Functions:
+ *     dcache_lookup  - look up NAME in DIR. Returns true if the cache
+ *                      knows the answer, in which case *RET is the
+ *                      vnode (with a new reference) or NULL if the
+ *                      name doesn't exist.
+ *     dcache_enter   - remember that NAME in DIR is VN, or if VN is
+ *                      NULL, that NAME doesn't exist.
+ *     dcache_purge   - forget NAME in DIR (and, if it's a directory,
+ *                      anything cached in it).
+ *     dcache_purgefs - forget everything belonging to FS.
+ *     dcache_printstats - print hit/miss counts.
+ */
+
+#define DCACHE_MAXENTRIES	256	/* Most entries at once */
+
+struct vnode;
+struct fs;
+
+bool dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret);
+void dcache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void dcache_purge(struct vnode *dir, const char *name);
+void dcache_purgefs(struct fs *fs);
+
+void dcache_printstats(void);
+
+
+#endif /* _DCACHE_H_ */
@@ -34,6 +34,7 @@
  * Devices.
  */
 
+#include <kern/time.h>
 
 struct uio;  /* in <uio.h> */
 
@@ -51,16 +52,48 @@ struct device {
 	void *d_data;		/* device-specific data */
 };
 
+/*
+ * Asynchronous block I/O request.
+ *
+ * The submitter fills in ior_uio, which must be a kernel uio, and
+ * optionally ior_callback and ior_data, and passes the request to
+ * dev_submit, which returns without waiting for the transfer. When
+ * it's done, ior_result is set and then either ior_callback is
+ * called (possibly from an interrupt handler, so it must not sleep),
+ * or, if there is no callback, ior_done is set and threads waiting in
+ * dev_wait are woken. The request must stay put until then.
+ */
+struct ioreq {
+	struct uio *ior_uio;		/* kernel uio for the data */
+	void (*ior_callback)(struct ioreq *);	/* called when done */
+	void *ior_data;			/* for the callback's use */
+	int ior_result;			/* errno when done */
+	volatile bool ior_done;		/* true when done */
+
+	/* Filled in by dev_submit */
+	daddr_t ior_block;		/* first block */
+	unsigned ior_nblocks;		/* number of blocks */
+
+	/* For the device's (or its scheduler's) use */
+	struct ioreq *ior_next;		/* next in queue */
+	struct timespec ior_queued;	/* when submitted */
+	struct timespec ior_started;	/* when handed to the hardware */
+};
+
 /*
  * Device operations.
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_submit - start an asynchronous request (optional)
+ *      devop_wait - wait for a request from devop_submit (optional)
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_submit)(struct device *, struct ioreq *);
+	int (*devop_wait)(struct device *, struct ioreq *);
 };
 
 /*
@@ -71,6 +104,15 @@ struct device_ops {
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
 
 
+/*
+ * Asynchronous I/O on any block device. For devices without
+ * devop_submit, dev_submit does the I/O synchronously with devop_io
+ * and completes the request before returning. dev_wait returns the
+ * request's result; don't use it on requests with a callback.
+ */
+int dev_submit(struct device *d, struct ioreq *req);
+int dev_wait(struct device *d, struct ioreq *req);
+
 /* Create vnode for a vfs-level device. */
 struct vnode *dev_create_vnode(struct device *dev);
 
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _IOSCHED_H_
+#define _IOSCHED_H_
+
+/*
+ * Disk request scheduling.
+ *
+ * A block device driver that can only do one thing at a time hands
+ * its requests to an iosched instead of serializing them itself. The
+ * iosched keeps the waiting requests sorted by block number and,
+ * each time the device finishes one, starts the next in C-SCAN
+ * order: the lowest-numbered request at or past where the last one
+ * ended, or, if there is none, the lowest-numbered request of all
+ * (the head sweeps up the disk and then jumps back to the start). A
+ * request that begins right where the previous one ended thus goes
+ * next with no seek; these are counted as merges.
+ *
+ * The driver supplies a start function, which is called with the
+ * scheduler's spinlock held (and possibly from the interrupt
+ * handler) to begin a request on the hardware. When the hardware is
+ * done with the request, the driver calls iosched_done, typically
+ * from its interrupt handler, which starts the next one. The uio in
+ * a request is always a kernel uio, so the driver can move data from
+ * interrupt context.
+ *
+ * Requests are struct ioreq from device.h.
+ *
+ * Functions:
+ *     iosched_create - make a scheduler for a device.
+ *     iosched_submit - queue a request (devop_submit).
+ *     iosched_wait   - wait for a request (devop_wait).
+ *     iosched_io     - do the I/O described by UIO, which may be a
+ *                      user uio, and wait for it (devop_io).
+ *     iosched_done   - report that the active request is finished.
+ *     iosched_printstats - print queue depth and timing for all
+ *                      schedulers.
+ */
+
+#include <uio.h>
+#include <device.h>
+
+struct iosched;		/* Opaque */
+
+struct iosched *iosched_create(const char *name, size_t blocksize,
+			       void (*start)(void *devdata, struct ioreq *),
+			       void *devdata);
+void iosched_submit(struct iosched *ios, struct ioreq *req);
+int iosched_wait(struct iosched *ios, struct ioreq *req);
+int iosched_io(struct iosched *ios, struct uio *uio);
+void iosched_done(struct iosched *ios, int result);
+
+void iosched_printstats(void);
+
+
+#endif /* _IOSCHED_H_ */
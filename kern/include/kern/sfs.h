@@ -41,8 +41,8 @@
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
@@ -62,11 +62,96 @@
 /* Size of free block bitmap (in blocks) */
 #define SFS_FREEMAPBLOCKS(nblocks)  (SFS_FREEMAPBITS(nblocks)/SFS_BITSPERBLOCK)
 
+/* Number of directory entries in a block */
+#define SFS_DIRSLOTSPERBLOCK (SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/* Flags for sfi_flags */
+#define SFS_IFLAG_HASHDIR   0x1   /* Directory entries placed by hash */
+#define SFS_IFLAG_DIROVFL   0x2   /* Some entries not in their bucket */
+#define SFS_IFLAG_INLINE    0x4   /* File data kept in sfi_inline */
+
+/*
+ * Inline files.
+ *
+ * The space at the end of the inode past the block pointers is
+ * SFS_INLINESIZE bytes. A regular file with SFS_IFLAG_INLINE set
+ * keeps its contents there instead of in data blocks: all its block
+ * pointers are 0, sfi_size is at most SFS_INLINESIZE, and the bytes
+ * of sfi_inline past sfi_size are 0. When such a file grows past
+ * SFS_INLINESIZE its contents move to a data block and the flag is
+ * cleared. In every other inode sfi_inline is all 0.
+ */
+#define SFS_INLINESIZE    ((128-6-SFS_NDIRECT)*4)
+
+/*
+ * Hashed directories.
+ *
+ * A directory with SFS_IFLAG_HASHDIR set is an ordinary directory
+ * whose size is a power-of-two number of blocks (or zero). Each
+ * block is a bucket, and each entry goes in the bucket given by the
+ * low bits of the FNV-1a hash of its name:
+ *
+ *     h = SFS_DIRHASH_INIT;
+ *     for each byte c of the name: h = (h ^ c) * SFS_DIRHASH_PRIME;
+ *     bucket = h & (nbuckets - 1);
+ *
+ * so a lookup reads one block. If an entry had to go in some other
+ * bucket because its own was full, SFS_IFLAG_DIROVFL is set, and
+ * lookups that miss in the home bucket must search the whole
+ * directory. Tools that ignore the flags just see a directory with
+ * some empty slots.
+ */
+#define SFS_DIRHASH_INIT    2166136261U
+#define SFS_DIRHASH_PRIME   16777619U
+
+/*
+ * Metadata journal.
+ *
+ * If sb_journalblocks is nonzero, that many blocks starting at
+ * sb_journalstart hold a redo log of metadata updates. The first is
+ * a header (struct sfs_jheader); the rest are log slots, used in
+ * order from the first one.
+ *
+ * A transaction is a descriptor block (struct sfs_jdesc) naming the
+ * home blocks of up to SFS_JDESC_MAX block images, followed by those
+ * images, possibly followed by more descriptors and images, and
+ * ended by a commit block (struct sfs_jcommit). All of these carry
+ * the transaction's sequence number. The commit block records the
+ * total number of images and the sum of all their 32-bit words; a
+ * transaction whose commit block is missing or doesn't match is
+ * ignored.
+ *
+ * The first transaction in the log has sequence number jh_seq, and
+ * each later one the next number. To recover, copy the images of
+ * every complete transaction to their home blocks, in order,
+ * stopping at the first slot that doesn't hold the next expected
+ * descriptor. Once everything in the log is at home, the log is
+ * emptied by advancing jh_seq past the last transaction.
+ *
+ * Only metadata (inodes, indirect blocks, directories, the freemap
+ * and the superblock) goes through the journal; file data is written
+ * in place before the transaction that refers to it commits.
+ */
+#define SFS_JOURNAL_MAGIC   0x6a6f726eU   /* header */
+#define SFS_JDESC_MAGIC     0x6a646573U   /* descriptor block */
+#define SFS_JCOMMIT_MAGIC   0x6a636f6dU   /* commit block */
+#define SFS_JOURNAL_MIN     8             /* smallest usable journal */
+#define SFS_JDESC_MAX       125           /* images per descriptor */
+
+/*
+ * Superblock flags.
+ *
+ * SFS_SB_CLEAN is set when the volume is unmounted (or made, or
+ * checked and found sound) and cleared on disk as soon as it is
+ * mounted, so a volume that still has it set needs no checking.
+ */
+#define SFS_SB_CLEAN        0x1   /* Unmounted cleanly */
+
 /*
  * On-disk superblock
  */
@@ -74,7 +159,10 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First block of journal */
+	uint32_t sb_journalblocks;		/* Size of journal, or 0 */
+	uint32_t sb_flags;			/* SFS_SB_* below */
+	uint32_t reserved[115];			/* unused, set to 0 */
 };
 
 /*
@@ -86,7 +174,34 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_flags;			/* SFS_IFLAG_* above */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	char sfi_inline[SFS_INLINESIZE];	/* Inline file data, or 0 */
+};
+
+/*
+ * On-disk journal blocks
+ */
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JOURNAL_MAGIC */
+	uint32_t jh_seq;			/* Seq of first transaction */
+	uint32_t jh_reserved[126];		/* unused, set to 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JDESC_MAGIC */
+	uint32_t jd_seq;			/* Transaction sequence number */
+	uint32_t jd_nblocks;			/* Number of images following */
+	uint32_t jd_blocks[SFS_JDESC_MAX];	/* Home block of each image */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;			/* SFS_JCOMMIT_MAGIC */
+	uint32_t jc_seq;			/* Transaction sequence number */
+	uint32_t jc_nblocks;			/* Images in the transaction */
+	uint32_t jc_checksum;			/* Sum of words of the images */
+	uint32_t jc_reserved[124];		/* unused, set to 0 */
 };
 
 /*
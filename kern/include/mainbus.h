@@ -55,6 +55,15 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Control this cpu's clock interrupt. mainbus_timer_oneshot makes the
+ * next interrupt come USECS microseconds from now instead of at the
+ * next hardclock tick; after that interrupt, or after a call to
+ * mainbus_timer_periodic, hardclock runs HZ times a second again.
+ */
+void mainbus_timer_oneshot(uint32_t usecs);
+void mainbus_timer_periodic(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
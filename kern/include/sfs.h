@@ -56,8 +56,26 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	uint32_t sv_ranext;             /* block after last one read */
+	uint32_t sv_raissued;           /* readahead issued up to here */
+	unsigned sv_rawindow;           /* readahead window, in blocks */
+	daddr_t sv_allocgoal;           /* where to put the next block */
+	bool sv_prealloc;               /* open for writing; preallocate */
+	daddr_t sv_pastart;             /* first preallocated block */
+	unsigned sv_pacount;            /* number of preallocated blocks */
+	uint32_t *sv_bmcache;           /* copy of last indirect block used */
+	uint32_t sv_bmcachebase;        /* first file block it maps */
+	bool sv_bmcachevalid;           /* true if sv_bmcache is current */
+	struct sfs_vnode *sv_hashnext;  /* next in vnode table chain */
+	struct sfs_vnode **sv_hashprevp; /* link pointing to us */
 };
 
+/*
+ * Number of hash chains in the table of loaded vnodes. Must be a
+ * power of 2.
+ */
+#define SFS_VNODE_HASHSIZE	256
+
 /*
  * In-memory info for a whole fs volume
  */
@@ -66,9 +84,26 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnodes[SFS_VNODE_HASHSIZE];
+					/* vnodes loaded, by inode number */
+	unsigned sfs_nvnodes;           /* number of vnodes loaded */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_freemapdirtyblocks; /* which freemap blocks */
+
+	/* Journal state; sfs_jslots is 0 if there's no journal */
+	unsigned sfs_jslots;            /* log slots after the header */
+	unsigned sfs_jhead;             /* next free log slot */
+	uint32_t sfs_jfirstseq;         /* seq of first transaction in log */
+	uint32_t sfs_jseq;              /* seq of the open transaction */
+	struct array *sfs_jbufs;        /* buffers in the open transaction */
+	unsigned sfs_jmaxbufs;          /* most that fit in the log */
+	bool sfs_joverflow;             /* open transaction can't be logged */
+	struct bitmap *sfs_jlogged;     /* blocks with images in the log */
+	daddr_t *sfs_jdeferred;         /* frees held back until checkpoint */
+	unsigned sfs_jndeferred;        /* number of those */
+	unsigned sfs_jmaxdeferred;      /* space allocated for them */
+	char *sfs_jstage;               /* staging area for log I/O */
 };
 
 /*
@@ -54,6 +54,9 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
+/* Setup function for futex wait queues. */
+void futex_bootstrap(void);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -64,6 +67,7 @@ void exec_bootstrap(void);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
@@ -76,11 +80,22 @@ int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_close(int fd);
 int sys_read(int fd, userptr_t buf, size_t size, int *retval);
 int sys_write(int fd, userptr_t buf, size_t size, int *retval);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
 int sys_lseek(int fd, off_t offset, int code, off_t *retval);
+int sys_fsync(int fd);
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval);
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int *retval);
+int sys_sync(void);
 
 int sys_chdir(const_userptr_t path);
 int sys___getcwd(userptr_t buf, size_t buflen, int *retval);
 
 int sys_sbrk(intptr_t amount, int *retval);
 
+int sys_futex_wait(userptr_t uaddr, int expected, const_userptr_t timeout);
+int sys_futex_wake(userptr_t uaddr, int count, int *retval);
+
 #endif /* _SYSCALL_H_ */
@@ -56,6 +56,7 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int workqueuetest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
@@ -64,6 +65,9 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int journaltest(int, char **);
+int inlinetest(int, char **);
+int dcachetest(int, char **);
 int printfile(int, char **);
 
 /* other tests */
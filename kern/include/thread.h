@@ -79,9 +79,11 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct thread *t_inboxnext;	/* Link for cpu wakeup inbox */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	bool t_bound;			/* Never migrate off t_cpu */
 	struct proc *t_proc;		/* Process thread belongs to */
 
 	/*
@@ -124,6 +126,9 @@ void thread_bootstrap(void);
 /* Call late in system startup to get secondary CPUs running. */
 void thread_start_cpus(void);
 
+/* Number of CPUs. Fixed once thread_start_cpus has run. */
+unsigned thread_numcpus(void);
+
 /* Call during panic to stop other threads in their tracks */
 void thread_panic(void);
 
@@ -144,6 +149,16 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Make one kernel thread per cpu, each bound to its cpu (the
+ * scheduler will never migrate it). Each thread is named NAME plus
+ * the cpu number, and gets its cpu number as the numeric argument.
+ * Call after thread_start_cpus.
+ */
+int thread_fork_percpu(const char *name,
+                       void (*func)(void *, unsigned long),
+                       void *data1);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
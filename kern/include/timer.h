@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Kernel timers.
+ *
+ * A timer calls a function at (or shortly after) a given time of day.
+ * Pending timers live in a per-cpu timer wheel: an array of
+ * TIMER_WHEELSIZE slots, one per hardclock tick, with each timer
+ * hashed into the slot for the tick its deadline falls in. On every
+ * hardclock the cpu looks only at the slots for the ticks that have
+ * gone by since it last looked, and fires the timers there whose
+ * deadline has passed. Deadlines more than TIMER_WHEELSIZE ticks out
+ * share slots with nearer ones and are just skipped until their time
+ * comes around.
+ *
+ * Timers fire from hardclock, i.e. in interrupt context on the cpu
+ * that scheduled them, so the function must not sleep. Resolution is
+ * one hardclock tick.
+ *
+ * Functions:
+ *     timer_bootstrap - set up; call once at boot.
+ *     timer_init     - initialize a timer to call FUNC(DATA).
+ *     timer_schedule - arm a timer on the current cpu to fire at the
+ *                      absolute time of day DEADLINE. The timer must
+ *                      not already be pending.
+ *     timer_cancel   - disarm a timer. Returns true if it was pending
+ *                      (and thus now will not fire), false if it had
+ *                      already fired or was firing.
+ *     timer_pending  - check if a timer is armed.
+ *     timer_nextdeadline - get the earliest deadline pending on the
+ *                      current cpu. Returns false if there is none.
+ *     timer_sleep    - put the current thread to sleep for DURATION.
+ *     timer_printstats - print the wakeup lateness histograms.
+ *
+ * timerwheel_create and timer_expire are for the clock code.
+ */
+
+#include <kern/time.h>
+
+struct timerwheel;	/* Opaque */
+
+struct timer {
+	struct timer *tm_next;		/* next in wheel slot */
+	struct timer **tm_prevp;	/* pointer to us in wheel slot */
+	struct timerwheel *tm_wheel;	/* wheel we're on, or NULL */
+	struct timespec tm_deadline;	/* when to fire */
+	void (*tm_func)(void *);	/* what to do */
+	void *tm_data;			/* argument for tm_func */
+};
+
+void timer_bootstrap(void);
+void timer_init(struct timer *tm, void (*func)(void *), void *data);
+void timer_schedule(struct timer *tm, const struct timespec *deadline);
+bool timer_cancel(struct timer *tm);
+bool timer_pending(struct timer *tm);
+bool timer_nextdeadline(struct timespec *ret);
+
+void timer_sleep(const struct timespec *duration);
+
+void timer_printstats(void);
+
+struct timerwheel *timerwheel_create(void);
+void timer_expire(void);
+
+
+#endif /* _TIMER_H_ */
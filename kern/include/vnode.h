@@ -98,6 +98,16 @@ struct vnode {
  *                      handled in the normal fashion.
  *                      On non-directory objects, return ENOTDIR.
  *
+ *    vop_getdirentries - Like vop_getdirentry, but read as many
+ *                      entries as fit into the uio, each packed as a
+ *                      struct dirent record (see kern/dirent.h) with
+ *                      its inode number and type if known. The offset
+ *                      field is left pointing at the first entry not
+ *                      returned. If even the first entry's record
+ *                      doesn't fit, return EINVAL.
+ *                      File systems without anything better to do can
+ *                      use vfs_getdirentries_byname.
+ *
  *    vop_write       - Write data from uio to file at offset specified
  *                      in the uio, updating uio_resid to reflect the
  *                      amount written, and updating uio_offset to match.
@@ -187,6 +197,7 @@ struct vnode_ops {
 	int (*vop_read)(struct vnode *file, struct uio *uio);
 	int (*vop_readlink)(struct vnode *link, struct uio *uio);
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
+	int (*vop_getdirentries)(struct vnode *dir, struct uio *uio);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
@@ -231,6 +242,7 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
+#define VOP_GETDIRENTRIES(vn, uio)      (__VOP(vn,getdirentries)(vn, uio))
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
@@ -279,6 +291,16 @@ int vnode_init(struct vnode *, const struct vnode_ops *ops,
  */
 void vnode_cleanup(struct vnode *);
 
+/*
+ * Helpers for vop_getdirentries: append one struct dirent record to
+ * a uio and advance the directory position to NEXTPOS (setting *FULL
+ * instead if it doesn't fit), and a version of the whole operation
+ * built on vop_getdirentry that returns names only.
+ */
+int vfs_putdirent(struct uio *uio, ino_t ino, mode_t type, const char *name,
+		  off_t nextpos, bool *full);
+int vfs_getdirentries_byname(struct vnode *dir, struct uio *uio);
+
 /*
  * Common stubs for vnode functions that just fail, in various ways.
  */
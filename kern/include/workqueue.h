@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Deferred work.
+ *
+ * Each cpu has a queue of work items and a kernel thread, bound to
+ * that cpu, that runs them. Scheduling work from an interrupt handler
+ * is allowed, and is the main point: the handler does the minimum and
+ * leaves the rest to run later in thread context, where it may sleep.
+ *
+ * The worker takes everything queued at once and runs the whole
+ * batch before looking again, and only the item that makes an empty
+ * queue nonempty wakes the worker, so a burst of work costs one
+ * wakeup.
+ *
+ * Functions:
+ *     workqueue_bootstrap - start the worker threads; call after
+ *                     thread_start_cpus.
+ *     work_init     - initialize a work item to call FUNC(ARG).
+ *     work_schedule - queue a work item on the current cpu. Returns
+ *                     false (and does nothing) if the item is already
+ *                     queued or pending. Once the function starts
+ *                     running the item may be scheduled again.
+ *     work_schedule_delayed - like work_schedule, but the item is
+ *                     queued only once DELAY has gone by.
+ *     workqueue_enqueue - allocate a one-shot work item for FUNC(ARG)
+ *                     and schedule it. It is freed after it runs.
+ *                     Not for use in interrupt handlers.
+ */
+
+#include <timer.h>
+
+struct work {
+	struct work *wk_next;		/* next in queue */
+	void *volatile wk_owner;	/* queue claiming us, or NULL */
+	void (*wk_func)(void *);	/* what to do */
+	void *wk_arg;			/* argument for wk_func */
+	bool wk_autofree;		/* kfree after running */
+	struct timer wk_timer;		/* for work_schedule_delayed */
+};
+
+void workqueue_bootstrap(void);
+
+void work_init(struct work *wk, void (*func)(void *), void *arg);
+bool work_schedule(struct work *wk);
+bool work_schedule_delayed(struct work *wk, const struct timespec *delay);
+
+int workqueue_enqueue(void (*func)(void *), void *arg);
+
+
+#endif /* _WORKQUEUE_H_ */
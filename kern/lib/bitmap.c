@@ -47,17 +47,70 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * To avoid scanning the whole map when it's mostly full, the words
+ * are divided into groups of GROUP_WORDS, and a summary map keeps one
+ * bit per group that is set when every bit in the group is set. A
+ * search only looks inside groups whose summary bit is clear, and
+ * skips 32 full groups (8192 bits) per summary word.
+ *
+ * The summary is derived from the data. If the data is changed
+ * directly (through bitmap_getdata), call bitmap_datachanged.
+ */
+#define GROUP_WORDS     32
+#define SUMMARY_BITS    32
+
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
+        unsigned ngroups;
+        uint32_t *full;         /* bit set: group all in use */
 };
 
+/*
+ * Index of the lowest set bit in X, which must be nonzero. X & -X
+ * isolates that bit; counting leading zeros then gives its position
+ * in one instruction on MIPS32 (clz).
+ */
+static
+inline
+unsigned
+bitmap_lowbit(uint32_t x)
+{
+        KASSERT(x != 0);
+        return 31 - __builtin_clz(x & -x);
+}
+
+/*
+ * Recompute the summary bit for group GROUP.
+ */
+static
+void
+bitmap_update_group(struct bitmap *b, unsigned group)
+{
+        unsigned ix, maxix;
+        uint32_t mask;
+
+        maxix = (group + 1) * GROUP_WORDS;
+        if (maxix > DIVROUNDUP(b->nbits, BITS_PER_WORD)) {
+                maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        }
+        mask = (uint32_t)1 << (group % SUMMARY_BITS);
+
+        for (ix = group * GROUP_WORDS; ix < maxix; ix++) {
+                if (b->v[ix] != WORD_ALLBITS) {
+                        b->full[group / SUMMARY_BITS] &= ~mask;
+                        return;
+                }
+        }
+        b->full[group / SUMMARY_BITS] |= mask;
+}
 
 struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b;
-        unsigned words;
+        unsigned words, summarywords;
 
         words = DIVROUNDUP(nbits, BITS_PER_WORD);
         b = kmalloc(sizeof(struct bitmap));
@@ -69,8 +122,17 @@ bitmap_create(unsigned nbits)
                 kfree(b);
                 return NULL;
         }
+        b->ngroups = DIVROUNDUP(words, GROUP_WORDS);
+        summarywords = DIVROUNDUP(b->ngroups, SUMMARY_BITS);
+        b->full = kmalloc(summarywords*sizeof(uint32_t));
+        if (b->full == NULL) {
+                kfree(b->v);
+                kfree(b);
+                return NULL;
+        }
 
         bzero(b->v, words*sizeof(WORD_TYPE));
+        bzero(b->full, summarywords*sizeof(uint32_t));
         b->nbits = nbits;
 
         /* Mark any leftover bits at the end in use */
@@ -95,29 +157,111 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+void
+bitmap_datachanged(struct bitmap *b)
+{
+        unsigned group;
+
+        for (group = 0; group < b->ngroups; group++) {
+                bitmap_update_group(b, group);
+        }
+}
+
+/*
+ * Find the first cleared bit at or after START, without wrapping.
+ */
+static
 int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+bitmap_findclear(struct bitmap *b, unsigned start, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned ix, maxix, group, endix;
+        uint32_t summary;
+        WORD_TYPE w;
+
+        maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        if (start >= b->nbits) {
+                return ENOSPC;
+        }
+
+        /* The word START is in, ignoring the bits below START */
+        ix = start / BITS_PER_WORD;
+        w = b->v[ix] | (WORD_TYPE)((1U << (start % BITS_PER_WORD)) - 1);
+        if (w != WORD_ALLBITS) {
+                goto found;
+        }
+
+        /* The rest of START's group */
+        for (ix++; ix < maxix && ix % GROUP_WORDS != 0; ix++) {
+                if (b->v[ix] != WORD_ALLBITS) {
+                        w = b->v[ix];
+                        goto found;
+                }
+        }
+
+        if (ix >= maxix) {
+                return ENOSPC;
+        }
+
+        /* Whole groups, skipping full ones using the summary */
+        group = ix / GROUP_WORDS;
+        while (group < b->ngroups) {
+                summary = b->full[group / SUMMARY_BITS];
+                if (group % SUMMARY_BITS != 0) {
+                        summary |= ((uint32_t)1 << (group % SUMMARY_BITS))
+                                - 1;
+                }
+                if (summary == 0xffffffff) {
+                        group = (group / SUMMARY_BITS + 1) * SUMMARY_BITS;
+                        continue;
+                }
+                group = (group / SUMMARY_BITS) * SUMMARY_BITS
+                        + bitmap_lowbit(~summary);
+                if (group >= b->ngroups) {
+                        break;
+                }
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
+                endix = (group + 1) * GROUP_WORDS;
+                if (endix > maxix) {
+                        endix = maxix;
+                }
+                for (ix = group * GROUP_WORDS; ix < endix; ix++) {
+                        if (b->v[ix] != WORD_ALLBITS) {
+                                w = b->v[ix];
+                                goto found;
                         }
-                        KASSERT(0);
                 }
+                panic("bitmap: group %u is full but not marked so\n",
+                      group);
         }
         return ENOSPC;
+
+ found:
+        *index = ix*BITS_PER_WORD + bitmap_lowbit((WORD_TYPE)~w);
+        KASSERT(*index < b->nbits);
+        return 0;
+}
+
+int
+bitmap_alloc_hint(struct bitmap *b, unsigned hint, unsigned *index)
+{
+        int result;
+
+        result = bitmap_findclear(b, hint, index);
+        if (result && hint > 0) {
+                /* Wrap around */
+                result = bitmap_findclear(b, 0, index);
+        }
+        if (result) {
+                return result;
+        }
+        bitmap_mark(b, *index);
+        return 0;
+}
+
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        return bitmap_alloc_hint(b, 0, index);
 }
 
 static
@@ -142,12 +286,15 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        if (b->v[ix] == WORD_ALLBITS) {
+                bitmap_update_group(b, ix / GROUP_WORDS);
+        }
 }
 
 void
 bitmap_unmark(struct bitmap *b, unsigned index)
 {
-        unsigned ix;
+        unsigned ix, group;
         WORD_TYPE mask;
 
         KASSERT(index < b->nbits);
@@ -155,6 +302,9 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        group = ix / GROUP_WORDS;
+        b->full[group / SUMMARY_BITS] &=
+                ~((uint32_t)1 << (group % SUMMARY_BITS));
 }
 
 
@@ -171,6 +321,7 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
+        kfree(b->full);
         kfree(b->v);
         kfree(b);
 }
@@ -46,8 +46,10 @@
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <pid.h>
 #include <syscall.h>
+#include <workqueue.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -114,6 +116,7 @@ boot(void)
 	pid_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+	buffer_bootstrap();
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -130,7 +133,9 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	exec_bootstrap();
+	futex_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
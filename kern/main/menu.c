@@ -36,9 +36,13 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <buf.h>
+#include <iosched.h>
+#include <dcache.h>
 #include <sfs.h>
 #include <pid.h>
 #include <syscall.h>
@@ -243,6 +247,22 @@ cmd_sync(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for setting the buffer cache syncer's interval (seconds)
+ * and dirty threshold (percent).
+ */
+static
+int
+cmd_syncer(int nargs, char **args)
+{
+	if (nargs != 3) {
+		kprintf("Usage: syncer seconds percent\n");
+		return EINVAL;
+	}
+
+	return buffer_setsyncer(atoi(args[1]), atoi(args[2]));
+}
+
 /*
  * Command for doing an intentional panic.
  */
@@ -408,6 +428,54 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_timerstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	timer_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buffer_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_ioschedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	iosched_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_dcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	dcache_printstats();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -447,6 +515,7 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[syncer]  Set syncer interval/ratio ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -481,6 +550,7 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[wq]  Workqueue test                ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -488,6 +558,11 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+#if OPT_SFS
+	"[jt]  SFS journal test              ",
+	"[it]  SFS inline file test          ",
+	"[dct] Name cache test               ",
+#endif
 	NULL
 };
 
@@ -550,6 +625,7 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "syncer",	cmd_syncer },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -559,6 +635,10 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "ts",         cmd_timerstats },
+	{ "bs",         cmd_bufstats },
+	{ "ios",        cmd_ioschedstats },
+	{ "dcs",        cmd_dcachestats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -580,6 +660,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "wq",		workqueuetest },
 
 	/* system call assignment tests */
 	/* For testing the wait implementation. */
@@ -592,6 +673,11 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+#if OPT_SFS
+	{ "jt",		journaltest },
+	{ "it",		inlinetest },
+	{ "dct",	dcachetest },
+#endif
 
 	{ NULL, NULL }
 };
@@ -105,19 +105,23 @@ sys_open(const_userptr_t upath, int flags, mode_t mode, int *retval)
 }
 
 /*
- * Common logic for read and write.
+ * Common logic for all the read and write calls.
  *
- * Look up the fd, then use VOP_READ or VOP_WRITE.
+ * Look up the fd, then use VOP_READ or VOP_WRITE on a uio made from
+ * the IOVCNT iovecs in IOV, which add up to SIZE bytes. Ordinary
+ * calls use the file's seek position, under the offset lock, and
+ * advance it. Positional calls (POSITIONAL set) do the I/O at POS
+ * instead and don't touch the seek position, so they don't need the
+ * lock at all.
  */
 static
 int
-sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
-	      int badaccmode, ssize_t *retval)
+sys_rwiov(int fd, struct iovec *iov, unsigned iovcnt, size_t size,
+	  bool positional, off_t pos, enum uio_rw rw, int badaccmode,
+	  ssize_t *retval)
 {
 	struct openfile *file;
 	bool locked;
-	off_t pos;
-	struct iovec iov;
 	struct uio useruio;
 	int result;
 
@@ -127,9 +131,20 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 		return result;
 	}
 
-	/* Only lock the seek position if we're really using it. */
-	locked = VOP_ISSEEKABLE(file->of_vnode);
-	if (locked) {
+	locked = false;
+	if (positional) {
+		if (!VOP_ISSEEKABLE(file->of_vnode)) {
+			result = ESPIPE;
+			goto fail;
+		}
+		if (pos < 0) {
+			result = EINVAL;
+			goto fail;
+		}
+	}
+	else if (VOP_ISSEEKABLE(file->of_vnode)) {
+		/* Only lock the seek position if we're really using it. */
+		locked = true;
 		lock_acquire(file->of_offsetlock);
 		pos = file->of_offset;
 	}
@@ -142,8 +157,14 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 		goto fail;
 	}
 
-	/* set up a uio with the buffer, its size, and the current offset */
-	uio_uinit(&iov, &useruio, buf, size, pos, rw);
+	/* set up a uio with the buffers, their size, and the offset */
+	useruio.uio_iov = iov;
+	useruio.uio_iovcnt = iovcnt;
+	useruio.uio_offset = pos;
+	useruio.uio_resid = size;
+	useruio.uio_segflg = UIO_USERSPACE;
+	useruio.uio_rw = rw;
+	useruio.uio_space = proc_getas();
 
 	/* do the read or write */
 	result = (rw == UIO_READ) ?
@@ -162,8 +183,8 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 	filetable_put(curproc->p_filetable, fd, file);
 
 	/*
-	 * The amount read (or written) is the original buffer size,
-	 * minus how much is left in it.
+	 * The amount read (or written) is the original size, minus
+	 * how much is left.
 	 */
 	*retval = size - useruio.uio_resid;
 
@@ -177,6 +198,66 @@ fail:
 	return result;
 }
 
+/*
+ * Common logic for read and write: one buffer, at the seek position.
+ */
+static
+int
+sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
+	      int badaccmode, ssize_t *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_rwiov(fd, &iov, 1, size, false, 0, rw, badaccmode, retval);
+}
+
+/*
+ * Common logic for readv and writev: copy in the iovec array, check
+ * that the total size is sensible, and do the I/O at the seek
+ * position.
+ */
+static
+int
+sys_readwritev(int fd, const_userptr_t iovp, int iovcnt, enum uio_rw rw,
+	       int badaccmode, ssize_t *retval)
+{
+	struct iovec *iov;
+	size_t size;
+	int i, result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	iov = kmalloc(iovcnt * sizeof(*iov));
+	if (iov == NULL) {
+		return ENOMEM;
+	}
+	result = copyin(iovp, iov, iovcnt * sizeof(*iov));
+	if (result) {
+		kfree(iov);
+		return result;
+	}
+
+	/* The total has to fit in the return value */
+	size = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (iov[i].iov_len > (size_t)-1 >> 1 ||
+		    (ssize_t)(size + iov[i].iov_len) < 0) {
+			kfree(iov);
+			return EINVAL;
+		}
+		size += iov[i].iov_len;
+	}
+
+	result = sys_rwiov(fd, iov, iovcnt, size, false, 0, rw, badaccmode,
+			   retval);
+	kfree(iov);
+	return result;
+}
+
 /*
  * read() - use sys_readwrite
  */
@@ -195,6 +276,52 @@ sys_write(int fd, userptr_t buf, size_t size, int *retval)
 	return sys_readwrite(fd, buf, size, UIO_WRITE, O_RDONLY, retval);
 }
 
+/*
+ * readv() - use sys_readwritev
+ */
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_READ, O_WRONLY, retval);
+}
+
+/*
+ * writev() - use sys_readwritev
+ */
+int
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_WRITE, O_RDONLY, retval);
+}
+
+/*
+ * pread() - one buffer at POS, leaving the seek position alone
+ */
+int
+sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_rwiov(fd, &iov, 1, size, true, pos, UIO_READ, O_WRONLY,
+			 retval);
+}
+
+/*
+ * pwrite() - same as pread, but writing
+ */
+int
+sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_rwiov(fd, &iov, 1, size, true, pos, UIO_WRITE, O_RDONLY,
+			 retval);
+}
+
 /*
  * close() - remove from the file table.
  */
@@ -288,6 +415,90 @@ sys_lseek(int fd, off_t offset, int whence, off_t *retval)
 	return 0;
 }
 
+/*
+ * fsync() - flush a file's data and metadata to disk.
+ */
+int
+sys_fsync(int fd)
+{
+	struct openfile *file;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_FSYNC(file->of_vnode);
+
+	filetable_put(curproc->p_filetable, fd, file);
+	return result;
+}
+
+/*
+ * Common logic for getdirentry and getdirentries.
+ *
+ * The seek position is the directory position; what it means is up
+ * to the file system.
+ */
+static
+int
+sys_dirread(int fd, userptr_t buf, size_t buflen, bool many, int *retval)
+{
+	struct openfile *file;
+	struct iovec iov;
+	struct uio useruio;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(file->of_offsetlock);
+
+	uio_uinit(&iov, &useruio, buf, buflen, file->of_offset, UIO_READ);
+	result = many ?
+		VOP_GETDIRENTRIES(file->of_vnode, &useruio) :
+		VOP_GETDIRENTRY(file->of_vnode, &useruio);
+	if (result == 0) {
+		file->of_offset = useruio.uio_offset;
+		*retval = buflen - useruio.uio_resid;
+	}
+
+	lock_release(file->of_offsetlock);
+	filetable_put(curproc->p_filetable, fd, file);
+	return result;
+}
+
+/*
+ * getdirentry() - read one name from a directory.
+ */
+int
+sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval)
+{
+	return sys_dirread(fd, buf, buflen, false, retval);
+}
+
+/*
+ * getdirentries() - read as many entries from a directory as fit,
+ * as struct dirent records.
+ */
+int
+sys_getdirentries(int fd, userptr_t buf, size_t buflen, int *retval)
+{
+	return sys_dirread(fd, buf, buflen, true, retval);
+}
+
+/*
+ * sync() - flush everything on every filesystem to disk.
+ */
+int
+sys_sync(void)
+{
+	return vfs_sync();
+}
+
 /*
  * dup2() - clone a file descriptor.
  */
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futex-style wait/wake system calls.
+ *
+ * A user program keeps a lock or counter in an ordinary word of its
+ * own memory and only traps into the kernel when it actually has to
+ * block (futex_wait) or when it knows somebody might be blocked
+ * (futex_wake). The uncontended case costs no system call at all.
+ *
+ * Waiters are keyed on the physical address of the word, so two
+ * address spaces that map the same page (or the same process using
+ * two virtual aliases) rendezvous on the same queue. Keys hash into a
+ * fixed table of buckets; each bucket has a spinlock and a short
+ * chain of queues, one per key that currently has sleepers, and each
+ * queue carries its own wchan.
+ *
+ * The value check in futex_wait and the wakeup in futex_wake are both
+ * done under the bucket lock, so a wake that follows a store to the
+ * word cannot slip in between a waiter's check and its sleep.
+ *
+ * futex_wake hands out wakeups as tokens (fq_wakeups) rather than
+ * waking particular threads, because a waiter with a timeout can
+ * also be woken by its timer: whoever wakes up and finds a token
+ * takes it, and a waiter whose time is up without one leaves with
+ * ETIMEDOUT.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <proc.h>
+#include <clock.h>
+#include <timer.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/* Number of hash buckets. Must be a power of 2. */
+#define FUTEX_NBUCKETS	64
+
+/*
+ * Wait queue for one key.
+ */
+struct futex_queue {
+	struct futex_queue *fq_next;	/* next queue in the bucket */
+	paddr_t fq_key;			/* physical address of the word */
+	struct wchan *fq_wchan;		/* where the waiters sleep */
+	unsigned fq_sleepers;		/* threads not yet woken */
+	unsigned fq_wakeups;		/* wakeups not yet taken */
+	unsigned fq_refs;		/* threads still using the queue */
+};
+
+/*
+ * Hash bucket.
+ */
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct futex_queue *fb_queues;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+/*
+ * Setup function.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		futex_table[i].fb_queues = NULL;
+	}
+}
+
+/*
+ * Hash a key. The low two bits are always zero because the word must
+ * be aligned; fold in the page number so that the same offset on
+ * different pages doesn't all land in one bucket.
+ */
+static
+struct futex_bucket *
+futex_hash(paddr_t key)
+{
+	uint32_t h;
+
+	h = (key >> 2) ^ (key >> 12);
+	return &futex_table[h & (FUTEX_NBUCKETS - 1)];
+}
+
+/*
+ * Check the user address and turn it into a key.
+ *
+ * The copyin both rejects kernel addresses and makes sure the page is
+ * actually present, so that the translation afterwards cannot fail on
+ * a lazily-allocated page.
+ */
+static
+int
+futex_getkey(userptr_t uaddr, paddr_t *key)
+{
+	struct addrspace *as;
+	int val;
+	int result;
+
+	if (((vaddr_t)uaddr & (sizeof(int) - 1)) != 0) {
+		return EINVAL;
+	}
+
+	result = copyin((const_userptr_t)uaddr, &val, sizeof(val));
+	if (result) {
+		return result;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_translate(as, (vaddr_t)uaddr, key, NULL);
+}
+
+/*
+ * Find the queue for KEY in bucket FB. Call with the bucket locked.
+ */
+static
+struct futex_queue *
+futex_findqueue(struct futex_bucket *fb, paddr_t key)
+{
+	struct futex_queue *fq;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	for (fq = fb->fb_queues; fq != NULL; fq = fq->fq_next) {
+		if (fq->fq_key == key) {
+			return fq;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Create a queue. Done without holding the bucket lock.
+ */
+static
+struct futex_queue *
+futex_queue_create(paddr_t key)
+{
+	struct futex_queue *fq;
+
+	fq = kmalloc(sizeof(*fq));
+	if (fq == NULL) {
+		return NULL;
+	}
+	fq->fq_wchan = wchan_create("futex");
+	if (fq->fq_wchan == NULL) {
+		kfree(fq);
+		return NULL;
+	}
+	fq->fq_next = NULL;
+	fq->fq_key = key;
+	fq->fq_sleepers = 0;
+	fq->fq_wakeups = 0;
+	fq->fq_refs = 0;
+	return fq;
+}
+
+/*
+ * Destroy a queue. It must already be unlinked from its bucket.
+ */
+static
+void
+futex_queue_destroy(struct futex_queue *fq)
+{
+	KASSERT(fq->fq_refs == 0);
+	KASSERT(fq->fq_sleepers == 0);
+	KASSERT(fq->fq_wakeups == 0);
+	wchan_destroy(fq->fq_wchan);
+	kfree(fq);
+}
+
+/*
+ * Unlink FQ from bucket FB. Call with the bucket locked.
+ */
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_queue *fq)
+{
+	struct futex_queue **pp;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	for (pp = &fb->fb_queues; *pp != NULL; pp = &(*pp)->fq_next) {
+		if (*pp == fq) {
+			*pp = fq->fq_next;
+			fq->fq_next = NULL;
+			return;
+		}
+	}
+	panic("futex: queue %p not in its bucket\n", fq);
+}
+
+/*
+ * Timeout state for one futex_wait, on the waiter's stack.
+ */
+struct futex_timeout {
+	struct futex_bucket *ft_fb;
+	struct futex_queue *ft_fq;
+	bool ft_expired;		/* set (under fb_lock) when it fires */
+};
+
+/*
+ * Timer function for a futex_wait timeout.
+ */
+static
+void
+futex_timedout(void *vft)
+{
+	struct futex_timeout *ft = vft;
+	struct futex_bucket *fb = ft->ft_fb;
+
+	spinlock_acquire(&fb->fb_lock);
+	ft->ft_expired = true;
+	/* Other waiters on the queue will go back to sleep. */
+	wchan_wakeall(ft->ft_fq->fq_wchan, &fb->fb_lock);
+	spinlock_release(&fb->fb_lock);
+}
+
+/*
+ * futex_wait: if the word at UADDR still contains EXPECTED, sleep
+ * until woken by futex_wake on the same word. Otherwise fail with
+ * EAGAIN so the caller can re-examine the word. If UTIMEOUT is not
+ * NULL, it points to the longest time to sleep; after that, fail
+ * with ETIMEDOUT.
+ */
+int
+sys_futex_wait(userptr_t uaddr, int expected, const_userptr_t utimeout)
+{
+	struct futex_bucket *fb;
+	struct futex_queue *fq, *spare;
+	struct futex_timeout ft;
+	struct timespec deadline;
+	struct timer tm;
+	paddr_t key;
+	int result;
+
+	if (utimeout != NULL) {
+		result = copyin(utimeout, &deadline, sizeof(deadline));
+		if (result) {
+			return result;
+		}
+		if (deadline.tv_sec < 0 || deadline.tv_nsec < 0 ||
+		    deadline.tv_nsec >= 1000000000) {
+			return EINVAL;
+		}
+	}
+
+	result = futex_getkey(uaddr, &key);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(key);
+
+	spinlock_acquire(&fb->fb_lock);
+
+	/*
+	 * Compare the word through the direct-mapped kernel segment
+	 * so no fault (and thus no sleep) can happen under the lock.
+	 */
+	if (*(volatile int *)PADDR_TO_KVADDR(key) != expected) {
+		spinlock_release(&fb->fb_lock);
+		return EAGAIN;
+	}
+
+	fq = futex_findqueue(fb, key);
+	if (fq == NULL) {
+		/* Don't allocate with the spinlock held; retry after. */
+		spinlock_release(&fb->fb_lock);
+		spare = futex_queue_create(key);
+		if (spare == NULL) {
+			return ENOMEM;
+		}
+		spinlock_acquire(&fb->fb_lock);
+
+		/* The word may have changed while we were unlocked. */
+		if (*(volatile int *)PADDR_TO_KVADDR(key) != expected) {
+			spinlock_release(&fb->fb_lock);
+			futex_queue_destroy(spare);
+			return EAGAIN;
+		}
+
+		fq = futex_findqueue(fb, key);
+		if (fq == NULL) {
+			fq = spare;
+			spare = NULL;
+			fq->fq_next = fb->fb_queues;
+			fb->fb_queues = fq;
+		}
+	}
+	else {
+		spare = NULL;
+	}
+
+	fq->fq_refs++;
+	fq->fq_sleepers++;
+
+	if (utimeout != NULL) {
+		struct timespec now;
+
+		gettime(&now);
+		timespec_add(&now, &deadline, &deadline);
+		ft.ft_fb = fb;
+		ft.ft_fq = fq;
+		ft.ft_expired = false;
+		timer_init(&tm, futex_timedout, &ft);
+		timer_schedule(&tm, &deadline);
+	}
+
+	result = 0;
+	while (fq->fq_wakeups == 0) {
+		if (utimeout != NULL && ft.ft_expired) {
+			fq->fq_sleepers--;
+			result = ETIMEDOUT;
+			break;
+		}
+		wchan_sleep(fq->fq_wchan, &fb->fb_lock);
+	}
+	if (result == 0) {
+		/* futex_wake has already taken us off fq_sleepers. */
+		fq->fq_wakeups--;
+	}
+
+	if (utimeout != NULL && !timer_cancel(&tm)) {
+		/* It fired; wait until futex_timedout is done with FT. */
+		while (!ft.ft_expired) {
+			spinlock_release(&fb->fb_lock);
+			spinlock_acquire(&fb->fb_lock);
+		}
+	}
+
+	KASSERT(fq->fq_refs > 0);
+	fq->fq_refs--;
+	if (fq->fq_refs == 0) {
+		futex_unlink(fb, fq);
+	}
+	else {
+		fq = NULL;
+	}
+	spinlock_release(&fb->fb_lock);
+
+	if (fq != NULL) {
+		futex_queue_destroy(fq);
+	}
+	if (spare != NULL) {
+		futex_queue_destroy(spare);
+	}
+	return result;
+}
+
+/*
+ * futex_wake: wake up to COUNT threads sleeping in futex_wait on the
+ * word at UADDR. Returns the number actually woken.
+ */
+int
+sys_futex_wake(userptr_t uaddr, int count, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_queue *fq;
+	paddr_t key;
+	int woken;
+	int result;
+
+	if (count < 0) {
+		return EINVAL;
+	}
+
+	result = futex_getkey(uaddr, &key);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(key);
+
+	woken = 0;
+	spinlock_acquire(&fb->fb_lock);
+	fq = futex_findqueue(fb, key);
+	if (fq != NULL) {
+		while (woken < count && fq->fq_sleepers > 0) {
+			fq->fq_sleepers--;
+			fq->fq_wakeups++;
+			wchan_wakeone(fq->fq_wchan, &fb->fb_lock);
+			woken++;
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
@@ -101,6 +101,22 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Allocation from a hint takes the next clear bit, wrapping */
+	for (i=0; i<TESTSIZE; i++) {
+		if (random()%2) {
+			bitmap_unmark(b, i);
+			data[i] = 1;
+		}
+	}
+	while (bitmap_alloc_hint(b, TESTSIZE/2, &x)==0) {
+		KASSERT(x < TESTSIZE);
+		KASSERT(data[x]==1);
+		for (i=TESTSIZE/2; i != (int)x; i = (i+1) % TESTSIZE) {
+			KASSERT(data[i]==0);
+		}
+		data[x] = 0;
+	}
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name cache test.
+ *
+ * Run on an SFS volume that isn't mounted, e.g. "dct lhd1". Looks
+ * names up so they're cached, positively or negatively, then changes
+ * the directory and checks that lookups see the change: a name
+ * created after a failed lookup is found, removed and renamed-away
+ * names are gone, and opening a cached name with O_CREAT but not
+ * O_EXCL gets the existing file. Finally checks that the volume can
+ * be unmounted while names on it are cached.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <sfs.h>
+#include <test.h>
+
+static const char *dct_dev;
+
+/*
+ * Look up FILE and check that it exists and is WANT (if WANT isn't
+ * NULL), or that it doesn't exist (if WANT is NULL).
+ */
+static
+int
+dct_lookup(const char *what, const char *file, struct vnode *want)
+{
+	char name[64];
+	struct vnode *vn;
+	int result;
+
+	/* vfs_lookup destroys the string it's passed */
+	snprintf(name, sizeof(name), "%s:%s", dct_dev, file);
+	result = vfs_lookup(name, &vn);
+	if (result == ENOENT && want == NULL) {
+		return 0;
+	}
+	if (result) {
+		kprintf("dct: %s: lookup %s: %s\n", what, file,
+			strerror(result));
+		return result;
+	}
+	VOP_DECREF(vn);
+	if (want == NULL) {
+		kprintf("dct: %s: %s should not exist\n", what, file);
+		return EIO;
+	}
+	if (vn != want) {
+		kprintf("dct: %s: %s is the wrong file\n", what, file);
+		return EIO;
+	}
+	return 0;
+}
+
+static
+int
+dct_open(const char *file, int flags, struct vnode **ret)
+{
+	char name[64];
+	int result;
+
+	snprintf(name, sizeof(name), "%s:%s", dct_dev, file);
+	result = vfs_open(name, flags, 0664, ret);
+	if (result) {
+		kprintf("dct: open %s: %s\n", file, strerror(result));
+	}
+	return result;
+}
+
+static
+int
+dct_remove(const char *file)
+{
+	char name[64];
+	int result;
+
+	snprintf(name, sizeof(name), "%s:%s", dct_dev, file);
+	result = vfs_remove(name);
+	if (result) {
+		kprintf("dct: remove %s: %s\n", file, strerror(result));
+	}
+	return result;
+}
+
+static
+int
+dct_rename(const char *from, const char *to)
+{
+	char oldname[64], newname[64];
+	int result;
+
+	snprintf(oldname, sizeof(oldname), "%s:%s", dct_dev, from);
+	snprintf(newname, sizeof(newname), "%s:%s", dct_dev, to);
+	result = vfs_rename(oldname, newname);
+	if (result) {
+		kprintf("dct: rename %s to %s: %s\n", from, to,
+			strerror(result));
+	}
+	return result;
+}
+
+/*
+ * A failed lookup is cached; creating the name must replace that.
+ */
+static
+int
+dct_negative(void)
+{
+	struct vnode *vn;
+	int result;
+
+	result = dct_lookup("before create", "dcta", NULL);
+	if (result) {
+		return result;
+	}
+	result = dct_lookup("before create, again", "dcta", NULL);
+	if (result) {
+		return result;
+	}
+	result = dct_open("dcta", O_WRONLY|O_CREAT|O_EXCL, &vn);
+	if (result) {
+		return result;
+	}
+	result = dct_lookup("after create", "dcta", vn);
+	vfs_close(vn);
+	return result;
+}
+
+/*
+ * Opening a cached name with O_CREAT gets the file that's there;
+ * with O_EXCL as well, it fails.
+ */
+static
+int
+dct_creat(void)
+{
+	char name[64];
+	struct vnode *vn, *vn2;
+	int result;
+
+	result = dct_open("dcta", O_RDONLY, &vn);
+	if (result) {
+		return result;
+	}
+	result = dct_lookup("cached", "dcta", vn);
+	if (result) {
+		goto out;
+	}
+	result = dct_open("dcta", O_WRONLY|O_CREAT, &vn2);
+	if (result) {
+		goto out;
+	}
+	vfs_close(vn2);
+	if (vn2 != vn) {
+		kprintf("dct: O_CREAT on a cached name made a new file\n");
+		result = EIO;
+		goto out;
+	}
+	snprintf(name, sizeof(name), "%s:dcta", dct_dev);
+	result = vfs_open(name, O_WRONLY|O_CREAT|O_EXCL, 0664, &vn2);
+	if (result == 0) {
+		vfs_close(vn2);
+		kprintf("dct: O_EXCL on a cached name succeeded\n");
+		result = EIO;
+	}
+	else if (result == EEXIST) {
+		result = 0;
+	}
+	else {
+		kprintf("dct: O_EXCL on a cached name: %s\n",
+			strerror(result));
+	}
+ out:
+	vfs_close(vn);
+	return result;
+}
+
+/*
+ * Removing or renaming a cached name must make lookups of it miss.
+ */
+static
+int
+dct_stale(void)
+{
+	struct vnode *vn;
+	int result;
+
+	result = dct_open("dcta", O_RDONLY, &vn);
+	if (result) {
+		return result;
+	}
+
+	/* Cache the old name positively and the new one negatively */
+	result = dct_lookup("before rename", "dcta", vn);
+	if (result == 0) {
+		result = dct_lookup("before rename", "dctb", NULL);
+	}
+	if (result == 0) {
+		result = dct_rename("dcta", "dctb");
+	}
+	if (result == 0) {
+		result = dct_lookup("after rename", "dcta", NULL);
+	}
+	if (result == 0) {
+		result = dct_lookup("after rename", "dctb", vn);
+	}
+	vfs_close(vn);
+	if (result) {
+		return result;
+	}
+
+	result = dct_remove("dctb");
+	if (result) {
+		return result;
+	}
+	return dct_lookup("after remove", "dctb", NULL);
+}
+
+int
+dcachetest(int nargs, char **args)
+{
+	char *dev;
+	int result, result2;
+
+	if (nargs != 2) {
+		kprintf("Usage: dct device\n");
+		return EINVAL;
+	}
+
+	/* Allow (but do not require) colon after device name */
+	dev = args[1];
+	if (dev[strlen(dev)-1] == ':') {
+		dev[strlen(dev)-1] = 0;
+	}
+	dct_dev = dev;
+
+	kprintf("Starting name cache test...\n");
+
+	result = sfs_mount(dev);
+	if (result) {
+		kprintf("dct: mount: %s\n", strerror(result));
+		goto fail;
+	}
+
+	result = dct_negative();
+	if (result == 0) {
+		kprintf("dct: Create after failed lookup: ok\n");
+		result = dct_creat();
+	}
+	if (result == 0) {
+		kprintf("dct: O_CREAT on cached name: ok\n");
+		result = dct_stale();
+	}
+	if (result == 0) {
+		kprintf("dct: Remove and rename: ok\n");
+	}
+
+	/* Cached names must not keep the volume busy */
+	result2 = vfs_unmount(dev);
+	if (result2) {
+		kprintf("dct: unmount: %s\n", strerror(result2));
+		if (result == 0) {
+			result = result2;
+		}
+	}
+	if (result) {
+		goto fail;
+	}
+	kprintf("dct: Unmount with cached names: ok\n");
+
+	kprintf("Name cache test done\n");
+	return 0;
+
+ fail:
+	kprintf("Name cache test failed\n");
+	return result;
+}
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS inline file test.
+ *
+ * Run on an SFS volume that isn't mounted, e.g. "it lhd1". Checks
+ * that small files live in the inode and move out to a data block
+ * when a write or truncate takes them past SFS_INLINESIZE, that
+ * truncating to 0 makes a file inline again, that both kinds of file
+ * read back the same after a remount, and that a file that can't be
+ * moved out because the volume is full is left as it was.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <sfs.h>
+#include <test.h>
+
+#define IT_BIG    500	/* past SFS_INLINESIZE, within one block */
+#define IT_SMALL  100	/* well within SFS_INLINESIZE */
+#define IT_MID    300	/* within SFS_INLINESIZE, but IT_MID+IT_SMALL isn't */
+
+static char it_buf[SFS_BLOCKSIZE];
+
+/*
+ * The byte written at file offset POS; never zero, so holes show up.
+ */
+static
+char
+it_pattern(off_t pos)
+{
+	unsigned p = (unsigned)pos;
+
+	return 1 + (p * 7 + p / 64) % 251;
+}
+
+static
+int
+it_open(const char *dev, const char *file, int flags, struct vnode **ret)
+{
+	char name[64];
+	int result;
+
+	/* vfs_open destroys the string it's passed */
+	snprintf(name, sizeof(name), "%s:%s", dev, file);
+	result = vfs_open(name, flags, 0664, ret);
+	if (result) {
+		kprintf("it: %s: %s\n", file, strerror(result));
+	}
+	return result;
+}
+
+static
+int
+it_remove(const char *dev, const char *file)
+{
+	char name[64];
+	int result;
+
+	snprintf(name, sizeof(name), "%s:%s", dev, file);
+	result = vfs_remove(name);
+	if (result) {
+		kprintf("it: remove %s: %s\n", file, strerror(result));
+	}
+	return result;
+}
+
+/*
+ * Write the pattern to LEN bytes at POS.
+ */
+static
+int
+it_write(struct vnode *vn, off_t pos, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	size_t i;
+	int result;
+
+	KASSERT(len <= sizeof(it_buf));
+	for (i=0; i<len; i++) {
+		it_buf[i] = it_pattern(pos + i);
+	}
+	uio_kinit(&iov, &ku, it_buf, len, pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result == 0 && ku.uio_resid > 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+static
+int
+it_truncate(struct vnode *vn, off_t len)
+{
+	int result;
+
+	result = VOP_TRUNCATE(vn, len);
+	if (result) {
+		kprintf("it: truncate to %lld: %s\n", (long long)len,
+			strerror(result));
+	}
+	return result;
+}
+
+/*
+ * Check that the file is SIZE bytes long, holds the pattern below
+ * ZEROFROM and zeros from there on, and is or isn't inline.
+ */
+static
+int
+it_check(const char *what, struct vnode *vn, off_t size, off_t zerofrom,
+	 bool inl)
+{
+	struct sfs_vnode *sv = vn->vn_data;
+	struct iovec iov;
+	struct uio ku;
+	char want;
+	off_t i;
+	int result;
+
+	KASSERT(size <= (off_t)sizeof(it_buf));
+
+	vfs_biglock_acquire();
+	if (sv->sv_i.sfi_size != size) {
+		kprintf("it: %s: size is %u, expected %u\n", what,
+			sv->sv_i.sfi_size, (unsigned)size);
+		vfs_biglock_release();
+		return EIO;
+	}
+	if (((sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) != 0) != inl ||
+	    (inl && sv->sv_i.sfi_direct[0] != 0)) {
+		kprintf("it: %s: file should %sbe inline\n", what,
+			inl ? "" : "not ");
+		vfs_biglock_release();
+		return EIO;
+	}
+	vfs_biglock_release();
+
+	uio_kinit(&iov, &ku, it_buf, sizeof(it_buf), 0, UIO_READ);
+	result = VOP_READ(vn, &ku);
+	if (result) {
+		kprintf("it: %s: read: %s\n", what, strerror(result));
+		return result;
+	}
+	if (ku.uio_offset != size) {
+		kprintf("it: %s: read %lld bytes, expected %lld\n", what,
+			(long long)ku.uio_offset, (long long)size);
+		return EIO;
+	}
+	for (i=0; i<size; i++) {
+		want = i < zerofrom ? it_pattern(i) : 0;
+		if (it_buf[i] != want) {
+			kprintf("it: %s: byte %lld is wrong\n", what,
+				(long long)i);
+			return EIO;
+		}
+	}
+	kprintf("it: %s: ok\n", what);
+	return 0;
+}
+
+/*
+ * Grow an inline file by writing and by truncating, shrink it back,
+ * and empty it. Leaves it IT_BIG bytes long in a data block.
+ */
+static
+int
+it_transitions(struct vnode *vn)
+{
+	int result;
+
+	result = it_write(vn, 0, IT_MID);
+	if (result == 0) {
+		result = it_check("small write", vn, IT_MID, IT_MID, true);
+	}
+	if (result == 0) {
+		result = it_write(vn, IT_MID, IT_BIG - IT_MID);
+	}
+	if (result == 0) {
+		result = it_check("write past inline size", vn, IT_BIG,
+				  IT_BIG, false);
+	}
+
+	/* Back to empty, then small writes and truncates stay inline */
+	if (result == 0) {
+		result = it_truncate(vn, 0);
+	}
+	if (result == 0) {
+		result = it_check("truncate to 0", vn, 0, 0, true);
+	}
+	if (result == 0) {
+		result = it_write(vn, 0, IT_SMALL);
+	}
+	if (result == 0) {
+		result = it_truncate(vn, IT_SMALL / 2);
+	}
+	if (result == 0) {
+		result = it_truncate(vn, IT_MID);
+	}
+	if (result == 0) {
+		result = it_check("truncate within inline size", vn, IT_MID,
+				  IT_SMALL / 2, true);
+	}
+
+	/* Truncating up past the inline size moves the data out */
+	if (result == 0) {
+		result = it_truncate(vn, IT_BIG);
+	}
+	if (result == 0) {
+		result = it_check("truncate past inline size", vn, IT_BIG,
+				  IT_SMALL / 2, false);
+	}
+	if (result == 0) {
+		result = it_truncate(vn, IT_SMALL / 4);
+	}
+	if (result == 0) {
+		result = it_check("truncate back below inline size", vn,
+				  IT_SMALL / 4, IT_SMALL / 4, false);
+	}
+
+	/* Leave it a block file holding the whole pattern */
+	if (result == 0) {
+		result = it_write(vn, 0, IT_BIG);
+	}
+	return result;
+}
+
+/*
+ * With the volume full, a write or truncate that would move a small
+ * file out of the inode must fail and leave it inline and intact.
+ * Then free up space and check the write goes through.
+ */
+static
+int
+it_full(const char *dev, struct vnode *vn)
+{
+	struct vnode *fill;
+	off_t pos;
+	int result, result2;
+
+	result = it_open(dev, "itfill", O_WRONLY|O_CREAT|O_TRUNC, &fill);
+	if (result) {
+		return result;
+	}
+	for (pos = 0; ; pos += SFS_BLOCKSIZE) {
+		result = it_write(fill, pos, SFS_BLOCKSIZE);
+		if (result) {
+			break;
+		}
+	}
+	vfs_close(fill);
+	if (result != ENOSPC) {
+		kprintf("it: filling volume: %s\n", strerror(result));
+		it_remove(dev, "itfill");
+		return result;
+	}
+
+	result = it_write(vn, IT_MID, IT_SMALL * 2);
+	if (result != ENOSPC) {
+		kprintf("it: write on full volume: %s, expected %s\n",
+			strerror(result), strerror(ENOSPC));
+		result = EIO;
+	}
+	else {
+		result = it_check("failed write on full volume", vn,
+				  IT_MID, IT_MID, true);
+	}
+	if (result == 0) {
+		result = VOP_TRUNCATE(vn, IT_BIG);
+		if (result != ENOSPC) {
+			kprintf("it: truncate on full volume: %s, "
+				"expected %s\n", strerror(result),
+				strerror(ENOSPC));
+			result = EIO;
+		}
+		else {
+			result = it_check("failed truncate on full volume",
+					  vn, IT_MID, IT_MID, true);
+		}
+	}
+
+	result2 = it_remove(dev, "itfill");
+	if (result == 0) {
+		result = result2;
+	}
+	if (result == 0) {
+		result = it_write(vn, IT_MID, IT_SMALL * 2);
+	}
+	if (result == 0) {
+		result = it_check("write after freeing space", vn,
+				  IT_MID + IT_SMALL * 2, IT_MID + IT_SMALL * 2,
+				  false);
+	}
+	return result;
+}
+
+int
+inlinetest(int nargs, char **args)
+{
+	struct vnode *big, *small;
+	char *dev;
+	int result, result2;
+
+	if (nargs != 2) {
+		kprintf("Usage: it device\n");
+		return EINVAL;
+	}
+
+	/* Allow (but do not require) colon after device name */
+	dev = args[1];
+	if (dev[strlen(dev)-1] == ':') {
+		dev[strlen(dev)-1] = 0;
+	}
+
+	kprintf("Starting SFS inline file test...\n");
+
+	result = sfs_mount(dev);
+	if (result) {
+		kprintf("it: mount: %s\n", strerror(result));
+		goto fail;
+	}
+
+	result = it_open(dev, "itbig", O_RDWR|O_CREAT|O_TRUNC, &big);
+	if (result) {
+		goto unmount;
+	}
+	result = it_transitions(big);
+	vfs_close(big);
+	if (result) {
+		goto unmount;
+	}
+
+	result = it_open(dev, "itsmall", O_RDWR|O_CREAT|O_TRUNC, &small);
+	if (result) {
+		goto unmount;
+	}
+	result = it_write(small, 0, IT_MID);
+	vfs_close(small);
+	if (result) {
+		goto unmount;
+	}
+
+	/* Both kinds of file must come back the same from disk */
+	result = vfs_unmount(dev);
+	if (result) {
+		kprintf("it: unmount: %s\n", strerror(result));
+		goto fail;
+	}
+	result = sfs_mount(dev);
+	if (result) {
+		kprintf("it: mount: %s\n", strerror(result));
+		goto fail;
+	}
+
+	result = it_open(dev, "itbig", O_RDONLY, &big);
+	if (result) {
+		goto unmount;
+	}
+	result = it_check("block file after remount", big, IT_BIG, IT_BIG,
+			  false);
+	vfs_close(big);
+	if (result) {
+		goto unmount;
+	}
+
+	result = it_open(dev, "itsmall", O_RDWR, &small);
+	if (result) {
+		goto unmount;
+	}
+	result = it_check("inline file after remount", small, IT_MID, IT_MID,
+			  true);
+	if (result == 0) {
+		result = it_full(dev, small);
+	}
+	vfs_close(small);
+	if (result) {
+		goto unmount;
+	}
+
+	result = it_remove(dev, "itbig");
+	if (result == 0) {
+		result = it_remove(dev, "itsmall");
+	}
+
+ unmount:
+	result2 = vfs_unmount(dev);
+	if (result2) {
+		kprintf("it: unmount: %s\n", strerror(result2));
+		if (result == 0) {
+			result = result2;
+		}
+	}
+	if (result) {
+		goto fail;
+	}
+	kprintf("SFS inline file test done\n");
+	return 0;
+
+ fail:
+	kprintf("SFS inline file test failed\n");
+	return result;
+}
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS journal test.
+ *
+ * Run on an SFS volume with a journal that isn't mounted, e.g.
+ * "jt lhd1". The first two phases write transactions straight into
+ * the log, as if we'd crashed after committing them, and mount the
+ * volume to see what recovery does with them. Their images all go
+ * to a block that is free in the volume, so nothing is damaged. The
+ * third phase checks that a block freed while it has an image in the
+ * log isn't reused before the log is checkpointed, and is free on
+ * disk afterwards.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <sfs.h>
+#include <test.h>
+
+#define JT_WORDS (SFS_BLOCKSIZE / sizeof(uint32_t))
+
+/* Each transaction takes a descriptor, one image, and a commit block */
+#define JT_TXNSLOTS 3
+#define JT_NSLOTS   (3 * JT_TXNSLOTS)
+
+enum jt_commit {
+	JT_GOOD,	/* commit block matches */
+	JT_BADSUM,	/* commit block has the wrong checksum */
+	JT_TORN,	/* commit block never written */
+};
+
+static uint32_t jt_block[JT_WORDS];
+static struct sfs_superblock jt_sb;
+
+/*
+ * Read or write a block of the raw device.
+ */
+static
+int
+jt_rawio(struct vnode *raw, daddr_t block, void *data, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, data, SFS_BLOCKSIZE,
+		  (off_t)block * SFS_BLOCKSIZE, rw);
+	result = rw == UIO_READ ? VOP_READ(raw, &ku) : VOP_WRITE(raw, &ku);
+	if (result == 0 && ku.uio_resid > 0) {
+		result = EIO;
+	}
+	if (result) {
+		kprintf("jt: block %u: %s\n", block, strerror(result));
+	}
+	return result;
+}
+
+static
+int
+jt_openraw(const char *dev, struct vnode **ret)
+{
+	char name[32];
+	int result;
+
+	/* vfs_open destroys the string it's passed */
+	snprintf(name, sizeof(name), "%sraw:", dev);
+	result = vfs_open(name, O_RDWR, 0, ret);
+	if (result) {
+		kprintf("jt: %sraw: %s\n", dev, strerror(result));
+	}
+	return result;
+}
+
+/*
+ * Check whether BLOCK is marked in use in the freemap on disk.
+ */
+static
+int
+jt_diskused(struct vnode *raw, daddr_t block, bool *ret)
+{
+	unsigned char *bits = (unsigned char *)jt_block;
+	unsigned bit;
+	int result;
+
+	result = jt_rawio(raw, SFS_FREEMAP_START + block / SFS_BITSPERBLOCK,
+			  jt_block, UIO_READ);
+	if (result) {
+		return result;
+	}
+	bit = block % SFS_BITSPERBLOCK;
+	*ret = (bits[bit / CHAR_BIT] & (1 << (bit % CHAR_BIT))) != 0;
+	return 0;
+}
+
+/*
+ * Load the superblock and pick a free block for the log images to
+ * go to.
+ */
+static
+int
+jt_setup(struct vnode *raw, daddr_t *home)
+{
+	daddr_t block;
+	bool used;
+	int result;
+
+	result = jt_rawio(raw, SFS_SUPER_BLOCK, &jt_sb, UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (jt_sb.sb_magic != SFS_MAGIC) {
+		kprintf("jt: Not an SFS volume\n");
+		return EINVAL;
+	}
+	if (jt_sb.sb_journalblocks < 1 + JT_NSLOTS) {
+		kprintf("jt: Volume has no journal, or it's too small\n");
+		return EINVAL;
+	}
+
+	for (block = jt_sb.sb_nblocks - 1; block > 0; block--) {
+		result = jt_diskused(raw, block, &used);
+		if (result) {
+			return result;
+		}
+		if (!used) {
+			*home = block;
+			return 0;
+		}
+	}
+	kprintf("jt: Volume is full\n");
+	return ENOSPC;
+}
+
+static
+void
+jt_fill(uint32_t *data, uint32_t pattern)
+{
+	unsigned i;
+
+	for (i=0; i<JT_WORDS; i++) {
+		data[i] = pattern + i;
+	}
+}
+
+static
+int
+jt_slotio(struct vnode *raw, unsigned slot, void *data)
+{
+	return jt_rawio(raw, jt_sb.sb_journalstart + 1 + slot, data,
+			UIO_WRITE);
+}
+
+/*
+ * Write a transaction SEQ into the log at SLOT that puts an image
+ * filled with PATTERN in block HOME.
+ */
+static
+int
+jt_writetxn(struct vnode *raw, unsigned slot, uint32_t seq, daddr_t home,
+	    uint32_t pattern, enum jt_commit how)
+{
+	struct sfs_jdesc *jd = (struct sfs_jdesc *)jt_block;
+	struct sfs_jcommit *jc = (struct sfs_jcommit *)jt_block;
+	uint32_t sum;
+	unsigned i;
+	int result;
+
+	bzero(jt_block, sizeof(jt_block));
+	jd->jd_magic = SFS_JDESC_MAGIC;
+	jd->jd_seq = seq;
+	jd->jd_nblocks = 1;
+	jd->jd_blocks[0] = home;
+	result = jt_slotio(raw, slot, jt_block);
+	if (result) {
+		return result;
+	}
+
+	jt_fill(jt_block, pattern);
+	sum = 0;
+	for (i=0; i<JT_WORDS; i++) {
+		sum += jt_block[i];
+	}
+	result = jt_slotio(raw, slot + 1, jt_block);
+	if (result) {
+		return result;
+	}
+
+	bzero(jt_block, sizeof(jt_block));
+	if (how != JT_TORN) {
+		jc->jc_magic = SFS_JCOMMIT_MAGIC;
+		jc->jc_seq = seq;
+		jc->jc_nblocks = 1;
+		jc->jc_checksum = how == JT_GOOD ? sum : sum + 1;
+	}
+	return jt_slotio(raw, slot + 2, jt_block);
+}
+
+/*
+ * Set up the log with the transactions in HOWS, one after another,
+ * each writing its own pattern to HOME; then mount and unmount the
+ * volume so it gets recovered, and check that HOME got the pattern
+ * of transaction EXPECT.
+ */
+static
+int
+jt_recover(const char *dev, const enum jt_commit *hows, unsigned num,
+	   unsigned expect)
+{
+	struct sfs_jheader *jh = (struct sfs_jheader *)jt_block;
+	struct vnode *raw;
+	daddr_t home;
+	uint32_t seq, want[JT_WORDS];
+	unsigned i;
+	int result;
+
+	KASSERT(num * JT_TXNSLOTS <= JT_NSLOTS);
+
+	result = jt_openraw(dev, &raw);
+	if (result) {
+		return result;
+	}
+	result = jt_setup(raw, &home);
+	if (result == 0) {
+		result = jt_rawio(raw, jt_sb.sb_journalstart, jt_block,
+				  UIO_READ);
+	}
+	seq = jh->jh_seq;
+	for (i=0; i<num && result == 0; i++) {
+		result = jt_writetxn(raw, i * JT_TXNSLOTS, seq + i, home,
+				     seq * 0x10000 + i * 0x1000, hows[i]);
+	}
+	vfs_close(raw);
+	if (result) {
+		return result;
+	}
+
+	result = sfs_mount(dev);
+	if (result) {
+		kprintf("jt: mount: %s\n", strerror(result));
+		return result;
+	}
+	result = vfs_unmount(dev);
+	if (result) {
+		kprintf("jt: unmount: %s\n", strerror(result));
+		return result;
+	}
+
+	result = jt_openraw(dev, &raw);
+	if (result) {
+		return result;
+	}
+	result = jt_rawio(raw, home, jt_block, UIO_READ);
+	vfs_close(raw);
+	if (result) {
+		return result;
+	}
+	jt_fill(want, seq * 0x10000 + expect * 0x1000);
+	for (i=0; i<JT_WORDS; i++) {
+		if (jt_block[i] != want[i]) {
+			kprintf("jt: Block %u doesn't hold transaction "
+				"%u's image\n", home, seq + expect);
+			return EIO;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Create the file PATH and write NBLOCKS blocks to it. Hands back
+ * the open vnode.
+ */
+static
+int
+jt_makefile(const char *path, unsigned nblocks, struct vnode **ret)
+{
+	char name[64];
+	struct iovec iov;
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	strcpy(name, path);
+	result = vfs_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664, ret);
+	if (result) {
+		kprintf("jt: %s: %s\n", path, strerror(result));
+		return result;
+	}
+	for (i=0; i<nblocks; i++) {
+		jt_fill(jt_block, i);
+		uio_kinit(&iov, &ku, jt_block, SFS_BLOCKSIZE,
+			  (off_t)i * SFS_BLOCKSIZE, UIO_WRITE);
+		result = VOP_WRITE(*ret, &ku);
+		if (result) {
+			kprintf("jt: %s: Write error: %s\n", path,
+				strerror(result));
+			vfs_close(*ret);
+			return result;
+		}
+	}
+	return 0;
+}
+
+static
+int
+jt_removefile(const char *path)
+{
+	char name[64];
+	int result;
+
+	strcpy(name, path);
+	result = vfs_remove(name);
+	if (result) {
+		kprintf("jt: remove %s: %s\n", path, strerror(result));
+	}
+	return result;
+}
+
+/*
+ * Free a block that has an image in the log, and check that it stays
+ * allocated until the log is checkpointed and is free afterwards.
+ */
+static
+int
+jt_deferred(const char *dev)
+{
+	char path[64];
+	struct vnode *vn, *raw;
+	struct sfs_fs *sfs;
+	struct sfs_vnode *sv;
+	daddr_t block;
+	bool found, used;
+	unsigned i;
+	int result, result2;
+
+	block = 0;
+	result = sfs_mount(dev);
+	if (result) {
+		kprintf("jt: mount: %s\n", strerror(result));
+		return result;
+	}
+	result = vfs_getroot(dev, &vn);
+	if (result) {
+		kprintf("jt: %s: %s\n", dev, strerror(result));
+		goto out;
+	}
+	sfs = vn->vn_fs->fs_data;
+	VOP_DECREF(vn);
+
+	/* A file big enough to have an indirect block, which is logged */
+	snprintf(path, sizeof(path), "%s:jtfile", dev);
+	result = jt_makefile(path, SFS_NDIRECT + 1, &vn);
+	if (result) {
+		goto out;
+	}
+	vfs_sync();
+	sv = vn->vn_data;
+	block = sv->sv_i.sfi_indirect;
+	vfs_close(vn);
+	result = jt_removefile(path);
+	if (result) {
+		goto out;
+	}
+	vfs_sync();
+
+	vfs_biglock_acquire();
+	found = false;
+	for (i=0; i<sfs->sfs_jndeferred; i++) {
+		if (sfs->sfs_jdeferred[i] == block) {
+			found = true;
+		}
+	}
+	used = bitmap_isset(sfs->sfs_freemap, block);
+	vfs_biglock_release();
+	if (block == 0 || !found || !used) {
+		kprintf("jt: Free of indirect block %u wasn't deferred\n",
+			block);
+		result = EIO;
+		goto out;
+	}
+
+	/* New blocks must not land on it */
+	result = jt_makefile(path, SFS_NDIRECT, &vn);
+	if (result) {
+		goto out;
+	}
+	sv = vn->vn_data;
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] == block) {
+			kprintf("jt: Block %u reused before checkpoint\n",
+				block);
+			result = EIO;
+		}
+	}
+	vfs_close(vn);
+	result2 = jt_removefile(path);
+	if (result == 0) {
+		result = result2;
+	}
+
+ out:
+	/* Unmounting checkpoints the log */
+	result2 = vfs_unmount(dev);
+	if (result2) {
+		kprintf("jt: unmount: %s\n", strerror(result2));
+		return result ? result : result2;
+	}
+	if (result) {
+		return result;
+	}
+
+	result = jt_openraw(dev, &raw);
+	if (result) {
+		return result;
+	}
+	result = jt_diskused(raw, block, &used);
+	vfs_close(raw);
+	if (result == 0 && used) {
+		kprintf("jt: Block %u still in use after checkpoint\n",
+			block);
+		result = EIO;
+	}
+	return result;
+}
+
+int
+journaltest(int nargs, char **args)
+{
+	static const enum jt_commit badsum[] = { JT_GOOD, JT_BADSUM, JT_GOOD };
+	static const enum jt_commit torn[] = { JT_GOOD, JT_GOOD, JT_TORN };
+	char *dev;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: jt device\n");
+		return EINVAL;
+	}
+
+	/* Allow (but do not require) colon after device name */
+	dev = args[1];
+	if (dev[strlen(dev)-1] == ':') {
+		dev[strlen(dev)-1] = 0;
+	}
+
+	kprintf("Starting SFS journal test...\n");
+
+	/* Recovery stops at the bad commit block and skips what follows */
+	result = jt_recover(dev, badsum, 3, 0);
+	if (result) {
+		goto fail;
+	}
+	kprintf("jt: Replay stops at bad checksum: ok\n");
+
+	/* A transaction whose commit block never made it isn't replayed */
+	result = jt_recover(dev, torn, 3, 1);
+	if (result) {
+		goto fail;
+	}
+	kprintf("jt: Replay stops at torn commit: ok\n");
+
+	result = jt_deferred(dev);
+	if (result) {
+		goto fail;
+	}
+	kprintf("jt: Deferred free survives until checkpoint: ok\n");
+
+	kprintf("SFS journal test done\n");
+	return 0;
+
+ fail:
+	kprintf("SFS journal test failed\n");
+	return result;
+}
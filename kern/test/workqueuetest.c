@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueue test.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define NITEMS 64
+
+static struct semaphore *wqt_sem;
+static volatile unsigned wqt_count;
+
+static
+void
+wqt_func(void *arg)
+{
+	(void)arg;
+	wqt_count++;
+	V(wqt_sem);
+}
+
+int
+workqueuetest(int nargs, char **args)
+{
+	struct work wk;
+	struct timespec start, end, delay, elapsed;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	wqt_sem = sem_create("wqt_sem", 0);
+	KASSERT(wqt_sem != NULL);
+	wqt_count = 0;
+
+	/* A burst of one-shot items. */
+	for (i=0; i<NITEMS; i++) {
+		result = workqueue_enqueue(wqt_func, NULL);
+		KASSERT(result == 0);
+	}
+	for (i=0; i<NITEMS; i++) {
+		P(wqt_sem);
+	}
+	KASSERT(wqt_count == NITEMS);
+
+	/* An item can't be queued twice, but can be once it's run. */
+	work_init(&wk, wqt_func, NULL);
+	KASSERT(work_schedule(&wk));
+	P(wqt_sem);
+	KASSERT(work_schedule(&wk));
+	P(wqt_sem);
+	KASSERT(wqt_count == NITEMS + 2);
+
+	/* Delayed work doesn't run early. */
+	delay.tv_sec = 0;
+	delay.tv_nsec = 100000000;
+	gettime(&start);
+	KASSERT(work_schedule_delayed(&wk, &delay));
+	KASSERT(!work_schedule(&wk));
+	P(wqt_sem);
+	gettime(&end);
+	timespec_sub(&end, &start, &elapsed);
+	KASSERT(elapsed.tv_sec > 0 || elapsed.tv_nsec >= delay.tv_nsec);
+	KASSERT(wqt_count == NITEMS + 3);
+
+	sem_destroy(wqt_sem);
+	wqt_sem = NULL;
+
+	kprintf("Workqueue test done\n");
+	return 0;
+}
@@ -30,17 +30,17 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
-#include <wchan.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Callbacks at specific points in the future are handled by the
+ * timer wheels in timer.c, which we drive from hardclock.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -53,23 +53,13 @@
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
-/*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
-
 /*
  * Setup.
  */
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
+	timer_bootstrap();
 }
 
 /*
@@ -79,10 +69,10 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+	/*
+	 * Nothing to do: sleepers used to poll on a once-a-second
+	 * broadcast here, but now each one has its own timer.
+	 */
 }
 
 /*
@@ -97,6 +87,7 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	timer_expire();
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
@@ -106,16 +97,61 @@ hardclock(void)
 	thread_yield();
 }
 
+/*
+ * Going idle: there's nothing for hardclock to schedule, so don't
+ * take an interrupt until the next timer on this cpu is due.
+ */
+void
+hardclock_idle(void)
+{
+	struct timespec now, next, delta;
+	uint32_t usecs;
+
+	if (!timer_nextdeadline(&next)) {
+		/* Nothing pending; sleep as long as the hardware allows. */
+		mainbus_timer_oneshot(0xffffffff);
+		return;
+	}
+
+	gettime(&now);
+	if (next.tv_sec < now.tv_sec ||
+	    (next.tv_sec == now.tv_sec && next.tv_nsec <= now.tv_nsec)) {
+		usecs = 0;
+	}
+	else {
+		timespec_sub(&next, &now, &delta);
+		if (delta.tv_sec >= 4000) {
+			usecs = 0xffffffff;
+		}
+		else {
+			usecs = delta.tv_sec * 1000000 +
+				DIVROUNDUP(delta.tv_nsec, 1000);
+		}
+	}
+	mainbus_timer_oneshot(usecs);
+}
+
+/*
+ * Unidling: go back to the regular tick.
+ */
+void
+hardclock_unidle(void)
+{
+	mainbus_timer_periodic();
+}
+
 /*
  * Suspend execution for n seconds.
  */
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	struct timespec ts;
+
+	if (num_secs <= 0) {
+		return;
 	}
-	spinlock_release(&lbolt_lock);
+	ts.tv_sec = num_secs;
+	ts.tv_nsec = 0;
+	timer_sleep(&ts);
 }
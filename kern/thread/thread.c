@@ -42,10 +42,14 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <atomic.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
+#include <clock.h>
+#include <timer.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
@@ -146,9 +150,11 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_inboxnext = NULL;
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
+	thread->t_bound = false;
 	thread->t_proc = NULL;
 
 	/* Interrupt state fields */
@@ -183,6 +189,10 @@ cpu_create(unsigned hardware_number)
 
 	c->c_self = c;
 	c->c_hardware_number = hardware_number;
+	c->c_timers = timerwheel_create();
+	if (c->c_timers == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
@@ -192,6 +202,7 @@ cpu_create(unsigned hardware_number)
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_inbox = NULL;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -443,6 +454,15 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Return the number of cpus.
+ */
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -453,6 +473,7 @@ void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
+	struct thread *head;
 
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
@@ -461,6 +482,36 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
+	else if (targetcpu != curcpu->c_self) {
+		/*
+		 * Waking a thread that belongs to another cpu. Rather
+		 * than fight over its run queue lock, push the thread
+		 * onto its inbox and let it pick the thread up itself.
+		 * Leave t_state alone: the thread may still be on its
+		 * way to sleep on that cpu, which sets t_state after
+		 * letting go of the wchan lock, so only the owner may
+		 * mark it ready (in thread_drain_inbox).
+		 */
+		do {
+			head = targetcpu->c_inbox;
+			target->t_inboxnext = head;
+			membar_store_store();
+		} while (atomic_cas_ptr((void *volatile *)&targetcpu->c_inbox,
+					head, target) != head);
+
+		/*
+		 * Only the wakeup that makes the inbox nonempty needs
+		 * to poke the cpu; later ones ride along with it. The
+		 * barrier pairs with the one in thread_switch after
+		 * c_isidle is set, so that either we see the cpu idle
+		 * or it sees our thread.
+		 */
+		membar_any_any();
+		if (head == NULL && targetcpu->c_isidle) {
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+		return;
+	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
@@ -483,20 +534,57 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 }
 
 /*
- * Create a new thread based on an existing one.
+ * Move threads other cpus have woken up for us from our inbox onto
+ * our run queue. The inbox is a stack, so reverse it on the way to
+ * keep wakeups in the order they happened. The threads are marked
+ * ready here, under the run queue lock, rather than by the waker;
+ * see thread_make_runnable.
  *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
- *
- * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * Call with the run queue locked.
+ */
+static
+void
+thread_drain_inbox(void)
+{
+	struct thread *list, *rev, *t;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_inbox == NULL) {
+		return;
+	}
+	list = atomic_swap_ptr((void *volatile *)&curcpu->c_inbox, NULL);
+	membar_load_load();
+
+	rev = NULL;
+	while (list != NULL) {
+		t = list;
+		list = t->t_inboxnext;
+		t->t_inboxnext = rev;
+		rev = t;
+	}
+	while (rev != NULL) {
+		t = rev;
+		rev = t->t_inboxnext;
+		t->t_inboxnext = NULL;
+		KASSERT(t->t_cpu == curcpu->c_self);
+		t->t_state = S_READY;
+		threadlist_addtail(&curcpu->c_runqueue, t);
+	}
+}
+
+/*
+ * Common code for thread_fork and thread_fork_percpu. If TARGETCPU
+ * is null the new thread starts on the caller's cpu; otherwise it
+ * starts on TARGETCPU and is bound there.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_oncpu(const char *name,
+		  struct proc *proc,
+		  struct cpu *targetcpu,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -519,7 +607,13 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	if (targetcpu != NULL) {
+		newthread->t_cpu = targetcpu;
+		newthread->t_bound = true;
+	}
+	else {
+		newthread->t_cpu = curthread->t_cpu;
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -542,12 +636,55 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the target cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+/*
+ * Create a new thread based on an existing one.
+ *
+ * The new thread has name NAME, and starts executing in function
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ *
+ * The new thread is created in the process P. If P is null, the
+ * process is inherited from the caller. It will start on the same CPU
+ * as the caller, unless the scheduler intervenes first.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_oncpu(name, proc, NULL, entrypoint, data1, data2);
+}
+
+/*
+ * Create a bound kernel thread on each cpu.
+ */
+int
+thread_fork_percpu(const char *name,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1)
+{
+	char namebuf[32];
+	unsigned i;
+	int result;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		snprintf(namebuf, sizeof(namebuf), "%s/%u", name, i);
+		result = thread_fork_oncpu(namebuf, NULL,
+					   cpuarray_get(&allcpus, i),
+					   entrypoint, data1, i);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -563,6 +700,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+	bool idled;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -588,6 +726,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
+	/* Pick up anything other cpus have woken for us. */
+	thread_drain_inbox();
+
 	/* Micro-optimization: if nothing to do, just return */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
@@ -639,17 +780,33 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
-	/* The current cpu is now idle. */
+	/*
+	 * The current cpu is now idle. Other cpus pushing onto our
+	 * inbox check c_isidle without the run queue lock, so make
+	 * sure the store is visible before we look at the inbox.
+	 */
 	curcpu->c_isidle = true;
+	membar_any_any();
+	idled = false;
 	do {
+		thread_drain_inbox();
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
+			/*
+			 * Stop the periodic clock while idle; it
+			 * restarts once we have something to run.
+			 */
 			spinlock_release(&curcpu->c_runqueue_lock);
+			hardclock_idle();
+			idled = true;
 			cpu_idle();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	if (idled) {
+		hardclock_unidle();
+	}
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -913,8 +1070,11 @@ thread_consider_migration(void)
 			 * the list and decrement to_send in order to
 			 * skip it. Then it goes back on our own run
 			 * queue below.
+			 *
+			 * Threads bound to this cpu get the same
+			 * treatment.
 			 */
-			if (t == curthread) {
+			if (t == curthread || t->t_bound) {
 				threadlist_addtail(&victims, t);
 				to_send--;
 				continue;
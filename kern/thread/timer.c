@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <timer.h>
+#include <current.h>
+
+/*
+ * Kernel timers. See timer.h for the overview.
+ */
+
+/* Number of slots in each wheel; one slot per hardclock tick. */
+#define TIMER_WHEELSIZE		256
+
+/*
+ * Lateness histogram: bucket N counts wakeups that were less than
+ * 2^N microseconds late (bucket 0 is "on time"), except that the last
+ * bucket also takes everything later than that.
+ */
+#define TIMER_NHIST		20
+
+/* Wait channels for timer_sleep, hashed by thread. Power of 2. */
+#define TIMER_NSLEEPCHANS	32
+
+#define NSEC_PER_TICK		(1000000000 / HZ)
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	struct timer *tw_slots[TIMER_WHEELSIZE];
+	unsigned tw_count;		/* number of pending timers */
+	uint64_t tw_lasttick;		/* last tick already examined */
+
+	/* statistics */
+	unsigned tw_fired;
+	unsigned tw_hist[TIMER_NHIST];
+	struct timerwheel *tw_nextwheel; /* for timer_printstats */
+};
+
+/* List of all wheels, for statistics. */
+static struct timerwheel *allwheels;
+static struct spinlock allwheels_lock = SPINLOCK_INITIALIZER;
+
+/* For timer_sleep. */
+struct timer_sleepchan {
+	struct spinlock tsc_lock;
+	struct wchan *tsc_wchan;
+};
+static struct timer_sleepchan timer_sleepchans[TIMER_NSLEEPCHANS];
+
+////////////////////////////////////////////////////////////
+// setup
+
+/*
+ * Called once at boot.
+ */
+void
+timer_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<TIMER_NSLEEPCHANS; i++) {
+		spinlock_init(&timer_sleepchans[i].tsc_lock);
+		timer_sleepchans[i].tsc_wchan = wchan_create("timersleep");
+		if (timer_sleepchans[i].tsc_wchan == NULL) {
+			panic("timer_bootstrap: Out of memory\n");
+		}
+	}
+}
+
+/*
+ * Create a timer wheel for a new cpu.
+ */
+struct timerwheel *
+timerwheel_create(void)
+{
+	struct timerwheel *tw;
+	unsigned i;
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		return NULL;
+	}
+	spinlock_init(&tw->tw_lock);
+	for (i=0; i<TIMER_WHEELSIZE; i++) {
+		tw->tw_slots[i] = NULL;
+	}
+	tw->tw_count = 0;
+	tw->tw_lasttick = 0;
+	tw->tw_fired = 0;
+	for (i=0; i<TIMER_NHIST; i++) {
+		tw->tw_hist[i] = 0;
+	}
+
+	spinlock_acquire(&allwheels_lock);
+	tw->tw_nextwheel = allwheels;
+	allwheels = tw;
+	spinlock_release(&allwheels_lock);
+
+	return tw;
+}
+
+////////////////////////////////////////////////////////////
+// wheel ops
+
+/*
+ * Convert a time of day to a tick number.
+ */
+static
+uint64_t
+timer_tick(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * HZ + ts->tv_nsec / NSEC_PER_TICK;
+}
+
+/*
+ * Return true if time T1 is at or before time T2.
+ */
+static
+bool
+timer_notafter(const struct timespec *t1, const struct timespec *t2)
+{
+	if (t1->tv_sec != t2->tv_sec) {
+		return t1->tv_sec < t2->tv_sec;
+	}
+	return t1->tv_nsec <= t2->tv_nsec;
+}
+
+/*
+ * Remove a timer from its wheel. Call with the wheel locked.
+ */
+static
+void
+timer_unlink(struct timerwheel *tw, struct timer *tm)
+{
+	KASSERT(spinlock_do_i_hold(&tw->tw_lock));
+	KASSERT(tm->tm_wheel == tw);
+
+	*tm->tm_prevp = tm->tm_next;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prevp = tm->tm_prevp;
+	}
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+	tm->tm_wheel = NULL;
+	KASSERT(tw->tw_count > 0);
+	tw->tw_count--;
+}
+
+/*
+ * Record how late a timer fired. Call with the wheel locked.
+ */
+static
+void
+timer_record(struct timerwheel *tw, const struct timespec *deadline,
+	     const struct timespec *now)
+{
+	struct timespec late;
+	uint32_t late_usec;
+	unsigned bucket;
+
+	timespec_sub(now, deadline, &late);
+	if (late.tv_sec >= 4000) {
+		late_usec = 0xffffffff;
+	}
+	else {
+		late_usec = late.tv_sec * 1000000 + late.tv_nsec / 1000;
+	}
+
+	bucket = 0;
+	while (bucket < TIMER_NHIST - 1 && (late_usec >> bucket) != 0) {
+		bucket++;
+	}
+	tw->tw_hist[bucket]++;
+	tw->tw_fired++;
+}
+
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+	tm->tm_wheel = NULL;
+	tm->tm_deadline.tv_sec = 0;
+	tm->tm_deadline.tv_nsec = 0;
+	tm->tm_func = func;
+	tm->tm_data = data;
+}
+
+/*
+ * Arm a timer on the current cpu.
+ */
+void
+timer_schedule(struct timer *tm, const struct timespec *deadline)
+{
+	struct timerwheel *tw;
+	struct timespec now;
+	uint64_t tick;
+	unsigned slot;
+
+	tw = curcpu->c_timers;
+	KASSERT(tw != NULL);
+
+	spinlock_acquire(&tw->tw_lock);
+	KASSERT(tm->tm_wheel == NULL);
+
+	if (tw->tw_count == 0) {
+		/*
+		 * The wheel doesn't keep time while it's empty, so
+		 * catch up now.
+		 */
+		gettime(&now);
+		tw->tw_lasttick = timer_tick(&now);
+	}
+
+	/*
+	 * If the deadline is in a tick we've already examined (i.e.,
+	 * it's already passed), put it in the next one so it gets
+	 * looked at right away rather than one trip around the wheel
+	 * from now.
+	 */
+	tick = timer_tick(deadline);
+	if (tick <= tw->tw_lasttick) {
+		tick = tw->tw_lasttick + 1;
+	}
+	slot = tick % TIMER_WHEELSIZE;
+
+	tm->tm_deadline = *deadline;
+	tm->tm_wheel = tw;
+	tm->tm_next = tw->tw_slots[slot];
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prevp = &tm->tm_next;
+	}
+	tm->tm_prevp = &tw->tw_slots[slot];
+	tw->tw_slots[slot] = tm;
+	tw->tw_count++;
+
+	spinlock_release(&tw->tw_lock);
+}
+
+/*
+ * Disarm a timer.
+ */
+bool
+timer_cancel(struct timer *tm)
+{
+	struct timerwheel *tw;
+
+	while (1) {
+		tw = tm->tm_wheel;
+		if (tw == NULL) {
+			return false;
+		}
+		spinlock_acquire(&tw->tw_lock);
+		if (tm->tm_wheel == tw) {
+			timer_unlink(tw, tm);
+			spinlock_release(&tw->tw_lock);
+			return true;
+		}
+		/* It fired (and maybe was rearmed) while we looked. */
+		spinlock_release(&tw->tw_lock);
+	}
+}
+
+bool
+timer_pending(struct timer *tm)
+{
+	return tm->tm_wheel != NULL;
+}
+
+/*
+ * Find the earliest pending deadline on the current cpu. This looks
+ * at every pending timer, so it's meant for the idle path only.
+ */
+bool
+timer_nextdeadline(struct timespec *ret)
+{
+	struct timerwheel *tw;
+	struct timer *tm;
+	unsigned slot;
+	bool found;
+
+	tw = curcpu->c_timers;
+	if (tw == NULL) {
+		return false;
+	}
+
+	found = false;
+	spinlock_acquire(&tw->tw_lock);
+	for (slot = 0; slot < TIMER_WHEELSIZE && tw->tw_count > 0; slot++) {
+		for (tm = tw->tw_slots[slot]; tm != NULL; tm = tm->tm_next) {
+			if (!found || timer_notafter(&tm->tm_deadline, ret)) {
+				*ret = tm->tm_deadline;
+				found = true;
+			}
+		}
+	}
+	spinlock_release(&tw->tw_lock);
+	return found;
+}
+
+/*
+ * Fire whatever timers have expired on the current cpu. This is
+ * called from hardclock.
+ */
+void
+timer_expire(void)
+{
+	struct timerwheel *tw;
+	struct timer *tm, *next, *expired;
+	struct timespec now;
+	uint64_t tick, nowtick;
+	unsigned slot;
+
+	tw = curcpu->c_timers;
+	if (tw == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		spinlock_release(&tw->tw_lock);
+		return;
+	}
+
+	gettime(&now);
+	nowtick = timer_tick(&now);
+	if (nowtick <= tw->tw_lasttick) {
+		spinlock_release(&tw->tw_lock);
+		return;
+	}
+
+	/*
+	 * Look at each slot we've passed since last time, but never
+	 * more than once around the wheel.
+	 */
+	expired = NULL;
+	tick = tw->tw_lasttick + 1;
+	if (nowtick - tw->tw_lasttick > TIMER_WHEELSIZE) {
+		tick = nowtick - TIMER_WHEELSIZE + 1;
+	}
+	for (; tick <= nowtick; tick++) {
+		slot = tick % TIMER_WHEELSIZE;
+		for (tm = tw->tw_slots[slot]; tm != NULL; tm = next) {
+			next = tm->tm_next;
+			if (!timer_notafter(&tm->tm_deadline, &now)) {
+				/* Not yet; a later trip around the wheel. */
+				continue;
+			}
+			timer_unlink(tw, tm);
+			timer_record(tw, &tm->tm_deadline, &now);
+			tm->tm_next = expired;
+			expired = tm;
+		}
+	}
+	tw->tw_lasttick = nowtick;
+
+	spinlock_release(&tw->tw_lock);
+
+	/*
+	 * Call the functions without the wheel locked so they can
+	 * reschedule themselves. Once tm_func is called the timer may
+	 * be reused (or freed), so get the link first.
+	 */
+	for (tm = expired; tm != NULL; tm = next) {
+		next = tm->tm_next;
+		tm->tm_next = NULL;
+		tm->tm_func(tm->tm_data);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// sleeping
+
+struct timer_sleeper {
+	struct timer_sleepchan *ts_chan;
+	volatile bool ts_done;
+};
+
+/*
+ * Get the sleep channel for the current thread.
+ */
+static
+struct timer_sleepchan *
+timer_getsleepchan(void)
+{
+	uintptr_t h;
+
+	h = (uintptr_t)curthread;
+	h = (h >> 4) ^ (h >> 12);
+	return &timer_sleepchans[h & (TIMER_NSLEEPCHANS - 1)];
+}
+
+/*
+ * Timer function for timer_sleep.
+ */
+static
+void
+timer_wakeup(void *vts)
+{
+	struct timer_sleeper *ts = vts;
+	struct timer_sleepchan *tsc = ts->ts_chan;
+
+	spinlock_acquire(&tsc->tsc_lock);
+	ts->ts_done = true;
+	/* Other threads may share the channel; they'll go back to sleep. */
+	wchan_wakeall(tsc->tsc_wchan, &tsc->tsc_lock);
+	spinlock_release(&tsc->tsc_lock);
+}
+
+/*
+ * Sleep for DURATION.
+ */
+void
+timer_sleep(const struct timespec *duration)
+{
+	struct timer_sleeper ts;
+	struct timer tm;
+	struct timespec deadline;
+
+	gettime(&deadline);
+	timespec_add(&deadline, duration, &deadline);
+
+	ts.ts_chan = timer_getsleepchan();
+	ts.ts_done = false;
+	timer_init(&tm, timer_wakeup, &ts);
+
+	/*
+	 * Arm the timer with the channel locked so that the wakeup
+	 * can't happen until we're asleep.
+	 */
+	spinlock_acquire(&ts.ts_chan->tsc_lock);
+	timer_schedule(&tm, &deadline);
+	while (!ts.ts_done) {
+		wchan_sleep(ts.ts_chan->tsc_wchan, &ts.ts_chan->tsc_lock);
+	}
+	spinlock_release(&ts.ts_chan->tsc_lock);
+
+	KASSERT(!timer_pending(&tm));
+}
+
+////////////////////////////////////////////////////////////
+// statistics
+
+void
+timer_printstats(void)
+{
+	struct timerwheel *tw;
+	unsigned hist[TIMER_NHIST];
+	unsigned fired, pending, i;
+
+	fired = pending = 0;
+	for (i=0; i<TIMER_NHIST; i++) {
+		hist[i] = 0;
+	}
+
+	spinlock_acquire(&allwheels_lock);
+	for (tw = allwheels; tw != NULL; tw = tw->tw_nextwheel) {
+		spinlock_acquire(&tw->tw_lock);
+		fired += tw->tw_fired;
+		pending += tw->tw_count;
+		for (i=0; i<TIMER_NHIST; i++) {
+			hist[i] += tw->tw_hist[i];
+		}
+		spinlock_release(&tw->tw_lock);
+	}
+	spinlock_release(&allwheels_lock);
+
+	kprintf("Timers: %u fired, %u pending\n", fired, pending);
+	kprintf("Wakeup lateness:\n");
+	kprintf("    on time: %u\n", hist[0]);
+	for (i=1; i<TIMER_NHIST-1; i++) {
+		if (hist[i] > 0) {
+			kprintf("    < %7u us: %u\n", 1U << i, hist[i]);
+		}
+	}
+	kprintf("    >= %6u us: %u\n", 1U << (TIMER_NHIST - 2),
+		hist[TIMER_NHIST-1]);
+}
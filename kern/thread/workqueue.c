@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <atomic.h>
+#include <wchan.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+/*
+ * Deferred work. See workqueue.h for the overview.
+ */
+
+struct workqueue {
+	struct spinlock wq_lock;
+	struct wchan *wq_wchan;		/* worker sleeps here */
+	struct work *wq_head;		/* pending items */
+	struct work **wq_tailp;		/* where to append */
+};
+
+/* One per cpu, indexed by cpu number. */
+static struct workqueue *workqueues;
+static unsigned numworkqueues;
+
+/*
+ * Append a claimed work item to WQ, waking the worker if it might be
+ * asleep.
+ */
+static
+void
+workqueue_add(struct workqueue *wq, struct work *wk)
+{
+	bool wasempty;
+
+	KASSERT(wk->wk_owner == wq);
+
+	spinlock_acquire(&wq->wq_lock);
+	wasempty = (wq->wq_head == NULL);
+	wk->wk_next = NULL;
+	*wq->wq_tailp = wk;
+	wq->wq_tailp = &wk->wk_next;
+	if (wasempty) {
+		wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * Get the current cpu's queue.
+ */
+static
+struct workqueue *
+workqueue_mine(void)
+{
+	KASSERT(workqueues != NULL);
+	KASSERT(curcpu->c_number < numworkqueues);
+	return &workqueues[curcpu->c_number];
+}
+
+/*
+ * Worker thread.
+ */
+static
+void
+workqueue_thread(void *data1, unsigned long cpunum)
+{
+	struct workqueue *wq;
+	struct work *batch, *wk, *next;
+	void (*func)(void *);
+	void *arg;
+
+	(void)data1;
+	wq = &workqueues[cpunum];
+
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_head == NULL) {
+			wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+		}
+		batch = wq->wq_head;
+		wq->wq_head = NULL;
+		wq->wq_tailp = &wq->wq_head;
+		spinlock_release(&wq->wq_lock);
+
+		for (wk = batch; wk != NULL; wk = next) {
+			next = wk->wk_next;
+			func = wk->wk_func;
+			arg = wk->wk_arg;
+
+			if (wk->wk_autofree) {
+				kfree(wk);
+			}
+			else {
+				/* Release the item so it can be rescheduled. */
+				wk->wk_next = NULL;
+				membar_any_store();
+				wk->wk_owner = NULL;
+			}
+			func(arg);
+		}
+	}
+}
+
+/*
+ * Timer function for work_schedule_delayed. Runs on the cpu that
+ * armed the timer, whose queue already owns the item.
+ */
+static
+void
+work_timerfire(void *vwk)
+{
+	struct work *wk = vwk;
+
+	workqueue_add(wk->wk_owner, wk);
+}
+
+void
+workqueue_bootstrap(void)
+{
+	unsigned i;
+	int result;
+
+	/* thread_start_cpus has run, so the cpu count is fixed. */
+	numworkqueues = thread_numcpus();
+
+	workqueues = kmalloc(numworkqueues * sizeof(*workqueues));
+	if (workqueues == NULL) {
+		panic("workqueue_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<numworkqueues; i++) {
+		spinlock_init(&workqueues[i].wq_lock);
+		workqueues[i].wq_wchan = wchan_create("workqueue");
+		if (workqueues[i].wq_wchan == NULL) {
+			panic("workqueue_bootstrap: Out of memory\n");
+		}
+		workqueues[i].wq_head = NULL;
+		workqueues[i].wq_tailp = &workqueues[i].wq_head;
+	}
+
+	result = thread_fork_percpu("worker", workqueue_thread, NULL);
+	if (result) {
+		panic("workqueue_bootstrap: thread_fork_percpu: %s\n",
+		      strerror(result));
+	}
+}
+
+void
+work_init(struct work *wk, void (*func)(void *), void *arg)
+{
+	wk->wk_next = NULL;
+	wk->wk_owner = NULL;
+	wk->wk_func = func;
+	wk->wk_arg = arg;
+	wk->wk_autofree = false;
+	timer_init(&wk->wk_timer, work_timerfire, wk);
+}
+
+bool
+work_schedule(struct work *wk)
+{
+	struct workqueue *wq;
+	int spl;
+
+	/* Don't move cpus between picking the queue and using it. */
+	spl = splhigh();
+	wq = workqueue_mine();
+	if (atomic_cas_ptr(&wk->wk_owner, NULL, wq) != NULL) {
+		splx(spl);
+		return false;
+	}
+	membar_any_any();
+	workqueue_add(wq, wk);
+	splx(spl);
+	return true;
+}
+
+bool
+work_schedule_delayed(struct work *wk, const struct timespec *delay)
+{
+	struct workqueue *wq;
+	struct timespec deadline;
+	int spl;
+
+	gettime(&deadline);
+	timespec_add(&deadline, delay, &deadline);
+
+	/* The timer fires on this cpu, so claim for this cpu's queue. */
+	spl = splhigh();
+	wq = workqueue_mine();
+	if (atomic_cas_ptr(&wk->wk_owner, NULL, wq) != NULL) {
+		splx(spl);
+		return false;
+	}
+	membar_any_any();
+	timer_schedule(&wk->wk_timer, &deadline);
+	splx(spl);
+	return true;
+}
+
+int
+workqueue_enqueue(void (*func)(void *), void *arg)
+{
+	struct work *wk;
+
+	wk = kmalloc(sizeof(*wk));
+	if (wk == NULL) {
+		return ENOMEM;
+	}
+	work_init(wk, func, arg);
+	wk->wk_autofree = true;
+	work_schedule(wk);
+	return 0;
+}
@@ -0,0 +1,1476 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Block buffer cache. See buf.h for the interface.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <timer.h>
+#include <workqueue.h>
+#include <vfs.h>
+#include <device.h>
+#include <buf.h>
+
+/* Number of hash buckets. Must be a power of 2. */
+#define BUFFER_HASHSIZE	64
+
+/* Number of writes buffer_flush keeps in flight at once. */
+#define BUFFER_FLUSHBATCH	8
+
+struct buf {
+	struct device *b_dev;		/* device, or NULL if unnamed */
+	daddr_t b_block;		/* block number on b_dev */
+	void *b_data;			/* BUFFER_SIZE bytes of data */
+	unsigned b_refcount;		/* number of holders */
+	bool b_valid;			/* b_data matches (or supersedes) disk */
+	bool b_dirty;			/* b_data needs to be written */
+	bool b_busy;			/* I/O in progress */
+	bool b_held;			/* must not be written (buffer_hold) */
+	bool b_logged;			/* dirty, but safe in a journal */
+	struct buf *b_hashnext;		/* next in hash chain */
+	struct buf *b_lrunext;		/* next (more recent) on LRU list */
+	struct buf *b_lruprev;		/* previous (older) on LRU list */
+};
+
+/*
+ * All of the following is protected by buffer_lock. buffer_cv is
+ * signaled whenever a buffer stops being busy.
+ */
+static struct lock *buffer_lock;
+static struct cv *buffer_cv;
+static struct buf *buffer_hash[BUFFER_HASHSIZE];
+static struct buf *buffer_lruhead;	/* least recently used */
+static struct buf *buffer_lrutail;	/* most recently used */
+static unsigned buffer_count;
+static unsigned buffer_ndirty;
+static unsigned buffer_rapending;	/* readahead requests in flight */
+
+static struct {
+	unsigned hits;
+	unsigned misses;
+	unsigned reads;
+	unsigned readios;
+	unsigned writes;
+	unsigned writeios;
+	unsigned evictions;
+	unsigned readaheads;
+	unsigned directs;
+	unsigned syncs;
+	unsigned flushes;
+} buffer_stats;
+
+/*
+ * Syncer state. The syncer sleeps on syncer_wchan until either its
+ * timer goes off or buffer_mark_dirty finds too many dirty buffers.
+ * Both of those can happen in contexts where we can't take
+ * buffer_lock (the timer runs in the interrupt handler), so this is
+ * protected by a spinlock instead.
+ */
+static struct spinlock syncer_lock = SPINLOCK_INITIALIZER;
+static struct wchan *syncer_wchan;
+static struct timer syncer_timer;
+static bool syncer_timedout;
+static bool syncer_pressure;
+
+/* Tunables; see buffer_setsyncer. */
+static unsigned buffer_syncinterval = BUFFER_SYNCINTERVAL;
+static unsigned buffer_dirtyratio = BUFFER_DIRTYRATIO;
+
+static void buffer_syncer(void *, unsigned long);
+static void syncer_timeout(void *);
+
+/*
+ * Setup.
+ */
+void
+buffer_bootstrap(void)
+{
+	int result;
+
+	buffer_lock = lock_create("buffer cache");
+	if (buffer_lock == NULL) {
+		panic("buffer_bootstrap: Out of memory\n");
+	}
+	buffer_cv = cv_create("buffer cache");
+	if (buffer_cv == NULL) {
+		panic("buffer_bootstrap: Out of memory\n");
+	}
+	syncer_wchan = wchan_create("syncer");
+	if (syncer_wchan == NULL) {
+		panic("buffer_bootstrap: Out of memory\n");
+	}
+	timer_init(&syncer_timer, syncer_timeout, NULL);
+
+	result = thread_fork("syncer", NULL, buffer_syncer, NULL, 0);
+	if (result) {
+		panic("buffer_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Hash table and LRU list
+
+static
+unsigned
+buffer_hashfn(struct device *dev, daddr_t block)
+{
+	uint32_t h;
+
+	h = block ^ ((uint32_t)dev->d_devnumber << 16);
+	return h & (BUFFER_HASHSIZE - 1);
+}
+
+static
+struct buf *
+buffer_find(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buffer_hash[buffer_hashfn(dev, block)];
+	     b != NULL; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buffer_hash_insert(struct buf *b)
+{
+	unsigned h;
+
+	h = buffer_hashfn(b->b_dev, b->b_block);
+	b->b_hashnext = buffer_hash[h];
+	buffer_hash[h] = b;
+}
+
+static
+void
+buffer_hash_remove(struct buf *b)
+{
+	struct buf **bp;
+
+	for (bp = &buffer_hash[buffer_hashfn(b->b_dev, b->b_block)];
+	     *bp != NULL; bp = &(*bp)->b_hashnext) {
+		if (*bp == b) {
+			*bp = b->b_hashnext;
+			b->b_hashnext = NULL;
+			return;
+		}
+	}
+	panic("buffer_hash_remove: buffer not in hash table\n");
+}
+
+static
+void
+buffer_lru_remove(struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(buffer_lruhead == b);
+		buffer_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(buffer_lrutail == b);
+		buffer_lrutail = b->b_lruprev;
+	}
+	b->b_lrunext = b->b_lruprev = NULL;
+}
+
+static
+void
+buffer_lru_append(struct buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = buffer_lrutail;
+	if (buffer_lrutail != NULL) {
+		buffer_lrutail->b_lrunext = b;
+	}
+	else {
+		buffer_lruhead = b;
+	}
+	buffer_lrutail = b;
+}
+
+/*
+ * Take and drop references. Unreferenced buffers are on the LRU list;
+ * referenced ones aren't.
+ */
+static
+void
+buffer_incref(struct buf *b)
+{
+	if (b->b_refcount == 0) {
+		buffer_lru_remove(b);
+	}
+	b->b_refcount++;
+}
+
+static
+void
+buffer_decref(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	b->b_refcount--;
+	if (b->b_refcount == 0) {
+		buffer_lru_append(b);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Read or write a run of buffers for consecutive blocks of the same
+ * device as one device request, retrying I/O errors. The buffers
+ * must be marked busy, and buffer_lock must not be held.
+ */
+static
+int
+buffer_iorun(struct buf **bufs, unsigned num, enum uio_rw rw)
+{
+	struct iovec iov[BUFFER_MAXRUN];
+	struct uio ku;
+	struct device *dev;
+	daddr_t block;
+	unsigned i;
+	int result;
+	int tries = 0;
+
+	KASSERT(num > 0 && num <= BUFFER_MAXRUN);
+	KASSERT(!lock_do_i_hold(buffer_lock));
+
+	dev = bufs[0]->b_dev;
+	block = bufs[0]->b_block;
+	for (i=0; i<num; i++) {
+		KASSERT(bufs[i]->b_busy);
+		KASSERT(bufs[i]->b_dev == dev);
+		KASSERT(bufs[i]->b_block == block + i);
+	}
+
+	DEBUG(DB_VFS, "buf: %s blocks %u-%u\n",
+	      rw == UIO_READ ? "read" : "write", block, block + num - 1);
+
+ retry:
+	for (i=0; i<num; i++) {
+		iov[i].iov_kbase = bufs[i]->b_data;
+		iov[i].iov_len = BUFFER_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = num;
+	ku.uio_offset = (off_t)block * BUFFER_SIZE;
+	ku.uio_resid = num * BUFFER_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+
+	result = DEVOP_IO(dev, &ku);
+	if (result == EINVAL) {
+		/*
+		 * This means the sector we requested was out of range,
+		 * or the seek address we gave wasn't sector-aligned,
+		 * or a couple of other things that are our fault.
+		 */
+		panic("buf: DEVOP_IO returned EINVAL\n");
+	}
+	if (result == EIO) {
+		if (tries == 0) {
+			tries++;
+			kprintf("buf: blocks %u-%u I/O error, retrying\n",
+				block, block + num - 1);
+			goto retry;
+		}
+		else if (tries < 10) {
+			tries++;
+			goto retry;
+		}
+		else {
+			kprintf("buf: blocks %u-%u I/O error, giving up "
+				"after %d retries\n",
+				block, block + num - 1, tries);
+		}
+	}
+	return result;
+}
+
+/*
+ * Wait until nobody is doing I/O on a buffer.
+ */
+static
+void
+buffer_waitidle(struct buf *b)
+{
+	while (b->b_busy) {
+		cv_wait(buffer_cv, buffer_lock);
+	}
+}
+
+/*
+ * Check if a buffer can join a run of dirty buffers being written.
+ */
+static
+bool
+buffer_canwrite(struct buf *b)
+{
+	return b != NULL && b->b_dirty && !b->b_busy && !b->b_held;
+}
+
+/*
+ * Collect the run of dirty buffers to write along with B, which must
+ * be dirty and not busy: any dirty buffers for the blocks on either
+ * side of it, up to BUFFER_MAXRUN in all. Take a reference to each
+ * and mark them busy and clean. Returns the number of buffers.
+ *
+ * The dirty flags are cleared before writing, so that if someone
+ * changes a buffer again while the write is in progress it doesn't
+ * get lost.
+ */
+static
+unsigned
+buffer_startwrite(struct buf *b, struct buf **run)
+{
+	daddr_t first;
+	unsigned i, num;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(buffer_canwrite(b));
+
+	/* Find the start of the run, then collect it going forward. */
+	first = b->b_block;
+	while (b->b_block - first < BUFFER_MAXRUN - 1 && first > 0 &&
+	       buffer_canwrite(buffer_find(b->b_dev, first - 1))) {
+		first--;
+	}
+	num = 0;
+	while (num < BUFFER_MAXRUN) {
+		struct buf *rb;
+
+		rb = (first + num == b->b_block) ? b :
+			buffer_find(b->b_dev, first + num);
+		if (!buffer_canwrite(rb)) {
+			break;
+		}
+		run[num++] = rb;
+	}
+	KASSERT(num > b->b_block - first);
+
+	for (i=0; i<num; i++) {
+		buffer_incref(run[i]);
+		run[i]->b_dirty = false;
+		run[i]->b_logged = false;
+		run[i]->b_busy = true;
+	}
+	buffer_ndirty -= num;
+	return num;
+}
+
+/*
+ * Finish a write started with buffer_startwrite. If it failed, the
+ * buffers are dirty again.
+ */
+static
+void
+buffer_endwrite(struct buf **run, unsigned num, int result)
+{
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	for (i=0; i<num; i++) {
+		run[i]->b_busy = false;
+		if (result && !run[i]->b_dirty) {
+			run[i]->b_dirty = true;
+			buffer_ndirty++;
+		}
+		buffer_decref(run[i]);
+	}
+	if (result == 0) {
+		buffer_stats.writes += num;
+		buffer_stats.writeios++;
+	}
+	cv_broadcast(buffer_cv, buffer_lock);
+}
+
+/*
+ * Write a buffer out if it's dirty and not held back by buffer_hold.
+ * The caller must hold a reference, so it can't be recycled while we
+ * have the lock released.
+ */
+static
+int
+buffer_writeout(struct buf *b)
+{
+	struct buf *run[BUFFER_MAXRUN];
+	unsigned num;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(b->b_refcount > 0);
+
+	buffer_waitidle(b);
+	if (!b->b_dirty || b->b_held) {
+		return 0;
+	}
+
+	num = buffer_startwrite(b, run);
+	lock_release(buffer_lock);
+
+	result = buffer_iorun(run, num, UIO_WRITE);
+
+	lock_acquire(buffer_lock);
+	buffer_endwrite(run, num, result);
+	return result;
+}
+
+/*
+ * Read a run of buffers for consecutive blocks, none of which may be
+ * valid or busy, and mark them valid.
+ */
+static
+int
+buffer_readrun(struct buf **bufs, unsigned num)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	for (i=0; i<num; i++) {
+		KASSERT(bufs[i]->b_refcount > 0);
+		KASSERT(!bufs[i]->b_valid && !bufs[i]->b_busy);
+		bufs[i]->b_busy = true;
+	}
+	lock_release(buffer_lock);
+
+	result = buffer_iorun(bufs, num, UIO_READ);
+
+	lock_acquire(buffer_lock);
+	for (i=0; i<num; i++) {
+		bufs[i]->b_busy = false;
+		if (result == 0) {
+			bufs[i]->b_valid = true;
+		}
+	}
+	if (result == 0) {
+		buffer_stats.reads += num;
+		buffer_stats.readios++;
+	}
+	cv_broadcast(buffer_cv, buffer_lock);
+	return result;
+}
+
+/*
+ * Make sure a buffer we hold a reference to has valid contents,
+ * reading it if necessary. If someone else is already reading it,
+ * wait for them instead.
+ */
+static
+int
+buffer_fill(struct buf *b)
+{
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(b->b_refcount > 0);
+
+	buffer_waitidle(b);
+	if (b->b_valid) {
+		return 0;
+	}
+	return buffer_readrun(&b, 1);
+}
+
+/*
+ * Fill a set of buffers we hold references to. Buffers that nobody
+ * is reading yet and whose blocks follow one another in the array
+ * are read in one request; then wait for (or, if that failed,
+ * retry) the rest.
+ */
+static
+int
+buffer_fillrun(struct buf **bufs, unsigned num)
+{
+	unsigned i, j;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	for (i=0; i<num; i=j) {
+		if (bufs[i]->b_valid || bufs[i]->b_busy) {
+			j = i+1;
+			continue;
+		}
+		for (j=i+1; j<num && j-i < BUFFER_MAXRUN; j++) {
+			if (bufs[j]->b_valid || bufs[j]->b_busy ||
+			    bufs[j]->b_dev != bufs[i]->b_dev ||
+			    bufs[j]->b_block != bufs[i]->b_block + (j-i)) {
+				break;
+			}
+		}
+		result = buffer_readrun(&bufs[i], j-i);
+		if (result) {
+			return result;
+		}
+	}
+
+	for (i=0; i<num; i++) {
+		result = buffer_fill(bufs[i]);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Asynchronous I/O
+
+/*
+ * A run of buffers with an asynchronous device request in flight.
+ */
+struct buffer_aio {
+	struct ioreq ba_req;
+	struct uio ba_uio;
+	struct iovec ba_iov[BUFFER_MAXRUN];
+	struct buf *ba_bufs[BUFFER_MAXRUN];
+	unsigned ba_num;
+	struct work ba_work;		/* for finishing from a callback */
+};
+
+/*
+ * Start I/O on a run of busy buffers for consecutive blocks, without
+ * waiting for it. If CALLBACK is NULL, the request is handed back in
+ * RET for the caller to dev_wait on and then kfree; otherwise
+ * CALLBACK gets it when it's done (possibly in an interrupt handler)
+ * and RET is not used, since it may be gone already by the time
+ * dev_submit returns.
+ */
+static
+int
+buffer_aio_start(struct buf **bufs, unsigned num, enum uio_rw rw,
+		 void (*callback)(struct ioreq *), struct buffer_aio **ret)
+{
+	struct buffer_aio *ba;
+	struct device *dev;
+	unsigned i;
+	int result;
+
+	KASSERT(num > 0 && num <= BUFFER_MAXRUN);
+
+	ba = kmalloc(sizeof(*ba));
+	if (ba == NULL) {
+		return ENOMEM;
+	}
+
+	dev = bufs[0]->b_dev;
+	for (i=0; i<num; i++) {
+		KASSERT(bufs[i]->b_busy);
+		KASSERT(bufs[i]->b_dev == dev);
+		KASSERT(bufs[i]->b_block == bufs[0]->b_block + i);
+		ba->ba_bufs[i] = bufs[i];
+		ba->ba_iov[i].iov_kbase = bufs[i]->b_data;
+		ba->ba_iov[i].iov_len = BUFFER_SIZE;
+	}
+	ba->ba_num = num;
+	ba->ba_uio.uio_iov = ba->ba_iov;
+	ba->ba_uio.uio_iovcnt = num;
+	ba->ba_uio.uio_offset = (off_t)bufs[0]->b_block * BUFFER_SIZE;
+	ba->ba_uio.uio_resid = num * BUFFER_SIZE;
+	ba->ba_uio.uio_segflg = UIO_SYSSPACE;
+	ba->ba_uio.uio_rw = rw;
+	ba->ba_uio.uio_space = NULL;
+	ba->ba_req.ior_uio = &ba->ba_uio;
+	ba->ba_req.ior_callback = callback;
+	ba->ba_req.ior_data = ba;
+
+	DEBUG(DB_VFS, "buf: async %s blocks %u-%u\n",
+	      rw == UIO_READ ? "read" : "write",
+	      bufs[0]->b_block, bufs[0]->b_block + num - 1);
+
+	if (callback == NULL) {
+		*ret = ba;
+	}
+	result = dev_submit(dev, &ba->ba_req);
+	if (result == EINVAL) {
+		/* As in buffer_iorun, this is our fault */
+		panic("buf: dev_submit returned EINVAL\n");
+	}
+	if (result) {
+		kfree(ba);
+		return result;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Buffer allocation
+
+/*
+ * Get an unnamed buffer to use for some new block: a fresh one if
+ * we're under the size limit, otherwise the least recently used one.
+ * If nothing is on the LRU list (everything's pinned) go over the
+ * limit rather than wait, since the holders may well be us.
+ *
+ * The buffer is handed back with one reference.
+ */
+static
+int
+buffer_alloc(struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	while (buffer_count >= BUFFER_MAXBUFS && buffer_lruhead != NULL) {
+		b = buffer_lruhead;
+		buffer_incref(b);
+
+		result = buffer_writeout(b);
+		if (result) {
+			buffer_decref(b);
+			return result;
+		}
+		if (b->b_refcount > 1 || b->b_dirty) {
+			/* Someone found it while we were writing it */
+			buffer_decref(b);
+			continue;
+		}
+
+		if (b->b_dev != NULL) {
+			buffer_hash_remove(b);
+			b->b_dev = NULL;
+			buffer_stats.evictions++;
+		}
+		b->b_valid = false;
+		*ret = b;
+		return 0;
+	}
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return ENOMEM;
+	}
+	b->b_data = kmalloc(BUFFER_SIZE);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return ENOMEM;
+	}
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_refcount = 1;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_busy = false;
+	b->b_held = false;
+	b->b_logged = false;
+	b->b_hashnext = NULL;
+	b->b_lrunext = b->b_lruprev = NULL;
+	buffer_count++;
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Find or create the buffer for a block, and take a reference to it.
+ */
+static
+int
+buffer_getref(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b, *nb;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(dev->d_blocksize == BUFFER_SIZE);
+
+	b = buffer_find(dev, block);
+	if (b != NULL) {
+		buffer_incref(b);
+		*ret = b;
+		return 0;
+	}
+
+	result = buffer_alloc(&nb);
+	if (result) {
+		return result;
+	}
+
+	/* buffer_alloc may have slept; check again */
+	b = buffer_find(dev, block);
+	if (b != NULL) {
+		buffer_decref(nb);
+		buffer_incref(b);
+		*ret = b;
+		return 0;
+	}
+
+	nb->b_dev = dev;
+	nb->b_block = block;
+	buffer_hash_insert(nb);
+	*ret = nb;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+/*
+ * Get a buffer, reading it in if necessary.
+ */
+int
+buffer_read(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	lock_acquire(buffer_lock);
+
+	result = buffer_getref(dev, block, &b);
+	if (result) {
+		lock_release(buffer_lock);
+		return result;
+	}
+
+	/* A read in progress by someone else (e.g. readahead) counts */
+	if (b->b_valid || b->b_busy) {
+		buffer_stats.hits++;
+	}
+	else {
+		buffer_stats.misses++;
+	}
+
+	result = buffer_fill(b);
+	if (result) {
+		buffer_decref(b);
+		lock_release(buffer_lock);
+		return result;
+	}
+	lock_release(buffer_lock);
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get buffers for NUM consecutive blocks, reading the ones that
+ * aren't in memory with as few device requests as possible.
+ */
+int
+buffer_read_multi(struct device *dev, daddr_t block, unsigned num,
+		  struct buf **bufs)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(num > 0 && num <= BUFFER_MAXRUN);
+
+	lock_acquire(buffer_lock);
+
+	for (i=0; i<num; i++) {
+		result = buffer_getref(dev, block + i, &bufs[i]);
+		if (result) {
+			goto fail;
+		}
+		if (bufs[i]->b_valid || bufs[i]->b_busy) {
+			buffer_stats.hits++;
+		}
+		else {
+			buffer_stats.misses++;
+		}
+	}
+
+	result = buffer_fillrun(bufs, num);
+	if (result) {
+		goto fail;
+	}
+
+	lock_release(buffer_lock);
+	return 0;
+
+ fail:
+	while (i-- > 0) {
+		buffer_decref(bufs[i]);
+	}
+	lock_release(buffer_lock);
+	return result;
+}
+
+/*
+ * Read NUM consecutive blocks straight into UIO, bypassing the cache.
+ * The device moves the data to the caller's memory itself, so each
+ * byte is copied once instead of into a buffer and then out again.
+ * This is only safe if no block in the range is in the cache (a
+ * cached copy may be newer than the disk), so if one is, nothing is
+ * done and EAGAIN comes back. The caller must make sure nobody
+ * writes the blocks meanwhile. Hands back the number of blocks
+ * transferred in DONE, which may be nonzero on error.
+ */
+int
+buffer_read_direct(struct device *dev, daddr_t block, unsigned num,
+		   struct uio *uio, unsigned *done)
+{
+	off_t pos;
+	size_t resid, moved;
+	unsigned i;
+	int result;
+
+	KASSERT(num > 0);
+	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(uio->uio_resid >= num * BUFFER_SIZE);
+
+	*done = 0;
+
+	lock_acquire(buffer_lock);
+	for (i=0; i<num; i++) {
+		if (buffer_find(dev, block + i) != NULL) {
+			lock_release(buffer_lock);
+			return EAGAIN;
+		}
+	}
+	buffer_stats.misses += num;
+	lock_release(buffer_lock);
+
+	DEBUG(DB_VFS, "buf: direct read blocks %u-%u\n",
+	      block, block + num - 1);
+
+	pos = uio->uio_offset;
+	resid = uio->uio_resid;
+	uio->uio_offset = (off_t)block * BUFFER_SIZE;
+	uio->uio_resid = num * BUFFER_SIZE;
+
+	result = DEVOP_IO(dev, uio);
+
+	moved = num * BUFFER_SIZE - uio->uio_resid;
+	uio->uio_offset = pos + moved;
+	uio->uio_resid = resid - moved;
+	*done = moved / BUFFER_SIZE;
+
+	lock_acquire(buffer_lock);
+	buffer_stats.directs += *done;
+	if (result == 0) {
+		buffer_stats.readios++;
+	}
+	lock_release(buffer_lock);
+
+	return result;
+}
+
+/*
+ * Get a buffer without reading it.
+ */
+int
+buffer_get(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	lock_acquire(buffer_lock);
+	result = buffer_getref(dev, block, &b);
+	if (result == 0) {
+		buffer_waitidle(b);
+	}
+	lock_release(buffer_lock);
+
+	if (result) {
+		return result;
+	}
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Thread side of readahead completion: mark the buffers valid (if
+ * the read worked) and let go of them.
+ */
+static
+void
+buffer_readahead_finish(void *arg)
+{
+	struct buffer_aio *ba = arg;
+	unsigned i;
+
+	lock_acquire(buffer_lock);
+	for (i=0; i<ba->ba_num; i++) {
+		ba->ba_bufs[i]->b_busy = false;
+		/* Errors will come up again when someone really reads */
+		if (ba->ba_req.ior_result == 0) {
+			ba->ba_bufs[i]->b_valid = true;
+		}
+		buffer_decref(ba->ba_bufs[i]);
+	}
+	if (ba->ba_req.ior_result == 0) {
+		buffer_stats.reads += ba->ba_num;
+		buffer_stats.readios++;
+	}
+	KASSERT(buffer_rapending > 0);
+	buffer_rapending--;
+	cv_broadcast(buffer_cv, buffer_lock);
+	lock_release(buffer_lock);
+
+	kfree(ba);
+}
+
+/*
+ * Completion callback for readahead. This may be in an interrupt
+ * handler, where we can't take buffer_lock, so pass the rest off.
+ */
+static
+void
+buffer_readahead_done(struct ioreq *req)
+{
+	struct buffer_aio *ba = req->ior_data;
+
+	work_init(&ba->ba_work, buffer_readahead_finish, ba);
+	work_schedule(&ba->ba_work);
+}
+
+/*
+ * Submit a run of buffers, which we've marked busy, for readahead.
+ */
+static
+void
+buffer_readahead_run(struct buf **run, unsigned num)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	buffer_rapending++;
+	buffer_stats.readaheads += num;
+	lock_release(buffer_lock);
+
+	result = buffer_aio_start(run, num, UIO_READ,
+				  buffer_readahead_done, NULL);
+
+	lock_acquire(buffer_lock);
+	if (result) {
+		for (i=0; i<num; i++) {
+			run[i]->b_busy = false;
+			buffer_decref(run[i]);
+		}
+		buffer_stats.readaheads -= num;
+		buffer_rapending--;
+		cv_broadcast(buffer_cv, buffer_lock);
+	}
+}
+
+/*
+ * Start reading some blocks into the cache in the background. This
+ * is only a hint: blocks already in the cache are skipped, and if
+ * anything goes wrong we just don't do it.
+ *
+ * Blocks that follow one another go in one device request, and the
+ * requests are submitted asynchronously, so the caller goes on
+ * while the disk works. The buffers are marked busy until the data
+ * arrives, so anyone who wants one meanwhile waits for it.
+ */
+void
+buffer_readahead(struct device *dev, const daddr_t *blocks, unsigned num)
+{
+	struct buf *run[BUFFER_MAXRUN];
+	struct buf *b;
+	unsigned i, n;
+
+	lock_acquire(buffer_lock);
+	n = 0;
+	for (i=0; i<num; i++) {
+		b = buffer_find(dev, blocks[i]);
+		if (b != NULL && (b->b_valid || b->b_busy)) {
+			continue;
+		}
+		if (n > 0 && (n == BUFFER_MAXRUN ||
+			      blocks[i] != run[n-1]->b_block + 1)) {
+			buffer_readahead_run(run, n);
+			n = 0;
+		}
+		if (buffer_getref(dev, blocks[i], &b)) {
+			break;
+		}
+		if (b->b_valid || b->b_busy) {
+			/* buffer_getref slept and someone else got it */
+			buffer_decref(b);
+			continue;
+		}
+		b->b_busy = true;
+		run[n++] = b;
+	}
+	if (n > 0) {
+		buffer_readahead_run(run, n);
+	}
+	lock_release(buffer_lock);
+}
+
+/*
+ * Drop a reference to a buffer.
+ */
+void
+buffer_release(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	buffer_decref(b);
+	lock_release(buffer_lock);
+}
+
+/*
+ * Get the data pointer.
+ */
+void *
+buffer_map(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	return b->b_data;
+}
+
+/*
+ * Mark a buffer valid, after filling in all of it.
+ */
+void
+buffer_mark_valid(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_refcount > 0);
+	b->b_valid = true;
+	lock_release(buffer_lock);
+}
+
+/*
+ * Mark a buffer dirty. It'll be written later; if that puts us over
+ * the dirty limit, get the syncer going.
+ */
+void
+buffer_mark_dirty(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_refcount > 0);
+	KASSERT(b->b_valid);
+	b->b_logged = false;
+	if (!b->b_dirty) {
+		b->b_dirty = true;
+		buffer_ndirty++;
+		if (buffer_ndirty * 100 >= buffer_dirtyratio * BUFFER_MAXBUFS) {
+			spinlock_acquire(&syncer_lock);
+			if (!syncer_pressure) {
+				syncer_pressure = true;
+				wchan_wakeone(syncer_wchan, &syncer_lock);
+			}
+			spinlock_release(&syncer_lock);
+		}
+	}
+	lock_release(buffer_lock);
+}
+
+/*
+ * Keep a buffer from being written until buffer_unhold, e.g. while a
+ * journal transaction that changes it is still open. Takes a
+ * reference of its own, so the caller may release theirs. Returns
+ * false if the buffer was already held.
+ */
+bool
+buffer_hold(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_refcount > 0);
+	if (b->b_held) {
+		lock_release(buffer_lock);
+		return false;
+	}
+	b->b_held = true;
+	b->b_logged = false;
+	buffer_incref(b);
+	lock_release(buffer_lock);
+	return true;
+}
+
+/*
+ * Let a held buffer be written again, and drop the reference taken
+ * by buffer_hold. If it's dirty, its contents are now in the journal,
+ * so buffer_sync_unlogged can leave it for later.
+ */
+void
+buffer_unhold(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_held);
+	b->b_held = false;
+	b->b_logged = b->b_dirty;
+	buffer_decref(b);
+	lock_release(buffer_lock);
+}
+
+/*
+ * Get the block number.
+ */
+daddr_t
+buffer_blockno(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	return b->b_block;
+}
+
+/*
+ * Write a buffer to disk now.
+ */
+int
+buffer_write(struct buf *b)
+{
+	int result;
+
+	lock_acquire(buffer_lock);
+	result = buffer_writeout(b);
+	lock_release(buffer_lock);
+	return result;
+}
+
+/*
+ * Start asynchronous writes for up to BUFFER_FLUSHBATCH runs of dirty
+ * buffers for DEV (or any device, if NULL), skipping ones already in
+ * a journal unless LOGGED is set. Returns the number started; the
+ * requests are put in BATCH.
+ */
+static
+unsigned
+buffer_flushbatch(struct device *dev, bool logged, struct buffer_aio **batch)
+{
+	struct buf *run[BUFFER_MAXRUN];
+	struct buf *b;
+	unsigned i, num, nbatch;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	nbatch = 0;
+	for (i=0; i<BUFFER_HASHSIZE; i++) {
+		for (b = buffer_hash[i]; b != NULL; b = b->b_hashnext) {
+			if (!buffer_canwrite(b)) {
+				continue;
+			}
+			if (dev != NULL && b->b_dev != dev) {
+				continue;
+			}
+			if (b->b_logged && !logged) {
+				continue;
+			}
+			num = buffer_startwrite(b, run);
+			/* This doesn't sleep for devices with devop_submit */
+			if (buffer_aio_start(run, num, UIO_WRITE, NULL,
+					     &batch[nbatch])) {
+				/* Leave the rest to buffer_writeout */
+				buffer_endwrite(run, num, ENOMEM);
+				return nbatch;
+			}
+			if (++nbatch == BUFFER_FLUSHBATCH) {
+				return nbatch;
+			}
+		}
+	}
+	return nbatch;
+}
+
+/*
+ * Write out all the dirty buffers for a device, or for all devices if
+ * DEV is NULL. Held buffers are skipped, and so are logged ones unless
+ * LOGGED is set.
+ *
+ * First submit the dirty runs in batches of asynchronous requests,
+ * so the device always has the next one queued, and wait for each
+ * batch. Writes that get I/O errors are retried synchronously.
+ *
+ * Then make a synchronous pass for anything left, such as buffers
+ * that were busy. Since buffer_writeout releases the lock, the hash
+ * chain can change under us; start the chain over after each write.
+ * Each write cleans a buffer, so this terminates.
+ */
+static
+int
+buffer_flush(struct device *dev, bool logged)
+{
+	struct buffer_aio *batch[BUFFER_FLUSHBATCH];
+	struct buffer_aio *ba;
+	struct buf *b;
+	unsigned i, nbatch;
+	int result;
+
+	lock_acquire(buffer_lock);
+
+	while ((nbatch = buffer_flushbatch(dev, logged, batch)) > 0) {
+		lock_release(buffer_lock);
+		for (i=0; i<nbatch; i++) {
+			ba = batch[i];
+			result = dev_wait(ba->ba_bufs[0]->b_dev, &ba->ba_req);
+			if (result == EIO) {
+				result = buffer_iorun(ba->ba_bufs, ba->ba_num,
+						      UIO_WRITE);
+			}
+			ba->ba_req.ior_result = result;
+		}
+		lock_acquire(buffer_lock);
+
+		result = 0;
+		for (i=0; i<nbatch; i++) {
+			ba = batch[i];
+			buffer_endwrite(ba->ba_bufs, ba->ba_num,
+					ba->ba_req.ior_result);
+			if (result == 0) {
+				result = ba->ba_req.ior_result;
+			}
+			kfree(ba);
+		}
+		if (result) {
+			lock_release(buffer_lock);
+			return result;
+		}
+	}
+
+	for (i=0; i<BUFFER_HASHSIZE; i++) {
+ again:
+		for (b = buffer_hash[i]; b != NULL; b = b->b_hashnext) {
+			if (!b->b_dirty || b->b_held) {
+				continue;
+			}
+			if (dev != NULL && b->b_dev != dev) {
+				continue;
+			}
+			if (b->b_logged && !logged) {
+				continue;
+			}
+			buffer_incref(b);
+			result = buffer_writeout(b);
+			buffer_decref(b);
+			if (result) {
+				lock_release(buffer_lock);
+				return result;
+			}
+			goto again;
+		}
+	}
+	lock_release(buffer_lock);
+	return 0;
+}
+
+/*
+ * Write out all the dirty buffers for a device.
+ */
+int
+buffer_sync(struct device *dev)
+{
+	KASSERT(dev != NULL);
+	return buffer_flush(dev, true);
+}
+
+/*
+ * Write out the dirty buffers for a device that aren't in a journal.
+ */
+int
+buffer_sync_unlogged(struct device *dev)
+{
+	KASSERT(dev != NULL);
+	return buffer_flush(dev, false);
+}
+
+/*
+ * Throw away all the buffers for a device. Wait for any queued
+ * readahead first, so it can't bring blocks back in afterwards.
+ */
+void
+buffer_drop(struct device *dev)
+{
+	struct buf **bp, *b;
+	unsigned i;
+
+	lock_acquire(buffer_lock);
+	while (buffer_rapending > 0) {
+		cv_wait(buffer_cv, buffer_lock);
+	}
+	for (i=0; i<BUFFER_HASHSIZE; i++) {
+		bp = &buffer_hash[i];
+		while (*bp != NULL) {
+			b = *bp;
+			if (b->b_dev != dev) {
+				bp = &b->b_hashnext;
+				continue;
+			}
+			KASSERT(b->b_refcount == 0);
+			KASSERT(!b->b_busy);
+			if (b->b_dirty) {
+				kprintf("buf: discarding dirty block %u\n",
+					b->b_block);
+				buffer_ndirty--;
+			}
+			*bp = b->b_hashnext;
+			buffer_lru_remove(b);
+			kfree(b->b_data);
+			kfree(b);
+			buffer_count--;
+		}
+	}
+	lock_release(buffer_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Syncer
+
+/*
+ * Timer callback: time for the periodic sync.
+ */
+static
+void
+syncer_timeout(void *data)
+{
+	(void)data;
+
+	spinlock_acquire(&syncer_lock);
+	syncer_timedout = true;
+	wchan_wakeone(syncer_wchan, &syncer_lock);
+	spinlock_release(&syncer_lock);
+}
+
+/*
+ * Set the timer for the next periodic sync.
+ */
+static
+void
+syncer_arm(void)
+{
+	struct timespec deadline;
+
+	gettime(&deadline);
+	deadline.tv_sec += buffer_syncinterval;
+	timer_schedule(&syncer_timer, &deadline);
+}
+
+/*
+ * Syncer thread. On the timer, sync everything, which also picks up
+ * dirty inodes, freemaps and superblocks that haven't been written
+ * into the buffer cache yet. When there are too many dirty buffers,
+ * just write those; that's what frees up the cache. If that wasn't
+ * enough, the rest must be held for an open journal transaction, so
+ * sync to get it committed.
+ */
+static
+void
+buffer_syncer(void *data1, unsigned long data2)
+{
+	bool timedout, pressure;
+
+	(void)data1;
+	(void)data2;
+
+	syncer_arm();
+
+	while (1) {
+		spinlock_acquire(&syncer_lock);
+		while (!syncer_timedout && !syncer_pressure) {
+			wchan_sleep(syncer_wchan, &syncer_lock);
+		}
+		timedout = syncer_timedout;
+		pressure = syncer_pressure;
+		syncer_timedout = syncer_pressure = false;
+		spinlock_release(&syncer_lock);
+
+		if (timedout) {
+			vfs_sync();
+			lock_acquire(buffer_lock);
+			buffer_stats.syncs++;
+			lock_release(buffer_lock);
+			syncer_arm();
+		}
+		else if (pressure) {
+			buffer_flush(NULL, true);
+			lock_acquire(buffer_lock);
+			buffer_stats.flushes++;
+			pressure = buffer_ndirty * 100 >=
+				buffer_dirtyratio * BUFFER_MAXBUFS;
+			lock_release(buffer_lock);
+			if (pressure) {
+				/* still too many; sync the filesystems too */
+				vfs_sync();
+			}
+		}
+	}
+}
+
+/*
+ * Change the syncer settings. A new interval takes effect after the
+ * currently pending sync.
+ */
+int
+buffer_setsyncer(unsigned interval, unsigned ratio)
+{
+	if (interval == 0 || ratio == 0 || ratio > 100) {
+		return EINVAL;
+	}
+	buffer_syncinterval = interval;
+	buffer_dirtyratio = ratio;
+	return 0;
+}
+
+/*
+ * Print the counters.
+ */
+void
+buffer_printstats(void)
+{
+	unsigned lookups;
+
+	lock_acquire(buffer_lock);
+	lookups = buffer_stats.hits + buffer_stats.misses;
+	kprintf("buffer cache: %u buffers (limit %u)\n",
+		buffer_count, BUFFER_MAXBUFS);
+	kprintf("    %u hits, %u misses (%u%% hit rate)\n",
+		buffer_stats.hits, buffer_stats.misses,
+		lookups ? buffer_stats.hits * 100 / lookups : 0);
+	kprintf("    %u reads (%u readahead, %u direct) in %u requests\n",
+		buffer_stats.reads + buffer_stats.directs,
+		buffer_stats.readaheads, buffer_stats.directs,
+		buffer_stats.readios);
+	kprintf("    %u writes in %u requests, %u evictions\n",
+		buffer_stats.writes, buffer_stats.writeios,
+		buffer_stats.evictions);
+	kprintf("    %u dirty; syncer every %us or at %u%% dirty: "
+		"%u syncs, %u flushes\n",
+		buffer_ndirty, buffer_syncinterval, buffer_dirtyratio,
+		buffer_stats.syncs, buffer_stats.flushes);
+	lock_release(buffer_lock);
+}
@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Directory name lookup cache. See dcache.h for the interface.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <dcache.h>
+
+/* Number of hash buckets. Must be a power of 2. */
+#define DCACHE_HASHSIZE	128
+
+struct dcache_entry {
+	struct vnode *de_dir;		/* directory */
+	char *de_name;			/* name in de_dir */
+	struct vnode *de_vn;		/* what it names, or NULL if nothing */
+	struct dcache_entry *de_hashnext;	/* next in hash chain */
+	struct dcache_entry *de_lrunext;	/* next (more recent) on LRU */
+	struct dcache_entry *de_lruprev;	/* previous (older) on LRU */
+};
+
+/*
+ * All of the following is protected by the VFS big lock.
+ */
+static struct dcache_entry *dcache_hash[DCACHE_HASHSIZE];
+static struct dcache_entry *dcache_lruhead;	/* least recently used */
+static struct dcache_entry *dcache_lrutail;	/* most recently used */
+static unsigned dcache_count;
+
+static struct {
+	unsigned hits;
+	unsigned neghits;
+	unsigned misses;
+	unsigned enters;
+	unsigned evictions;
+	unsigned purges;
+} dcache_stats;
+
+////////////////////////////////////////////////////////////
+// Internals
+
+/*
+ * Hash function.
+ */
+static
+unsigned
+dcache_hashfn(struct vnode *dir, const char *name)
+{
+	unsigned h = (unsigned)(uintptr_t)dir >> 4;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h & (DCACHE_HASHSIZE - 1);
+}
+
+/*
+ * Look for the entry for NAME in DIR.
+ */
+static
+struct dcache_entry *
+dcache_find(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *de;
+
+	for (de = dcache_hash[dcache_hashfn(dir, name)]; de != NULL;
+	     de = de->de_hashnext) {
+		if (de->de_dir == dir && !strcmp(de->de_name, name)) {
+			return de;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * LRU list manipulation.
+ */
+static
+void
+dcache_lru_remove(struct dcache_entry *de)
+{
+	if (de->de_lruprev != NULL) {
+		de->de_lruprev->de_lrunext = de->de_lrunext;
+	}
+	else {
+		dcache_lruhead = de->de_lrunext;
+	}
+	if (de->de_lrunext != NULL) {
+		de->de_lrunext->de_lruprev = de->de_lruprev;
+	}
+	else {
+		dcache_lrutail = de->de_lruprev;
+	}
+	de->de_lrunext = de->de_lruprev = NULL;
+}
+
+static
+void
+dcache_lru_append(struct dcache_entry *de)
+{
+	de->de_lruprev = dcache_lrutail;
+	de->de_lrunext = NULL;
+	if (dcache_lrutail != NULL) {
+		dcache_lrutail->de_lrunext = de;
+	}
+	else {
+		dcache_lruhead = de;
+	}
+	dcache_lrutail = de;
+}
+
+/*
+ * Take an entry out of the cache, drop its references, and free it.
+ */
+static
+void
+dcache_remove(struct dcache_entry *de)
+{
+	struct dcache_entry **dp;
+
+	for (dp = &dcache_hash[dcache_hashfn(de->de_dir, de->de_name)];
+	     *dp != de; dp = &(*dp)->de_hashnext) {
+		KASSERT(*dp != NULL);
+	}
+	*dp = de->de_hashnext;
+	dcache_lru_remove(de);
+	dcache_count--;
+
+	if (de->de_vn != NULL) {
+		VOP_DECREF(de->de_vn);
+	}
+	VOP_DECREF(de->de_dir);
+	kfree(de->de_name);
+	kfree(de);
+}
+
+/*
+ * Remove every entry whose directory is DIR.
+ */
+static
+void
+dcache_purgedir(struct vnode *dir)
+{
+	struct dcache_entry *de, *next;
+
+	for (de = dcache_lruhead; de != NULL; de = next) {
+		next = de->de_lrunext;
+		if (de->de_dir == dir) {
+			dcache_remove(de);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+/*
+ * Look up a name.
+ */
+bool
+dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct dcache_entry *de;
+
+	vfs_biglock_acquire();
+
+	de = dcache_find(dir, name);
+	if (de == NULL) {
+		dcache_stats.misses++;
+		vfs_biglock_release();
+		return false;
+	}
+
+	dcache_lru_remove(de);
+	dcache_lru_append(de);
+
+	if (de->de_vn != NULL) {
+		VOP_INCREF(de->de_vn);
+		dcache_stats.hits++;
+	}
+	else {
+		dcache_stats.neghits++;
+	}
+	*ret = de->de_vn;
+
+	vfs_biglock_release();
+	return true;
+}
+
+/*
+ * Remember the result of a lookup. This is only a hint, so if we
+ * run out of memory, just don't.
+ */
+void
+dcache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct dcache_entry *de;
+
+	if (dir->vn_fs == NULL) {
+		return;
+	}
+
+	vfs_biglock_acquire();
+
+	de = dcache_find(dir, name);
+	if (de != NULL) {
+		/* Replace the old answer */
+		if (vn != NULL) {
+			VOP_INCREF(vn);
+		}
+		if (de->de_vn != NULL) {
+			VOP_DECREF(de->de_vn);
+		}
+		de->de_vn = vn;
+		dcache_lru_remove(de);
+		dcache_lru_append(de);
+		vfs_biglock_release();
+		return;
+	}
+
+	if (dcache_count >= DCACHE_MAXENTRIES) {
+		dcache_remove(dcache_lruhead);
+		dcache_stats.evictions++;
+	}
+
+	de = kmalloc(sizeof(*de));
+	if (de == NULL) {
+		vfs_biglock_release();
+		return;
+	}
+	de->de_name = kstrdup(name);
+	if (de->de_name == NULL) {
+		kfree(de);
+		vfs_biglock_release();
+		return;
+	}
+
+	VOP_INCREF(dir);
+	de->de_dir = dir;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	de->de_vn = vn;
+
+	de->de_hashnext = dcache_hash[dcache_hashfn(dir, name)];
+	dcache_hash[dcache_hashfn(dir, name)] = de;
+	dcache_lru_append(de);
+	dcache_count++;
+	dcache_stats.enters++;
+
+	vfs_biglock_release();
+}
+
+/*
+ * Forget a name, after it's been created, removed, or renamed. If it
+ * named a directory, forget what's cached in that directory too,
+ * since it may have been removed.
+ */
+void
+dcache_purge(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *de;
+
+	vfs_biglock_acquire();
+
+	de = dcache_find(dir, name);
+	if (de != NULL) {
+		/* Do this first; the entries in it keep de_vn alive */
+		if (de->de_vn != NULL) {
+			dcache_purgedir(de->de_vn);
+		}
+		dcache_remove(de);
+		dcache_stats.purges++;
+	}
+
+	vfs_biglock_release();
+}
+
+/*
+ * Forget everything on a filesystem, before unmounting it.
+ */
+void
+dcache_purgefs(struct fs *fs)
+{
+	struct dcache_entry *de, *next;
+
+	vfs_biglock_acquire();
+
+	for (de = dcache_lruhead; de != NULL; de = next) {
+		next = de->de_lrunext;
+		if (de->de_dir->vn_fs == fs) {
+			dcache_remove(de);
+		}
+	}
+
+	vfs_biglock_release();
+}
+
+/*
+ * Print statistics.
+ */
+void
+dcache_printstats(void)
+{
+	unsigned lookups;
+
+	vfs_biglock_acquire();
+	lookups = dcache_stats.hits + dcache_stats.neghits +
+		dcache_stats.misses;
+	kprintf("name cache: %u entries (limit %u)\n",
+		dcache_count, DCACHE_MAXENTRIES);
+	kprintf("    %u hits (%u negative), %u misses (%u%% hit rate)\n",
+		dcache_stats.hits + dcache_stats.neghits,
+		dcache_stats.neghits, dcache_stats.misses,
+		lookups ?
+		(dcache_stats.hits + dcache_stats.neghits) * 100 / lookups
+		: 0);
+	kprintf("    %u entered, %u evicted, %u purged\n",
+		dcache_stats.enters, dcache_stats.evictions,
+		dcache_stats.purges);
+	vfs_biglock_release();
+}
@@ -319,6 +319,60 @@ dev_lookup(struct vnode *dir,
 	return 0;
 }
 
+/*
+ * Start an asynchronous block I/O request. Check alignment and work
+ * out the block range here so drivers don't have to; if the device
+ * can't do asynchronous I/O, do it synchronously and complete the
+ * request on the spot.
+ */
+int
+dev_submit(struct device *d, struct ioreq *req)
+{
+	struct uio *uio = req->ior_uio;
+	int result;
+
+	KASSERT(uio->uio_segflg == UIO_SYSSPACE);
+
+	if (d->d_blocks == 0 ||
+	    uio->uio_offset % d->d_blocksize != 0 ||
+	    uio->uio_resid % d->d_blocksize != 0) {
+		return EINVAL;
+	}
+	req->ior_block = uio->uio_offset / d->d_blocksize;
+	req->ior_nblocks = uio->uio_resid / d->d_blocksize;
+
+	if (d->d_ops->devop_submit != NULL) {
+		return d->d_ops->devop_submit(d, req);
+	}
+
+	result = DEVOP_IO(d, uio);
+	if (result == EINVAL) {
+		/* Caller error; don't complete the request */
+		return result;
+	}
+	req->ior_result = result;
+	req->ior_done = true;
+	if (req->ior_callback != NULL) {
+		req->ior_callback(req);
+	}
+	return 0;
+}
+
+/*
+ * Wait for a request started with dev_submit and return its result.
+ */
+int
+dev_wait(struct device *d, struct ioreq *req)
+{
+	KASSERT(req->ior_callback == NULL);
+
+	if (d->d_ops->devop_wait != NULL) {
+		return d->d_ops->devop_wait(d, req);
+	}
+	KASSERT(req->ior_done);
+	return req->ior_result;
+}
+
 /*
  * Function table for device vnodes.
  */
@@ -330,6 +384,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_read = dev_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
 	.vop_write = dev_write,
 	.vop_ioctl = dev_ioctl,
 	.vop_stat = dev_stat,
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Disk request scheduling. See iosched.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <iosched.h>
+
+/* Most blocks bounced through the kernel per request for user I/O */
+#define IOSCHED_BOUNCEBLOCKS	16
+
+/* Most pieces of user memory transferred directly in one request */
+#define IOSCHED_MAXPIECES	16
+
+struct iosched {
+	char *ios_name;			/* device name, for stats */
+	size_t ios_blocksize;		/* device block size */
+	void (*ios_start)(void *, struct ioreq *);
+	void *ios_devdata;		/* argument for ios_start */
+	struct iosched *ios_nextsched;	/* next on iosched_list */
+
+	struct spinlock ios_lock;	/* protects everything below */
+	struct wchan *ios_wchan;	/* for waiting on requests */
+	struct ioreq *ios_queue;	/* waiting requests, by block */
+	struct ioreq *ios_active;	/* request on the device, or NULL */
+	daddr_t ios_head;		/* block after the last one started */
+	unsigned ios_depth;		/* number of requests queued */
+
+	/* statistics */
+	unsigned ios_nreqs;		/* requests submitted */
+	unsigned ios_nmerges;		/* requests started with no seek */
+	unsigned ios_maxdepth;		/* deepest the queue has been */
+	uint64_t ios_depthsum;		/* sum of depth at each submit */
+	uint64_t ios_waitusec;		/* total time spent queued */
+	uint64_t ios_svcusec;		/* total time on the device */
+};
+
+/* All the schedulers, for iosched_printstats. */
+static struct spinlock iosched_listlock = SPINLOCK_INITIALIZER;
+static struct iosched *iosched_list;
+
+/*
+ * Microseconds from BEFORE to AFTER.
+ */
+static
+uint64_t
+iosched_usec(const struct timespec *before, const struct timespec *after)
+{
+	struct timespec diff;
+
+	timespec_sub(after, before, &diff);
+	return (uint64_t)diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+}
+
+/*
+ * Constructor.
+ */
+struct iosched *
+iosched_create(const char *name, size_t blocksize,
+	       void (*start)(void *devdata, struct ioreq *), void *devdata)
+{
+	struct iosched *ios;
+
+	ios = kmalloc(sizeof(*ios));
+	if (ios == NULL) {
+		return NULL;
+	}
+	ios->ios_name = kstrdup(name);
+	if (ios->ios_name == NULL) {
+		kfree(ios);
+		return NULL;
+	}
+	ios->ios_wchan = wchan_create(ios->ios_name);
+	if (ios->ios_wchan == NULL) {
+		kfree(ios->ios_name);
+		kfree(ios);
+		return NULL;
+	}
+	ios->ios_blocksize = blocksize;
+	ios->ios_start = start;
+	ios->ios_devdata = devdata;
+	spinlock_init(&ios->ios_lock);
+	ios->ios_queue = NULL;
+	ios->ios_active = NULL;
+	ios->ios_head = 0;
+	ios->ios_depth = 0;
+	ios->ios_nreqs = 0;
+	ios->ios_nmerges = 0;
+	ios->ios_maxdepth = 0;
+	ios->ios_depthsum = 0;
+	ios->ios_waitusec = 0;
+	ios->ios_svcusec = 0;
+
+	spinlock_acquire(&iosched_listlock);
+	ios->ios_nextsched = iosched_list;
+	iosched_list = ios;
+	spinlock_release(&iosched_listlock);
+
+	return ios;
+}
+
+/*
+ * If the device is idle, start the next request in C-SCAN order.
+ */
+static
+void
+iosched_startnext(struct iosched *ios)
+{
+	struct ioreq **rp, *req;
+
+	KASSERT(spinlock_do_i_hold(&ios->ios_lock));
+
+	if (ios->ios_active != NULL || ios->ios_queue == NULL) {
+		return;
+	}
+
+	/* First request at or past the head; else wrap to the lowest. */
+	for (rp = &ios->ios_queue; *rp != NULL; rp = &(*rp)->ior_next) {
+		if ((*rp)->ior_block >= ios->ios_head) {
+			break;
+		}
+	}
+	if (*rp == NULL) {
+		rp = &ios->ios_queue;
+	}
+	req = *rp;
+	*rp = req->ior_next;
+	req->ior_next = NULL;
+	ios->ios_depth--;
+
+	if (req->ior_block == ios->ios_head) {
+		ios->ios_nmerges++;
+	}
+	ios->ios_head = req->ior_block + req->ior_nblocks;
+
+	gettime(&req->ior_started);
+	ios->ios_waitusec += iosched_usec(&req->ior_queued,
+					  &req->ior_started);
+
+	ios->ios_active = req;
+	ios->ios_start(ios->ios_devdata, req);
+}
+
+/*
+ * Queue a request, keeping the queue sorted by block number (and in
+ * arrival order among requests for the same block).
+ */
+void
+iosched_submit(struct iosched *ios, struct ioreq *req)
+{
+	struct ioreq **rp;
+
+	KASSERT(req->ior_uio->uio_segflg == UIO_SYSSPACE);
+
+	req->ior_next = NULL;
+	req->ior_result = 0;
+	req->ior_done = false;
+	gettime(&req->ior_queued);
+
+	spinlock_acquire(&ios->ios_lock);
+
+	for (rp = &ios->ios_queue; *rp != NULL; rp = &(*rp)->ior_next) {
+		if ((*rp)->ior_block > req->ior_block) {
+			break;
+		}
+	}
+	req->ior_next = *rp;
+	*rp = req;
+
+	ios->ios_depth++;
+	ios->ios_nreqs++;
+	ios->ios_depthsum += ios->ios_depth;
+	if (ios->ios_depth > ios->ios_maxdepth) {
+		ios->ios_maxdepth = ios->ios_depth;
+	}
+
+	iosched_startnext(ios);
+
+	spinlock_release(&ios->ios_lock);
+}
+
+/*
+ * Wait for a request to finish.
+ */
+int
+iosched_wait(struct iosched *ios, struct ioreq *req)
+{
+	spinlock_acquire(&ios->ios_lock);
+	while (!req->ior_done) {
+		wchan_sleep(ios->ios_wchan, &ios->ios_lock);
+	}
+	spinlock_release(&ios->ios_lock);
+
+	return req->ior_result;
+}
+
+/*
+ * Called by the driver when the active request is done. Once we mark
+ * it done or call its callback the submitter may free it, so don't
+ * touch it afterwards.
+ */
+void
+iosched_done(struct iosched *ios, int result)
+{
+	struct ioreq *req;
+	struct timespec now;
+	void (*callback)(struct ioreq *);
+
+	gettime(&now);
+
+	spinlock_acquire(&ios->ios_lock);
+
+	req = ios->ios_active;
+	KASSERT(req != NULL);
+	ios->ios_active = NULL;
+	ios->ios_svcusec += iosched_usec(&req->ior_started, &now);
+
+	req->ior_result = result;
+	callback = req->ior_callback;
+	if (callback == NULL) {
+		req->ior_done = true;
+		wchan_wakeall(ios->ios_wchan, &ios->ios_lock);
+	}
+
+	/* Get the device going again before running the callback */
+	iosched_startnext(ios);
+
+	spinlock_release(&ios->ios_lock);
+
+	if (callback != NULL) {
+		req->ior_done = true;
+		callback(req);
+	}
+}
+
+/*
+ * Do a kernel-space transfer as one request.
+ */
+static
+int
+iosched_kio(struct iosched *ios, struct uio *uio)
+{
+	struct ioreq req;
+
+	req.ior_uio = uio;
+	req.ior_callback = NULL;
+	req.ior_data = NULL;
+	req.ior_block = uio->uio_offset / ios->ios_blocksize;
+	req.ior_nblocks = uio->uio_resid / ios->ios_blocksize;
+
+	iosched_submit(ios, &req);
+	return iosched_wait(ios, &req);
+}
+
+/*
+ * Point kernel iovecs KIOV at the physical pages behind the next
+ * stretch of a user uio, through their kernel (direct-mapped)
+ * addresses, so the driver can move data to or from them at
+ * interrupt time. Stops at the first page that isn't in memory, isn't
+ * a user address, or doesn't allow the access (writing, if we're
+ * reading from the device), and rounds the total down to whole
+ * blocks.
+ * Hands back the number of iovecs used, and the length covered in
+ * LEN_RET; 0 means the transfer has to bounce.
+ */
+static
+unsigned
+iosched_mapuser(struct iosched *ios, struct uio *uio, struct iovec *kiov,
+		size_t *len_ret)
+{
+	vaddr_t va;
+	paddr_t pa;
+	size_t len, left, piece, excess;
+	unsigned i, n;
+	int perms, need;
+
+	n = 0;
+	len = 0;
+	if (uio->uio_space == NULL) {
+		goto done;
+	}
+	need = uio->uio_rw == UIO_READ ? AS_PERM_WRITE : AS_PERM_READ;
+	for (i=0; i<uio->uio_iovcnt && len < uio->uio_resid; i++) {
+		va = (vaddr_t)uio->uio_iov[i].iov_ubase;
+		left = uio->uio_iov[i].iov_len;
+		while (left > 0 && len < uio->uio_resid) {
+			if (n == IOSCHED_MAXPIECES || va >= USERSPACETOP ||
+			    as_translate(uio->uio_space, va, &pa, &perms) ||
+			    (perms & need) == 0) {
+				goto done;
+			}
+			piece = PAGE_SIZE - (va & ~(vaddr_t)PAGE_FRAME);
+			if (piece > left) {
+				piece = left;
+			}
+			if (piece > uio->uio_resid - len) {
+				piece = uio->uio_resid - len;
+			}
+			kiov[n].iov_kbase = (void *)PADDR_TO_KVADDR(pa);
+			kiov[n].iov_len = piece;
+			n++;
+			len += piece;
+			va += piece;
+			left -= piece;
+		}
+	}
+
+ done:
+	excess = len % ios->ios_blocksize;
+	len -= excess;
+	while (excess > 0) {
+		KASSERT(n > 0);
+		if (kiov[n-1].iov_len > excess) {
+			kiov[n-1].iov_len -= excess;
+			break;
+		}
+		excess -= kiov[n-1].iov_len;
+		n--;
+	}
+	*len_ret = len;
+	return len > 0 ? n : 0;
+}
+
+/*
+ * Advance a user uio past LEN bytes that were transferred behind its
+ * back by way of iosched_mapuser.
+ */
+static
+void
+iosched_uioskip(struct uio *uio, size_t len)
+{
+	struct iovec *iov;
+	size_t size;
+
+	while (len > 0) {
+		iov = uio->uio_iov;
+		size = iov->iov_len < len ? iov->iov_len : len;
+		iov->iov_ubase += size;
+		iov->iov_len -= size;
+		if (iov->iov_len == 0 && len > size) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+		}
+		uio->uio_offset += size;
+		uio->uio_resid -= size;
+		len -= size;
+	}
+}
+
+/*
+ * Do the I/O for a uio and wait for it. The driver moves data at
+ * interrupt time, which it can't do through user addresses. So user
+ * transfers go straight to or from the physical pages behind the
+ * user buffer where those are in memory, and otherwise through a
+ * kernel bounce buffer a piece at a time (copying through the bounce
+ * buffer faults the pages in, so the next piece can usually go
+ * direct).
+ */
+int
+iosched_io(struct iosched *ios, struct uio *uio)
+{
+	struct iovec kiov[IOSCHED_MAXPIECES];
+	struct iovec iov;
+	struct uio ku;
+	char *bounce;
+	size_t maxlen, len;
+	unsigned n;
+	off_t pos;
+	int result;
+
+	KASSERT(uio->uio_offset % ios->ios_blocksize == 0);
+	KASSERT(uio->uio_resid % ios->ios_blocksize == 0);
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return iosched_kio(ios, uio);
+	}
+
+	maxlen = IOSCHED_BOUNCEBLOCKS * ios->ios_blocksize;
+	bounce = NULL;
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		pos = uio->uio_offset;
+
+		n = iosched_mapuser(ios, uio, kiov, &len);
+		if (n > 0) {
+			ku.uio_iov = kiov;
+			ku.uio_iovcnt = n;
+			ku.uio_offset = pos;
+			ku.uio_resid = len;
+			ku.uio_segflg = UIO_SYSSPACE;
+			ku.uio_rw = uio->uio_rw;
+			ku.uio_space = NULL;
+			result = iosched_kio(ios, &ku);
+			if (result) {
+				break;
+			}
+			iosched_uioskip(uio, len);
+			continue;
+		}
+
+		if (bounce == NULL) {
+			bounce = kmalloc(maxlen);
+			if (bounce == NULL) {
+				result = ENOMEM;
+				break;
+			}
+		}
+		len = uio->uio_resid < maxlen ? uio->uio_resid : maxlen;
+
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
+		}
+
+		uio_kinit(&iov, &ku, bounce, len, pos, uio->uio_rw);
+		result = iosched_kio(ios, &ku);
+		if (result) {
+			break;
+		}
+
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
+		}
+	}
+
+	if (bounce != NULL) {
+		kfree(bounce);
+	}
+	return result;
+}
+
+/*
+ * Print the statistics for every scheduler. Schedulers are never
+ * removed from the list, so once we have the head we can walk it
+ * without the list lock.
+ */
+void
+iosched_printstats(void)
+{
+	struct iosched *ios, *first;
+	unsigned nreqs, nmerges, maxdepth, depth;
+	uint64_t depthsum, waitusec, svcusec;
+
+	spinlock_acquire(&iosched_listlock);
+	first = iosched_list;
+	spinlock_release(&iosched_listlock);
+
+	for (ios = first; ios != NULL; ios = ios->ios_nextsched) {
+		spinlock_acquire(&ios->ios_lock);
+		nreqs = ios->ios_nreqs;
+		nmerges = ios->ios_nmerges;
+		maxdepth = ios->ios_maxdepth;
+		depth = ios->ios_depth;
+		depthsum = ios->ios_depthsum;
+		waitusec = ios->ios_waitusec;
+		svcusec = ios->ios_svcusec;
+		spinlock_release(&ios->ios_lock);
+
+		kprintf("%s: %u requests, %u with no seek\n",
+			ios->ios_name, nreqs, nmerges);
+		if (nreqs == 0) {
+			continue;
+		}
+		kprintf("    queue depth: now %u, average %llu.%02llu, "
+			"max %u\n", depth,
+			depthsum / nreqs, (depthsum * 100 / nreqs) % 100,
+			maxdepth);
+		kprintf("    average wait %llu us, service %llu us\n",
+			waitusec / nreqs, svcusec / nreqs);
+	}
+}
@@ -39,6 +39,7 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <dcache.h>
 
 static struct vnode *bootfs_vnode = NULL;
 
@@ -265,6 +266,7 @@ int
 vfs_lookup(char *path, struct vnode **retval)
 {
 	struct vnode *startvn;
+	bool single;
 	int result;
 
 	vfs_biglock_acquire();
@@ -281,8 +283,28 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
+	/*
+	 * The name cache only knows about single components, so only
+	 * use it when that's what's left.
+	 */
+	single = strchr(path, '/') == NULL;
+
+	if (single && dcache_lookup(startvn, path, retval)) {
+		result = (*retval == NULL) ? ENOENT : 0;
+		VOP_DECREF(startvn);
+		vfs_biglock_release();
+		return result;
+	}
+
 	result = VOP_LOOKUP(startvn, path, retval);
 
+	if (single && result == 0) {
+		dcache_enter(startvn, path, *retval);
+	}
+	else if (single && result == ENOENT) {
+		dcache_enter(startvn, path, NULL);
+	}
+
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
 	return result;
@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <dcache.h>
 
 
 /* Does most of the work for open(). */
@@ -73,7 +74,18 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			return result;
 		}
 
-		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		/* If we know it exists, and that's OK, skip VOP_CREAT */
+		if (!excl && dcache_lookup(dir, name, &vn) && vn != NULL) {
+			result = 0;
+		}
+		else {
+			vfs_biglock_acquire();
+			result = VOP_CREAT(dir, name, excl, mode, &vn);
+			if (result == 0) {
+				dcache_enter(dir, name, vn);
+			}
+			vfs_biglock_release();
+		}
 
 		VOP_DECREF(dir);
 	}
@@ -145,7 +157,10 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_REMOVE(dir, name);
+	dcache_purge(dir, name);
+	vfs_biglock_release();
 	VOP_DECREF(dir);
 
 	return result;
@@ -178,7 +193,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	dcache_purge(olddir, oldname);
+	dcache_purge(newdir, newname);
+	vfs_biglock_release();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -212,7 +231,10 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_LINK(newdir, newname, oldfile);
+	dcache_purge(newdir, newname);
+	vfs_biglock_release();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -239,7 +261,10 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_SYMLINK(newdir, newname, contents);
+	dcache_purge(newdir, newname);
+	vfs_biglock_release();
 	VOP_DECREF(newdir);
 
 	return result;
@@ -285,7 +310,10 @@ vfs_mkdir(char *path, mode_t mode)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_MKDIR(parent, name, mode);
+	dcache_purge(parent, name);
+	vfs_biglock_release();
 
 	VOP_DECREF(parent);
 
@@ -307,7 +335,10 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_RMDIR(parent, name);
+	dcache_purge(parent, name);
+	vfs_biglock_release();
 
 	VOP_DECREF(parent);
 
@@ -32,7 +32,11 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/dirent.h>
+#include <limits.h>
 #include <lib.h>
+#include <stat.h>
+#include <uio.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
@@ -175,3 +179,88 @@ vnode_check(struct vnode *v, const char *opstr)
 	spinlock_release(&v->vn_countlock);
 	vfs_biglock_release();
 }
+
+/*
+ * Append a struct dirent record for NAME (inode INO, file type TYPE
+ * as in st_mode) to UIO and set the directory position to NEXTPOS.
+ * If the record doesn't fit, set *FULL and leave UIO alone.
+ */
+int
+vfs_putdirent(struct uio *uio, ino_t ino, mode_t type, const char *name,
+	      off_t nextpos, bool *full)
+{
+	struct dirent d;
+	size_t namlen, reclen;
+	int result;
+
+	namlen = strlen(name);
+	KASSERT(namlen <= NAME_MAX);
+	reclen = _DIRENT_RECLEN(namlen);
+
+	if (reclen > uio->uio_resid) {
+		*full = true;
+		return 0;
+	}
+	*full = false;
+
+	bzero(&d, reclen);
+	d.d_ino = ino;
+	d.d_reclen = reclen;
+	d.d_type = (type & S_IFMT) >> 12;
+	d.d_namlen = namlen;
+	memcpy(d.d_name, name, namlen);
+
+	result = uiomove(&d, reclen, uio);
+	if (result) {
+		return result;
+	}
+	uio->uio_offset = nextpos;
+	return 0;
+}
+
+/*
+ * vop_getdirentries for file systems that only have vop_getdirentry:
+ * fetch one name at a time and pack them with no inode number or
+ * type.
+ */
+int
+vfs_getdirentries_byname(struct vnode *dir, struct uio *uio)
+{
+	struct iovec iov;
+	struct uio nameuio;
+	char *name;
+	bool full, any = false;
+	int result;
+
+	name = kmalloc(NAME_MAX+1);
+	if (name == NULL) {
+		return ENOMEM;
+	}
+
+	while (1) {
+		uio_kinit(&iov, &nameuio, name, NAME_MAX, uio->uio_offset,
+			  UIO_READ);
+		result = VOP_GETDIRENTRY(dir, &nameuio);
+		if (result || nameuio.uio_resid == NAME_MAX) {
+			/* Error or end of directory */
+			break;
+		}
+		name[NAME_MAX - nameuio.uio_resid] = 0;
+
+		result = vfs_putdirent(uio, 0, 0, name, nameuio.uio_offset,
+				       &full);
+		if (result) {
+			break;
+		}
+		if (full) {
+			if (!any) {
+				result = EINVAL;
+			}
+			break;
+		}
+		any = true;
+	}
+
+	kfree(name);
+	return result;
+}
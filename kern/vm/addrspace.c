@@ -73,6 +73,7 @@ as_create(void)
 	as->as_stack_end = (vaddr_t)0;
 	as->regionlist = NULL;
 	as->as_pages = NULL;
+	as->as_ptsize = 0;
 
 	return as;
 }
@@ -295,6 +296,7 @@ as_prepare_load(struct addrspace *as)
         if(as->as_pages == NULL) {
             return ENOMEM;
         }
+        as->as_ptsize = INITIAL_SIZE;
 
         ptSize = 64;
     }
@@ -313,6 +315,7 @@ as_prepare_load(struct addrspace *as)
        empty spaces in the table, resize. */
     if(numPages > ptSize || numPages > ptSize - i) {
         as->as_pages = pagetable_resize(as->as_pages, ptSize);
+        as->as_ptsize = ptSize*2;
     }
     
     /* Start filling in the page table from the index of the last entry. */
@@ -411,6 +414,32 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Translate a user virtual address to the physical address backing it.
+ * Fails if the page has no frame yet. as_prepare_load leaves entries
+ * for the stack and heap with no frame, and vm_fault adds another
+ * entry for the same page when it is first touched, so look past
+ * those.
+ */
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret, int *perms)
+{
+    struct pagetable_entry *pte;
+    size_t i;
+
+    for(i = 0; i < as->as_ptsize; i++) {
+        pte = &as->as_pages[i];
+        if(pte->pte_vaddr == (vaddr & PAGE_FRAME) && pte->pte_paddr != 0) {
+            *ret = pte->pte_paddr + (vaddr & ~(vaddr_t)PAGE_FRAME);
+            if(perms != NULL) {
+                *perms = pte->pte_permissions;
+            }
+            return 0;
+        }
+    }
+    return EFAULT;
+}
+
 /*
  * Initialize a new page table and return it.
  */
@@ -308,6 +308,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
         /* Page table is full, so resize. */
         if(as->as_pages[ptSize-1].pte_vaddr != 0) {
             as->as_pages = pagetable_resize(as->as_pages, ptSize);
+            as->as_ptsize = ptSize*2;
         }
         else {
             ptSize--;
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
 #include <errno.h>
 #include <err.h>
 
@@ -192,10 +193,9 @@ static
 void
 listdir(const char *path, int showheader)
 {
-	int fd;
-	char buf[1024];
+	DIR *dir;
+	struct dirent *d;
 	char newpath[1024];
-	ssize_t len;
 
 	if (showheader) {
 		printheader(path);
@@ -204,70 +204,81 @@ listdir(const char *path, int showheader)
 	/*
 	 * Open it.
 	 */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
+	dir = opendir(path);
+	if (dir == NULL) {
 		err(1, "%s", path);
 	}
 
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while (1) {
+		/* readdir only sets errno on failure */
+		errno = 0;
+		d = readdir(dir);
+		if (d == NULL) {
+			break;
+		}
 
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, d->d_name);
 
-		if (aopt || buf[0]!='.') {
+		if (aopt || d->d_name[0]!='.') {
 			/* Print it */
 			print(newpath);
 		}
 	}
-	if (len<0) {
-		err(1, "%s: getdirentry", path);
+	if (errno != 0) {
+		err(1, "%s: readdir", path);
 	}
 
 	/* Done */
-	close(fd);
+	closedir(dir);
 }
 
 static
 void
 recursedir(const char *path)
 {
-	int fd;
-	char buf[1024];
+	DIR *dir;
+	struct dirent *d;
 	char newpath[1024];
-	int len;
 
 	/*
 	 * Open it.
 	 */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
+	dir = opendir(path);
+	if (dir == NULL) {
 		err(1, "%s", path);
 	}
 
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while (1) {
+		/* readdir only sets errno on failure */
+		errno = 0;
+		d = readdir(dir);
+		if (d == NULL) {
+			break;
+		}
 
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, d->d_name);
 
-		if (!aopt && buf[0]=='.') {
+		if (!aopt && d->d_name[0]=='.') {
 			/* skip this one */
 			continue;
 		}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) {
 			/* always skip these */
 			continue;
 		}
 
-		if (!isdir(newpath)) {
+		/* Only go and look if the file system didn't say */
+		if (d->d_type != DT_UNKNOWN ? d->d_type != DT_DIR :
+		    !isdir(newpath)) {
 			continue;
 		}
 
@@ -276,11 +287,11 @@ recursedir(const char *path)
 			recursedir(newpath);
 		}
 	}
-	if (len<0) {
+	if (errno != 0) {
 		err(1, "%s", path);
 	}
 
-	close(fd);
+	closedir(dir);
 }
 
 static
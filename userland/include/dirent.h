@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _DIRENT_H_
+#define _DIRENT_H_
+
+#include <sys/types.h>
+
+/* Get struct dirent and the file types from the kernel */
+#include <kern/stattypes.h>
+#include <kern/dirent.h>
+
+/*
+ * Non-underscore names for the d_type values.
+ */
+#define DT_UNKNOWN 0
+#define DT_REG     (_S_IFREG >> 12)
+#define DT_DIR     (_S_IFDIR >> 12)
+#define DT_LNK     (_S_IFLNK >> 12)
+#define DT_FIFO    (_S_IFIFO >> 12)
+#define DT_SOCK    (_S_IFSOCK >> 12)
+#define DT_CHR     (_S_IFCHR >> 12)
+#define DT_BLK     (_S_IFBLK >> 12)
+
+/*
+ * Directory streams. readdir() returns entries out of a buffer
+ * filled by getdirentries(), so it makes one system call per
+ * bufferful rather than one per entry. The struct dirent it returns
+ * is overwritten by the next call on the same stream.
+ */
+typedef struct __dirstream DIR;
+
+DIR *opendir(const char *path);
+struct dirent *readdir(DIR *dir);
+void rewinddir(DIR *dir);
+int closedir(DIR *dir);
+
+#endif /* _DIRENT_H_ */
@@ -40,6 +40,7 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/iovec.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
@@ -65,6 +66,8 @@
  *     open:     fcntl.h or sys/fcntl.h
  *     reboot:   sys/reboot.h
  *     ioctl:    sys/ioctl.h
+ *     readv:    sys/uio.h
+ *     writev:   sys/uio.h
  *     remove:   stdio.h
  *     rename:   stdio.h
  *     time:     time.h
@@ -142,12 +145,21 @@ int chdir(const char *path);
 /* Optional. */
 void *sbrk(__intptr_t change);
 ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
+ssize_t getdirentries(int filehandle, char *buf, size_t buflen);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+int futex_wait(volatile int *addr, int expected,
+	       const struct timespec *timeout);
+int futex_wake(volatile int *addr, int count);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+
+/*
+ * POSIX C functions: directory streams, built on getdirentries().
+ */
+
+#define DIRBUFSIZE 4096
+
+struct __dirstream {
+	int dd_fd;			/* the open directory */
+	size_t dd_len;			/* bytes of entries in dd_buf */
+	size_t dd_pos;			/* where the next entry starts */
+	char dd_buf[DIRBUFSIZE];	/* entries (4-byte aligned) */
+};
+
+DIR *
+opendir(const char *path)
+{
+	DIR *dir;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	dir = malloc(sizeof(*dir));
+	if (dir == NULL) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	dir->dd_fd = fd;
+	dir->dd_len = 0;
+	dir->dd_pos = 0;
+	return dir;
+}
+
+struct dirent *
+readdir(DIR *dir)
+{
+	struct dirent *d;
+	ssize_t len;
+
+	if (dir->dd_pos >= dir->dd_len) {
+		len = getdirentries(dir->dd_fd, dir->dd_buf,
+				    sizeof(dir->dd_buf));
+		if (len <= 0) {
+			/* End of directory, or error (errno is set) */
+			return NULL;
+		}
+		dir->dd_len = len;
+		dir->dd_pos = 0;
+	}
+
+	d = (struct dirent *)(dir->dd_buf + dir->dd_pos);
+	dir->dd_pos += d->d_reclen;
+	return d;
+}
+
+void
+rewinddir(DIR *dir)
+{
+	lseek(dir->dd_fd, 0, SEEK_SET);
+	dir->dd_len = 0;
+	dir->dd_pos = 0;
+}
+
+int
+closedir(DIR *dir)
+{
+	int result;
+
+	result = close(dir->dd_fd);
+	free(dir);
+	return result;
+}
@@ -73,6 +73,9 @@ static bool dofiles, dodirs;
 static bool doindirect;
 static bool recurse;
 
+/* Buckets in the hashed directory being dumped, or 0 if not hashed */
+static uint32_t dirbuckets;
+
 ////////////////////////////////////////////////////////////
 // printouts
 
@@ -150,6 +153,7 @@ void
 dumpsb(void)
 {
 	struct sfs_superblock sb;
+	struct sfs_jheader jh;
 	unsigned i;
 
 	diskread(&sb, SFS_SUPER_BLOCK);
@@ -163,6 +167,24 @@ dumpsb(void)
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
 	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
 	dumplval("Volume name", sb.sb_volname);
+	dumpvalf("Flags", "0x%x%s", SWAP32(sb.sb_flags),
+		 (SWAP32(sb.sb_flags) & SFS_SB_CLEAN) ? " clean" : "");
+	if (sb.sb_journalblocks == 0) {
+		dumplval("Journal", "none");
+	}
+	else {
+		dumpvalf("Journal", "%u blocks at block %u",
+			 SWAP32(sb.sb_journalblocks),
+			 SWAP32(sb.sb_journalstart));
+		diskread(&jh, SWAP32(sb.sb_journalstart));
+		if (SWAP32(jh.jh_magic) != SFS_JOURNAL_MAGIC) {
+			dumpvalf("Journal magic", "0x%8x (bad)",
+				 SWAP32(jh.jh_magic));
+		}
+		else {
+			dumpvalf("Journal sequence", "%u", SWAP32(jh.jh_seq));
+		}
+	}
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
 		if (sb.reserved[i] != 0) {
@@ -230,8 +252,10 @@ dumpfreemap(uint32_t fsblocks)
 
 static
 void
-dumpindirect(uint32_t block)
+dumpindirect(uint32_t block, unsigned levels)
 {
+	static const char *const names[] = { "", "Indirect", "Double indirect",
+					     "Triple indirect" };
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	char tmp[128];
 	unsigned i;
@@ -239,7 +263,8 @@ dumpindirect(uint32_t block)
 	if (block == 0) {
 		return;
 	}
-	printf("Indirect block %u\n", block);
+	assert(levels > 0 && levels < ARRAYCOUNT(names));
+	printf("%s block %u\n", names[levels], block);
 
 	diskread(ib, block);
 	for (i=0; i<ARRAYCOUNT(ib); i++) {
@@ -253,12 +278,23 @@ dumpindirect(uint32_t block)
 			printf("\n");
 		}
 	}
+
+	if (levels > 1) {
+		for (i=0; i<ARRAYCOUNT(ib); i++) {
+			dumpindirect(SWAP32(ib[i]), levels - 1);
+		}
+	}
 }
 
+/*
+ * Walk an indirect block LEVELS deep, calling DOBLOCK on each data
+ * block it maps, up to NUMBLOCKS. A zero block is treated as full of
+ * zeros.
+ */
 static
 uint32_t
 traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
-	    void (*doblock)(uint32_t, uint32_t))
+	    unsigned levels, void (*doblock)(uint32_t, uint32_t))
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	unsigned i;
@@ -270,7 +306,14 @@ traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
 		diskread(ib, block);
 	}
 	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+		if (levels > 1) {
+			fileblock = traverse_ib(fileblock, numblocks,
+						SWAP32(ib[i]), levels - 1,
+						doblock);
+		}
+		else {
+			doblock(fileblock++, SWAP32(ib[i]));
+		}
 	}
 	return fileblock;
 }
@@ -291,11 +334,35 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 	}
 	if (fileblock < numblocks) {
 		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+					SWAP32(sfi->sfi_indirect), 1, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_dindirect), 2, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_tindirect), 3, doblock);
 	}
 	assert(fileblock == numblocks);
 }
 
+/*
+ * Hash function for hashed directories; see kern/sfs.h.
+ */
+static
+uint32_t
+dirhash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_INIT;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= SFS_DIRHASH_PRIME;
+	}
+	return h;
+}
+
 static
 void
 dumpdirblock(uint32_t fileblock, uint32_t diskblock)
@@ -304,7 +371,6 @@ dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
 	int i;
 
-	(void)fileblock;
 	if (diskblock == 0) {
 		printf("    [block %u - empty]\n", diskblock);
 		return;
@@ -319,7 +385,15 @@ dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 		}
 		else {
 			sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
-			printf("        %u %s\n", ino, sds[i].sfd_name);
+			printf("        %u %s", ino, sds[i].sfd_name);
+			if (dirbuckets > 0 &&
+			    (dirhash(sds[i].sfd_name) & (dirbuckets-1))
+			    != fileblock) {
+				printf(" [overflow from bucket %u]",
+				       dirhash(sds[i].sfd_name) &
+				       (dirbuckets-1));
+			}
+			printf("\n");
 		}
 	}
 }
@@ -335,7 +409,15 @@ dumpdir(uint32_t ino, const struct sfs_dinode *sfi)
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
 	printf("Directory contents for inode %u: %d entries\n", ino, nentries);
+	dirbuckets = 0;
+	if (SWAP32(sfi->sfi_flags) & SFS_IFLAG_HASHDIR) {
+		dirbuckets = SWAP32(sfi->sfi_size) / SFS_BLOCKSIZE;
+		printf("Hashed directory: %u buckets%s\n", dirbuckets,
+		       (SWAP32(sfi->sfi_flags) & SFS_IFLAG_DIROVFL) ?
+		       ", overflowed" : "");
+	}
 	traverse(sfi, dumpdirblock);
+	dirbuckets = 0;
 }
 
 static
@@ -374,23 +456,19 @@ recursedir(uint32_t ino, const struct sfs_dinode *sfi)
 	printf("Done with directory %u\n", ino);
 }
 
+/*
+ * Hex dump LEN bytes of file data that start at file offset BASE.
+ */
 static
-void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
+void
+dumpbytes(uint32_t base, const uint8_t *data, unsigned len)
 {
-	uint8_t data[SFS_BLOCKSIZE];
-	unsigned i, j;
+	unsigned i, j, linestart;
 	char tmp[128];
 
-	if (diskblock == 0) {
-		printf("    0x%6x  [sparse]\n", fileblock * SFS_BLOCKSIZE);
-		return;
-	}
-
-	diskread(data, diskblock);
-	for (i=0; i<SFS_BLOCKSIZE; i++) {
+	for (i=0; i<len; i++) {
 		if (i % 16 == 0) {
-			snprintf(tmp, sizeof(tmp), "0x%x",
-				 fileblock * SFS_BLOCKSIZE + i);
+			snprintf(tmp, sizeof(tmp), "0x%x", base + i);
 			printf("%8s", tmp);
 		}
 		if (i % 8 == 0) {
@@ -400,9 +478,14 @@ void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 			printf(" ");
 		}
 		printf("%02x", data[i]);
-		if (i % 16 == 15) {
+		if (i % 16 == 15 || i == len - 1) {
+			/* Pad out a short last line */
+			for (j = i % 16 + 1; j < 16; j++) {
+				printf(j % 8 == 0 ? "    " : "   ");
+			}
 			printf("  ");
-			for (j = i-15; j<=i; j++) {
+			linestart = i - i % 16;
+			for (j = linestart; j<=i; j++) {
 				if (data[j] < 32 || data[j] > 126) {
 					putchar('.');
 				}
@@ -415,11 +498,35 @@ void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 	}
 }
 
+static
+void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
+{
+	uint8_t data[SFS_BLOCKSIZE];
+
+	if (diskblock == 0) {
+		printf("    0x%6x  [sparse]\n", fileblock * SFS_BLOCKSIZE);
+		return;
+	}
+
+	diskread(data, diskblock);
+	dumpbytes(fileblock * SFS_BLOCKSIZE, data, SFS_BLOCKSIZE);
+}
+
 static
 void
 dumpfile(uint32_t ino, const struct sfs_dinode *sfi)
 {
+	uint32_t size;
+
 	printf("File contents for inode %u:\n", ino);
+	if (SWAP32(sfi->sfi_flags) & SFS_IFLAG_INLINE) {
+		size = SWAP32(sfi->sfi_size);
+		if (size > SFS_INLINESIZE) {
+			size = SFS_INLINESIZE;
+		}
+		dumpbytes(0, (const uint8_t *)sfi->sfi_inline, size);
+		return;
+	}
 	traverse(sfi, dumpfileblock);
 }
 
@@ -449,6 +556,10 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
 	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	dumpvalf("Flags", "0x%x%s%s%s", SWAP32(sfi.sfi_flags),
+		 (SWAP32(sfi.sfi_flags) & SFS_IFLAG_HASHDIR) ? " hashdir" : "",
+		 (SWAP32(sfi.sfi_flags) & SFS_IFLAG_DIROVFL) ? " dirovfl" : "",
+		 (SWAP32(sfi.sfi_flags) & SFS_IFLAG_INLINE) ? " inline" : "");
 	printf("\n");
 
         printf("    Direct blocks:\n");
@@ -476,15 +587,23 @@ dumpinode(uint32_t ino, const char *name)
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
-	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
-		if (sfi.sfi_waste[i] != 0) {
-			printf("    Word %u in waste area: 0x%x\n",
-			       i, SWAP32(sfi.sfi_waste[i]));
+	printf("    Double indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_dindirect), SWAP32(sfi.sfi_dindirect));
+	printf("    Triple indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_tindirect), SWAP32(sfi.sfi_tindirect));
+	if ((SWAP32(sfi.sfi_flags) & SFS_IFLAG_INLINE) == 0) {
+		for (i=0; i<SFS_INLINESIZE; i++) {
+			if (sfi.sfi_inline[i] != 0) {
+				printf("    Byte %u in inline area: 0x%x\n",
+				       i, (unsigned char)sfi.sfi_inline[i]);
+			}
 		}
 	}
 
 	if (doindirect) {
-		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi.sfi_indirect), 1);
+		dumpindirect(SWAP32(sfi.sfi_dindirect), 2);
+		dumpindirect(SWAP32(sfi.sfi_tindirect), 3);
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
@@ -498,6 +617,156 @@ dumpinode(uint32_t ino, const char *name)
 	}
 }
 
+////////////////////////////////////////////////////////////
+// fragmentation report
+
+/* Per-object counts, for the object currently being traversed */
+static uint32_t fragblocks, fragextents, fragprev;
+
+/* Totals over all objects seen */
+static uint32_t fragobjects, fragdirs, fragfragmented;
+static uint32_t fragtotblocks, fragtotextents;
+static uint32_t fragworstino, fragworstextents;
+
+static void fraginode(uint32_t ino);
+
+/*
+ * Count one block of the current object. An extent is a run of
+ * blocks that are consecutive both in the file and on disk.
+ */
+static
+void
+fragblock(uint32_t fileblock, uint32_t diskblock)
+{
+	(void)fileblock;
+
+	if (diskblock == 0) {
+		/* a hole ends the current extent */
+		fragprev = 0;
+		return;
+	}
+	if (fragprev == 0 || diskblock != fragprev + 1) {
+		fragextents++;
+	}
+	fragblocks++;
+	fragprev = diskblock;
+}
+
+static
+void
+fragdirblock(uint32_t fileblock, uint32_t diskblock)
+{
+	struct sfs_direntry sds[SFS_BLOCKSIZE/sizeof(struct sfs_direntry)];
+	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	int i;
+
+	(void)fileblock;
+	if (diskblock == 0) {
+		return;
+	}
+	diskread(&sds, diskblock);
+
+	for (i=0; i<nsds; i++) {
+		uint32_t ino = SWAP32(sds[i].sfd_ino);
+		if (ino==SFS_NOINO) {
+			continue;
+		}
+		sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
+		if (!strcmp(sds[i].sfd_name, ".") ||
+		    !strcmp(sds[i].sfd_name, "..")) {
+			continue;
+		}
+		fraginode(ino);
+	}
+}
+
+static
+void
+fraginode(uint32_t ino)
+{
+	struct sfs_dinode sfi;
+
+	diskread(&sfi, ino);
+
+	fragblocks = fragextents = fragprev = 0;
+	traverse(&sfi, fragblock);
+
+	fragobjects++;
+	fragtotblocks += fragblocks;
+	fragtotextents += fragextents;
+	if (fragextents > 1) {
+		fragfragmented++;
+	}
+	if (fragextents > fragworstextents) {
+		fragworstextents = fragextents;
+		fragworstino = ino;
+	}
+
+	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR) {
+		fragdirs++;
+		traverse(&sfi, fragdirblock);
+	}
+}
+
+/*
+ * Print how scattered the files' blocks are, and how broken up the
+ * free space is.
+ */
+static
+void
+dumpfrag(uint32_t fsblocks)
+{
+	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
+	uint8_t data[SFS_BLOCKSIZE];
+	uint32_t i, bn, run;
+	uint32_t nfree, freeextents, largestfree;
+
+	fraginode(SFS_ROOTDIR_INO);
+
+	nfree = freeextents = largestfree = run = 0;
+	for (i=0; i<freemapblocks; i++) {
+		diskread(data, SFS_FREEMAP_START+i);
+		for (bn=0; bn<SFS_BITSPERBLOCK; bn++) {
+			if (i*SFS_BITSPERBLOCK + bn >= fsblocks) {
+				break;
+			}
+			if (data[bn/8] & (1U << (bn%8))) {
+				run = 0;
+				continue;
+			}
+			if (run == 0) {
+				freeextents++;
+			}
+			run++;
+			nfree++;
+			if (run > largestfree) {
+				largestfree = run;
+			}
+		}
+	}
+
+	printf("Fragmentation\n");
+	printf("-------------\n");
+	dumpvalf("Objects", "%u (%u directories)", fragobjects, fragdirs);
+	dumpvalf("Fragmented", "%u", fragfragmented);
+	dumpvalf("Data blocks", "%u", fragtotblocks);
+	dumpvalf("Extents", "%u", fragtotextents);
+	dumpvalf("Blocks per extent", "%u.%02u",
+		 fragtotextents ? fragtotblocks / fragtotextents : 0,
+		 fragtotextents ?
+		 (fragtotblocks % fragtotextents) * 100 / fragtotextents : 0);
+	dumpvalf("Worst", "inode %u (%u extents)",
+		 fragworstino, fragworstextents);
+	dumpvalf("Free blocks", "%u", nfree);
+	dumpvalf("Free extents", "%u", freeextents);
+	dumpvalf("Largest free extent", "%u blocks", largestfree);
+	if (dumppos % 2 == 1) {
+		printf("\n");
+		dumppos++;
+	}
+	printf("\n");
+}
+
 ////////////////////////////////////////////////////////////
 // main
 
@@ -513,6 +782,7 @@ usage(void)
 	warnx("   -f: dump file contents");
 	warnx("   -d: dump directory contents");
 	warnx("   -r: recurse into directory contents");
+	warnx("   -F: report file and free space fragmentation");
 	warnx("   -a: equivalent to -sbdfr -i 1");
 	errx(1, "   Default is -i 1");
 }
@@ -522,6 +792,7 @@ main(int argc, char **argv)
 {
 	bool dosb = false;
 	bool dofreemap = false;
+	bool dofrag = false;
 	uint32_t dumpino = 0;
 	const char *dumpdisk = NULL;
 
@@ -554,6 +825,7 @@ main(int argc, char **argv)
 				    case 'f': dofiles = true; break;
 				    case 'd': dodirs = true; break;
 				    case 'r': recurse = true; break;
+				    case 'F': dofrag = true; break;
 				    case 'a':
 					dosb = true;
 					dofreemap = true;
@@ -582,7 +854,7 @@ main(int argc, char **argv)
 		usage();
 	}
 
-	if (!dosb && !dofreemap && dumpino == 0) {
+	if (!dosb && !dofreemap && !dofrag && dumpino == 0) {
 		dumpino = SFS_ROOTDIR_INO;
 	}
 
@@ -595,6 +867,9 @@ main(int argc, char **argv)
 	if (dofreemap) {
 		dumpfreemap(nblocks);
 	}
+	if (dofrag) {
+		dumpfrag(nblocks);
+	}
 	if (dumpino != 0) {
 		dumpinode(dumpino, NULL);
 	}
@@ -50,6 +50,16 @@
 static int fd=-1;
 static uint32_t nblocks;
 
+/*
+ * Reads fetch a run of up to RUNBLOCKS blocks at once into a window.
+ * The tools mostly walk the volume in block order, and SFS puts
+ * inodes and directory blocks next to one another, so this turns a
+ * read call per block into one per run.
+ */
+#define RUNBLOCKS 64
+static char window[RUNBLOCKS*BLOCKSIZE];
+static uint32_t windowstart, windowlen;
+
 /*
  * Open a disk. If we're built for the host OS, check that it's a
  * System/161 disk image, and then ignore the header block.
@@ -115,14 +125,15 @@ diskblocks(void)
 }
 
 /*
- * Write a block.
+ * Read or write LEN bytes at block BLOCK, retrying short transfers.
  */
+static
 void
-diskwrite(const void *data, uint32_t block)
+diskio(int dowrite, void *data, uint32_t block, uint32_t len)
 {
-	const char *cdata = data;
+	char *cdata = data;
 	uint32_t tot=0;
-	int len;
+	int rlen;
 
 	assert(fd>=0);
 
@@ -135,55 +146,67 @@ diskwrite(const void *data, uint32_t block)
 		err(1, "lseek");
 	}
 
-	while (tot < BLOCKSIZE) {
-		len = write(fd, cdata + tot, BLOCKSIZE - tot);
-		if (len < 0) {
+	while (tot < len) {
+		if (dowrite) {
+			rlen = write(fd, cdata + tot, len - tot);
+		}
+		else {
+			rlen = read(fd, cdata + tot, len - tot);
+		}
+		if (rlen < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
 			}
-			err(1, "write");
+			err(1, dowrite ? "write" : "read");
 		}
-		if (len==0) {
-			err(1, "write returned 0?");
+		if (rlen==0) {
+			if (dowrite) {
+				err(1, "write returned 0?");
+			}
+			err(1, "unexpected EOF in mid-sector");
 		}
-		tot += len;
+		tot += rlen;
 	}
 }
 
 /*
- * Read a block.
+ * Write a block. The copy in the read window, if any, is updated
+ * too.
  */
 void
-diskread(void *data, uint32_t block)
+diskwrite(const void *data, uint32_t block)
 {
-	char *cdata = data;
-	uint32_t tot=0;
-	int len;
-
-	assert(fd>=0);
-
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
+	diskio(1, (void *)data, block, BLOCKSIZE);
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
-		err(1, "lseek");
+	if (block >= windowstart && block - windowstart < windowlen) {
+		memcpy(window + (block - windowstart) * BLOCKSIZE,
+		       data, BLOCKSIZE);
 	}
+}
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
-		if (len < 0) {
-			if (errno==EINTR || errno==EAGAIN) {
-				continue;
-			}
-			err(1, "read");
+/*
+ * Read a block. On a miss in the read window, refill the window
+ * with a run of blocks starting at this one.
+ */
+void
+diskread(void *data, uint32_t block)
+{
+	uint32_t len;
+
+	if (block < windowstart || block - windowstart >= windowlen) {
+		len = RUNBLOCKS;
+		if (block < nblocks && nblocks - block < len) {
+			len = nblocks - block;
 		}
-		if (len==0) {
-			err(1, "unexpected EOF in mid-sector");
+		else if (block >= nblocks) {
+			len = 1;
 		}
-		tot += len;
+		diskio(0, window, block, len * BLOCKSIZE);
+		windowstart = block;
+		windowlen = len;
 	}
+
+	memcpy(data, window + (block - windowstart) * BLOCKSIZE, BLOCKSIZE);
 }
 
 /*
@@ -197,4 +220,5 @@ closedisk(void)
 		err(1, "close");
 	}
 	fd = -1;
+	windowlen = 0;
 }
@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -60,6 +61,12 @@
 /* Maximum size of freemap we support */
 #define MAXFREEMAPBLOCKS 32
 
+/* Default journal size: 1/16 of the volume, up to this many blocks */
+#define JOURNALMAX 512
+
+/* Volumes smaller than this get no journal by default */
+#define JOURNALMINVOL 2048
+
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
 
@@ -73,6 +80,9 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 }
 
 /*
@@ -94,7 +104,7 @@ allocblock(uint32_t block)
  */
 static
 void
-initfreemap(uint32_t fsblocks)
+initfreemap(uint32_t fsblocks, uint32_t journalblocks)
 {
 	uint32_t freemapbits = SFS_FREEMAPBITS(fsblocks);
 	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
@@ -114,6 +124,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* so must the journal, which follows */
+	for (i=0; i<journalblocks; i++) {
+		allocblock(SFS_FREEMAP_START + freemapblocks + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -125,7 +140,7 @@ initfreemap(uint32_t fsblocks)
  */
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks, uint32_t journalblocks)
 {
 	struct sfs_superblock sb;
 
@@ -140,6 +155,12 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	sb.sb_flags = SWAP32(SFS_SB_CLEAN);
+	if (journalblocks > 0) {
+		sb.sb_journalstart = SWAP32(SFS_FREEMAP_START +
+					    SFS_FREEMAPBLOCKS(nblocks));
+		sb.sb_journalblocks = SWAP32(journalblocks);
+	}
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -165,11 +186,40 @@ writefreemap(uint32_t fsblocks)
 }
 
 /*
- * Write out the root directory inode.
+ * Write out an empty journal: a header, and zeros in the log so
+ * nothing left over on the disk looks like a transaction.
+ */
+static
+void
+writejournal(uint32_t fsblocks, uint32_t journalblocks)
+{
+	char buf[SFS_BLOCKSIZE];
+	struct sfs_jheader jh;
+	uint32_t start, i;
+
+	if (journalblocks == 0) {
+		return;
+	}
+	start = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JOURNAL_MAGIC);
+	jh.jh_seq = SWAP32(1);
+	diskwrite(&jh, start);
+
+	bzero(buf, sizeof(buf));
+	for (i=1; i<journalblocks; i++) {
+		diskwrite(buf, start + i);
+	}
+}
+
+/*
+ * Write out the root directory inode. If HASHED is set, make it a
+ * hashed directory (with no buckets yet; see kern/sfs.h).
  */
 static
 void
-writerootdir(void)
+writerootdir(int hashed)
 {
 	struct sfs_dinode sfi;
 
@@ -178,6 +228,7 @@ writerootdir(void)
 	sfi.sfi_size = SWAP32(0);
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAP16(1);
+	sfi.sfi_flags = SWAP32(hashed ? SFS_IFLAG_HASHDIR : 0);
 
 	/* Write it out */
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
@@ -189,15 +240,41 @@ writerootdir(void)
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize, journalblocks;
 	char *volname, *s;
+	int hashed = 0;
+	long journalarg = -1;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/*
+	 * -H: make the root directory a hashed directory
+	 * -j N: make the journal N blocks (0 for none)
+	 */
+	while (argc > 1 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "-H")) {
+			hashed = 1;
+			argc--;
+			argv++;
+		}
+		else if (!strcmp(argv[1], "-j") && argc > 2) {
+			journalarg = strtol(argv[2], &s, 10);
+			if (*s != 0 || journalarg < 0) {
+				errx(1, "Invalid journal size %s", argv[2]);
+			}
+			argc -= 2;
+			argv += 2;
+		}
+		else {
+			break;
+		}
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-H] [-j blocks] device/diskfile "
+		     "volume-name");
 	}
 
 	check();
@@ -228,11 +305,29 @@ main(int argc, char **argv)
 	}
 	size = diskblocks();
 
+	/* Pick the journal size */
+	if (journalarg < 0) {
+		journalblocks = size < JOURNALMINVOL ? 0 : size / 16;
+		if (journalblocks > JOURNALMAX) {
+			journalblocks = JOURNALMAX;
+		}
+	}
+	else if (journalarg > 0 && journalarg < SFS_JOURNAL_MIN) {
+		errx(1, "Journal must be at least %u blocks", SFS_JOURNAL_MIN);
+	}
+	else if (journalarg > size / 2) {
+		errx(1, "Journal too large for volume");
+	}
+	else {
+		journalblocks = journalarg;
+	}
+
 	/* Write out the on-disk structures */
-	initfreemap(size);
-	writesuper(volname, size);
+	initfreemap(size, journalblocks);
+	writesuper(volname, size, journalblocks);
 	writefreemap(size);
-	writerootdir();
+	writejournal(size, journalblocks);
+	writerootdir(hashed);
 
 	closedisk();
 
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "compat.h"
+#include <kern/sfs.h>
+
+#include "disk.h"
+#include "sb.h"
+#include "journal.h"
+#include "main.h"
+
+static uint32_t jstart, jslots;
+
+/*
+ * Read a log slot.
+ */
+static
+void
+slotread(void *data, uint32_t slot)
+{
+	diskread(data, jstart + 1 + slot);
+}
+
+/*
+ * Write the journal header.
+ */
+static
+void
+writeheader(uint32_t seq)
+{
+	struct sfs_jheader jh;
+
+	memset(&jh, 0, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JOURNAL_MAGIC);
+	jh.jh_seq = SWAP32(seq);
+	diskwrite(&jh, jstart);
+}
+
+/*
+ * Check whether a complete transaction SEQ starts at log slot SLOT.
+ * Returns the number of slots it takes up, or 0 if it isn't there.
+ */
+static
+uint32_t
+scan(uint32_t slot, uint32_t seq)
+{
+	struct sfs_jdesc jd;
+	struct sfs_jcommit *jc = (struct sfs_jcommit *)&jd;
+	uint32_t image[SFS_BLOCKSIZE / sizeof(uint32_t)];
+	uint32_t pos, total, sum, n, i, j;
+
+	total = 0;
+	sum = 0;
+	for (pos = slot; pos < jslots; ) {
+		slotread(&jd, pos);
+		if (SWAP32(jc->jc_magic) == SFS_JCOMMIT_MAGIC &&
+		    SWAP32(jc->jc_seq) == seq) {
+			if (total > 0 && SWAP32(jc->jc_nblocks) == total &&
+			    SWAP32(jc->jc_checksum) == sum) {
+				return pos + 1 - slot;
+			}
+			return 0;
+		}
+		if (SWAP32(jd.jd_magic) != SFS_JDESC_MAGIC ||
+		    SWAP32(jd.jd_seq) != seq) {
+			return 0;
+		}
+
+		n = SWAP32(jd.jd_nblocks);
+		if (n == 0 || n > SFS_JDESC_MAX || pos + 1 + n > jslots) {
+			return 0;
+		}
+		for (i=0; i<n; i++) {
+			if (SWAP32(jd.jd_blocks[i]) >= sb_totalblocks()) {
+				return 0;
+			}
+		}
+		pos++;
+
+		for (i=0; i<n; i++) {
+			slotread(image, pos++);
+			for (j=0; j<SFS_BLOCKSIZE / sizeof(uint32_t); j++) {
+				sum += SWAP32(image[j]);
+			}
+		}
+		total += n;
+	}
+	return 0;
+}
+
+/*
+ * Copy the images of the transaction in the LEN slots starting at
+ * SLOT, which scan() has checked, to their home blocks.
+ */
+static
+void
+apply(uint32_t slot, uint32_t len)
+{
+	struct sfs_jdesc jd;
+	char image[SFS_BLOCKSIZE];
+	uint32_t pos, n, i;
+
+	/* The last slot is the commit block */
+	for (pos = slot; pos < slot + len - 1; ) {
+		slotread(&jd, pos++);
+		n = SWAP32(jd.jd_nblocks);
+		for (i=0; i<n; i++) {
+			slotread(image, pos++);
+			diskwrite(image, SWAP32(jd.jd_blocks[i]));
+		}
+	}
+}
+
+/*
+ * Replay the journal, if there is one. If its location or header is
+ * bad, leave it for sb_check or fix the header; there's nothing
+ * trustworthy to replay.
+ */
+void
+journal_replay(void)
+{
+	struct sfs_jheader jh;
+	uint32_t nblocks, firstseq, seq, slot, len;
+
+	jstart = sb_journalstart();
+	nblocks = sb_journalblocks();
+	if (nblocks == 0 || !sb_journalvalid()) {
+		return;
+	}
+	jslots = nblocks - 1;
+
+	diskread(&jh, jstart);
+	if (SWAP32(jh.jh_magic) != SFS_JOURNAL_MAGIC) {
+		warnx("Journal header invalid (fixed)");
+		setbadness(EXIT_RECOV);
+		writeheader(1);
+		return;
+	}
+	firstseq = seq = SWAP32(jh.jh_seq);
+
+	slot = 0;
+	while (slot < jslots && (len = scan(slot, seq)) > 0) {
+		apply(slot, len);
+		slot += len;
+		seq++;
+	}
+
+	if (seq != firstseq) {
+		warnx("Replayed %lu transactions from the journal",
+		      (unsigned long)(seq - firstseq));
+		writeheader(seq);
+	}
+}
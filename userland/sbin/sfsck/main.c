@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <err.h>
 
 #include "compat.h"
@@ -39,6 +40,7 @@
 #include "sb.h"
 #include "freemap.h"
 #include "inode.h"
+#include "journal.h"
 #include "passes.h"
 #include "main.h"
 
@@ -64,20 +66,39 @@ setbadness(int code)
 int
 main(int argc, char **argv)
 {
+	int fast = 0;
+
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
-	/* FUTURE: add -n option */
+	/*
+	 * -f: trust the clean flag and skip a volume that has it.
+	 * FUTURE: add -n option
+	 */
+	if (argc==3 && !strcmp(argv[1], "-f")) {
+		fast = 1;
+		argc--;
+		argv++;
+	}
 	if (argc!=2) {
-		errx(EXIT_USAGE, "Usage: sfsck device/diskfile");
+		errx(EXIT_USAGE, "Usage: sfsck [-f] device/diskfile");
 	}
 
 	opendisk(argv[1]);
 
 	sfs_setup();
 	sb_load();
+	journal_replay();
+	sb_load();
 	sb_check();
+
+	if (fast && sb_isclean() && badness == EXIT_CLEAN) {
+		closedisk();
+		warnx("%s: clean, not checked", sb_volname());
+		return EXIT_CLEAN;
+	}
+
 	freemap_setup();
 
 	printf("Phase 1 -- check blocks and sizes\n");
@@ -91,6 +112,17 @@ main(int argc, char **argv)
 	printf("Phase 3 -- check reference counts\n");
 	inode_adjust_filelinks();
 
+	/*
+	 * If nothing was wrong, later runs with -f can skip the volume;
+	 * otherwise make sure they don't.
+	 */
+	if (badness == EXIT_CLEAN) {
+		sb_markclean();
+	}
+	else {
+		sb_markdirty();
+	}
+
 	closedisk();
 
 	warnx("%lu blocks used (of %lu); %lu directories; %lu files",
@@ -247,6 +247,52 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 	return changed;
 }
 
+/*
+ * Check an inline file (see kern/sfs.h): it must have no blocks, fit
+ * in the inline area, and have zeros in the inline area past EOF. A
+ * file that has blocks or is too big is made an ordinary file again,
+ * and its inline bytes discarded, since they can't be what it holds.
+ *
+ * Returns nonzero if SFI has been modified and needs to be written
+ * back.
+ */
+static
+int
+check_inline(uint32_t ino, struct sfs_dinode *sfi)
+{
+	unsigned i;
+	int hasblocks = 0;
+
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (sfi->sfi_direct[i] != 0) {
+			hasblocks = 1;
+		}
+	}
+	if (sfi->sfi_indirect != 0 || sfi->sfi_dindirect != 0 ||
+	    sfi->sfi_tindirect != 0) {
+		hasblocks = 1;
+	}
+
+	if (hasblocks || sfi->sfi_size > SFS_INLINESIZE) {
+		warnx("Inode %lu: inline file with %s (made ordinary)",
+		      (unsigned long) ino,
+		      hasblocks ? "data blocks" : "oversize length");
+		sfi->sfi_flags &= ~(uint32_t)SFS_IFLAG_INLINE;
+		bzero(sfi->sfi_inline, sizeof(sfi->sfi_inline));
+		setbadness(EXIT_RECOV);
+		return 1;
+	}
+
+	if (checkzeroed(sfi->sfi_inline + sfi->sfi_size,
+			SFS_INLINESIZE - sfi->sfi_size)) {
+		warnx("Inode %lu: inline data past EOF not zeroed (fixed)",
+		      (unsigned long) ino);
+		setbadness(EXIT_RECOV);
+		return 1;
+	}
+	return 0;
+}
+
 /*
  * Do the pass1 inode-level checks on inode INO, which has already
  * been loaded into SFI. Note that sfi_type has already been
@@ -270,8 +316,37 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 
 	freemap_blockinuse(ino, B_INODE, ino);
 
-	if (checkzeroed(sfi->sfi_waste, sizeof(sfi->sfi_waste))) {
-		warnx("Inode %lu: sfi_waste section not zeroed (fixed)",
+	if (sfi->sfi_flags & ~(uint32_t)(SFS_IFLAG_HASHDIR|SFS_IFLAG_DIROVFL|
+					 SFS_IFLAG_INLINE)) {
+		warnx("Inode %lu: unknown flags 0x%lx (cleared)",
+		      (unsigned long) ino, (unsigned long) sfi->sfi_flags);
+		sfi->sfi_flags &= SFS_IFLAG_HASHDIR|SFS_IFLAG_DIROVFL|
+			SFS_IFLAG_INLINE;
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+	if (!isdir && (sfi->sfi_flags & ~(uint32_t)SFS_IFLAG_INLINE) != 0) {
+		warnx("Inode %lu: directory flags on non-directory (cleared)",
+		      (unsigned long) ino);
+		sfi->sfi_flags &= SFS_IFLAG_INLINE;
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+	if (isdir && (sfi->sfi_flags & SFS_IFLAG_INLINE) != 0) {
+		warnx("Inode %lu: inline flag on directory (cleared)",
+		      (unsigned long) ino);
+		sfi->sfi_flags &= ~(uint32_t)SFS_IFLAG_INLINE;
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+
+	if (sfi->sfi_flags & SFS_IFLAG_INLINE) {
+		if (check_inline(ino, sfi)) {
+			changed = 1;
+		}
+	}
+	else if (checkzeroed(sfi->sfi_inline, sizeof(sfi->sfi_inline))) {
+		warnx("Inode %lu: sfi_inline section not zeroed (fixed)",
 		      (unsigned long) ino);
 		setbadness(EXIT_RECOV);
 		changed = 1;
@@ -76,6 +76,28 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	/* Load the inode. */
 	sfs_readinode(ino, &sfi);
 
+	/*
+	 * A hashed directory must be a power-of-two number of whole
+	 * bucket blocks, or empty (mksfs -H writes the root that way
+	 * and the first insert grows it to one bucket); if it isn't,
+	 * drop the flag and let the kernel treat it as an ordinary
+	 * linear directory.
+	 */
+	if (sfi.sfi_flags & SFS_IFLAG_HASHDIR) {
+		uint32_t nb = sfi.sfi_size / SFS_BLOCKSIZE;
+
+		if (sfi.sfi_size % SFS_BLOCKSIZE != 0 ||
+		    (nb & (nb-1)) != 0) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: Invalid hashed directory size "
+			      "%lu (made linear)", pathsofar,
+			      (unsigned long) sfi.sfi_size);
+			sfi.sfi_flags &= ~(uint32_t)(SFS_IFLAG_HASHDIR |
+						     SFS_IFLAG_DIROVFL);
+			ichanged = 1;
+		}
+	}
+
 	/*
 	 * Load the directory. If there is any leftover room in the
 	 * last block, allocate space for it in case we want to insert
@@ -284,6 +306,33 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		}
 	}
 
+	/*
+	 * In a hashed directory, every entry must either be in its
+	 * home bucket or the overflow flag must be set so the kernel
+	 * knows to search the whole directory.
+	 */
+
+	if ((sfi.sfi_flags & SFS_IFLAG_HASHDIR) &&
+	    !(sfi.sfi_flags & SFS_IFLAG_DIROVFL)) {
+		uint32_t nb = sfi.sfi_size / SFS_BLOCKSIZE;
+
+		for (i=0; nb > 0 && i<ndirentries; i++) {
+			if (direntries[i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			if (i / SFS_DIRSLOTSPERBLOCK !=
+			    (sfsdir_hash(direntries[i].sfd_name) & (nb-1))) {
+				setbadness(EXIT_RECOV);
+				warnx("Directory %s: Entry %s outside its "
+				      "bucket (overflow flag set)",
+				      pathsofar, direntries[i].sfd_name);
+				sfi.sfi_flags |= SFS_IFLAG_DIROVFL;
+				ichanged = 1;
+				break;
+			}
+		}
+	}
+
 	/*
 	 * Fix up the link count if needed.
 	 */
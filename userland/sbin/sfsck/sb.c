@@ -83,6 +83,20 @@ sb_check(void)
 		setbadness(EXIT_RECOV);
 		schanged = 1;
 	}
+	if (sb.sb_journalblocks != 0 && !sb_journalvalid()) {
+		warnx("Journal location invalid (removed)");
+		setbadness(EXIT_RECOV);
+		sb.sb_journalstart = 0;
+		sb.sb_journalblocks = 0;
+		schanged = 1;
+	}
+	if (sb.sb_flags & ~(uint32_t)SFS_SB_CLEAN) {
+		warnx("Unknown superblock flags 0x%lx (cleared)",
+		      (unsigned long) sb.sb_flags);
+		setbadness(EXIT_RECOV);
+		sb.sb_flags &= SFS_SB_CLEAN;
+		schanged = 1;
+	}
 	if (checkzeroed(sb.reserved, sizeof(sb.reserved))) {
 		warnx("Reserved section of superblock not zeroed (fixed)");
 		setbadness(EXIT_RECOV);
@@ -114,6 +128,37 @@ sb_freemapblocks(void)
 	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
 }
 
+/*
+ * Return the location and size of the journal (0 blocks if none).
+ */
+uint32_t
+sb_journalstart(void)
+{
+	return sb.sb_journalstart;
+}
+
+uint32_t
+sb_journalblocks(void)
+{
+	return sb.sb_journalblocks;
+}
+
+/*
+ * Check that the journal, if any, is somewhere sensible: big enough,
+ * past the freemap, and inside the volume.
+ */
+int
+sb_journalvalid(void)
+{
+	if (sb.sb_journalblocks == 0) {
+		return 1;
+	}
+	return sb.sb_journalblocks >= SFS_JOURNAL_MIN &&
+		sb.sb_journalstart >= SFS_FREEMAP_START + sb_freemapblocks() &&
+		sb.sb_journalstart <= sb.sb_nblocks &&
+		sb.sb_journalblocks <= sb.sb_nblocks - sb.sb_journalstart;
+}
+
 /*
  * Return the volume name.
  */
@@ -122,3 +167,36 @@ sb_volname(void)
 {
 	return sb.sb_volname;
 }
+
+/*
+ * Return true if the volume was last unmounted cleanly.
+ */
+int
+sb_isclean(void)
+{
+	return (sb.sb_flags & SFS_SB_CLEAN) != 0;
+}
+
+/*
+ * Set the clean flag, so the next sfsck -f can skip the volume.
+ */
+void
+sb_markclean(void)
+{
+	if (!sb_isclean()) {
+		sb.sb_flags |= SFS_SB_CLEAN;
+		sfs_writesb(SFS_SUPER_BLOCK, &sb);
+	}
+}
+
+/*
+ * Clear the clean flag, so the next sfsck -f checks the volume again.
+ */
+void
+sb_markdirty(void)
+{
+	if (sb_isclean()) {
+		sb.sb_flags &= ~(uint32_t)SFS_SB_CLEAN;
+		sfs_writesb(SFS_SUPER_BLOCK, &sb);
+	}
+}
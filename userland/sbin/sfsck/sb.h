@@ -46,9 +46,25 @@ uint32_t sb_totalblocks(void);
 /* After the superblock is loaded: return number of freemap blocks. */
 uint32_t sb_freemapblocks(void);
 
+/* After the superblock is loaded: return journal location and size. */
+uint32_t sb_journalstart(void);
+uint32_t sb_journalblocks(void);
+
+/* After the superblock is loaded: return true if the journal is sane. */
+int sb_journalvalid(void);
+
 /* After the superblock is loaded: return volume name. */
 const char *sb_volname(void);
 
+/* After the superblock is loaded: return true if marked clean. */
+int sb_isclean(void);
+
+/* Mark the volume clean on disk, after a check that found no errors. */
+void sb_markclean(void);
+
+/* Clear the clean flag on disk, after a check that found errors. */
+void sb_markdirty(void);
+
 /* Check the superblock. Must load it first. */
 void sb_check(void);
 
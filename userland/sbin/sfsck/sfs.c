@@ -51,6 +51,9 @@ sfs_setup(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 }
 
 ////////////////////////////////////////////////////////////
@@ -62,6 +65,9 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_journalstart = SWAP32(sb->sb_journalstart);
+	sb->sb_journalblocks = SWAP32(sb->sb_journalblocks);
+	sb->sb_flags = SWAP32(sb->sb_flags);
 }
 
 static
@@ -81,6 +87,7 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_size = SWAP32(sfi->sfi_size);
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 
 	for (i=0; i<NUM_D; i++) {
 		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
@@ -442,6 +449,23 @@ sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector)
 	qsort(vector, nd, sizeof(int), dirsortfunc);
 }
 
+/*
+ * Hash a directory entry name the way the kernel does for hashed
+ * directories (FNV-1a over at most SFS_NAMELEN bytes).
+ */
+uint32_t
+sfsdir_hash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_INIT;
+	unsigned i;
+
+	for (i=0; i<SFS_NAMELEN && name[i] != 0; i++) {
+		h ^= (unsigned char)name[i];
+		h *= SFS_DIRHASH_PRIME;
+	}
+	return h;
+}
+
 /*
  * Try to add an entry NAME/INO to D (which has ND entries) by
  * finding an empty slot. Cannot allocate new space.
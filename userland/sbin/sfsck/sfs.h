@@ -74,6 +74,9 @@ void sfs_writedir(const struct sfs_dinode *sfi,
 int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 		  const char *name, uint32_t ino);
 
+/* Compute the hashed-directory hash of a name. */
+uint32_t sfsdir_hash(const char *name);
+
 /* Sort a directory by creating a permutation vector. */
 void sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector);
 
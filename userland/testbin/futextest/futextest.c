@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futextest - check the argument handling of futex_wait/futex_wake.
+ *
+ * Processes don't share memory, so this can't exercise a wakeup from
+ * another process; it checks the paths that must return without
+ * blocking, and uses timeouts to check that waiting on a word
+ * really blocks and that separate processes' words don't collide.
+ */
+
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/* Timeout for the blocking tests, in milliseconds */
+#define WAITMS 200
+
+static volatile int word;
+
+static
+void
+check_mismatch(void)
+{
+	word = 3;
+	if (futex_wait(&word, 4, NULL) != -1) {
+		errx(1, "FAILED: futex_wait with stale value returned");
+	}
+	if (errno != EAGAIN) {
+		err(1, "futex_wait with stale value");
+	}
+}
+
+static
+void
+check_nowaiters(void)
+{
+	int r;
+
+	r = futex_wake(&word, 1);
+	if (r < 0) {
+		err(1, "futex_wake");
+	}
+	if (r != 0) {
+		errx(1, "FAILED: futex_wake woke %d with no waiters", r);
+	}
+	if (futex_wake(&word, -1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: futex_wake with negative count");
+	}
+}
+
+static
+void
+check_badaddr(void)
+{
+	volatile int *misaligned;
+
+	misaligned = (volatile int *)((volatile char *)&word + 1);
+	if (futex_wait(misaligned, 0, NULL) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: futex_wait on misaligned address");
+	}
+	if (futex_wake(misaligned, 1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: futex_wake on misaligned address");
+	}
+	if (futex_wait(NULL, 0, NULL) != -1 || errno != EFAULT) {
+		errx(1, "FAILED: futex_wait on NULL");
+	}
+	if (futex_wake((volatile int *)0x80000000, 1) != -1 ||
+	    errno != EFAULT) {
+		errx(1, "FAILED: futex_wake on kernel address");
+	}
+}
+
+static
+unsigned long
+elapsedms(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+static
+void
+check_timeout(void)
+{
+	volatile int stackword;
+	struct timespec ts;
+	time_t s0;
+	unsigned long ns0, ms;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = -1;
+	if (futex_wait(&word, 3, &ts) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: futex_wait with bad timeout");
+	}
+
+	/* A stack word, which lives on a page allocated on demand */
+	stackword = 7;
+	ts.tv_nsec = WAITMS * 1000000;
+	__time(&s0, &ns0);
+	if (futex_wait(&stackword, 7, &ts) != -1) {
+		errx(1, "FAILED: futex_wait on stack word returned");
+	}
+	if (errno != ETIMEDOUT) {
+		err(1, "futex_wait on stack word");
+	}
+	ms = elapsedms(s0, ns0);
+	if (ms < WAITMS) {
+		errx(1, "FAILED: futex_wait timed out after only %lu ms", ms);
+	}
+}
+
+static
+void
+check_isolation(void)
+{
+	volatile int stackword;
+	struct timespec ts;
+	pid_t pid;
+	int r, status;
+
+	/* The child sleeps on its copy of the word... */
+	stackword = 7;
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 2 * WAITMS * 1000000;
+		if (futex_wait(&stackword, 7, &ts) == -1 &&
+		    errno == ETIMEDOUT) {
+			_exit(0);
+		}
+		_exit(1);
+	}
+
+	/* ...so waking ours, at the same address, must not reach it. */
+	ts.tv_sec = 0;
+	ts.tv_nsec = WAITMS * 1000000 / 2;
+	nanosleep(&ts, NULL);
+	r = futex_wake(&stackword, 1);
+	if (r < 0) {
+		err(1, "futex_wake");
+	}
+	if (r != 0) {
+		errx(1, "FAILED: futex_wake woke %d in another process", r);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child was woken, or didn't block");
+	}
+}
+
+int
+main(void)
+{
+	printf("futextest: phase 1: value mismatch\n");
+	check_mismatch();
+
+	printf("futextest: phase 2: wake with no waiters\n");
+	check_nowaiters();
+
+	printf("futextest: phase 3: bad addresses\n");
+	check_badaddr();
+
+	printf("futextest: phase 4: timeout on a stack word\n");
+	check_timeout();
+
+	printf("futextest: phase 5: separate processes\n");
+	check_isolation();
+
+	printf("futextest: passed\n");
+	return 0;
+}
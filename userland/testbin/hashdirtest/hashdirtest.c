@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * hashdirtest - check SFS hashed directories.
+ *
+ * Creates enough files in one directory that it gets converted from
+ * a linear directory to a hashed one and then doubled in size
+ * several times, removes and recreates some of them, and checks
+ * after each step that every name that should be there is found
+ * (both by name and by reading the directory) and no other.
+ *
+ * Works in the current directory. With -k, leaves the directory
+ * full at the end; then unmount the volume and run sfsck on it to
+ * check the hashed layout.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTDIR "hashdir"
+
+/*
+ * Linear directories are converted at 32 entries and start out
+ * with room for about twice that; this many takes several doublings.
+ */
+#define NFILES 600
+
+static bool present[NFILES];
+
+static
+void
+makename(char *buf, size_t len, unsigned i)
+{
+	snprintf(buf, len, TESTDIR "/f%u", i);
+}
+
+static
+void
+create(unsigned i)
+{
+	char name[32];
+	int fd;
+
+	makename(name, sizeof(name), i);
+	fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", name);
+	}
+	close(fd);
+	present[i] = true;
+}
+
+static
+void
+destroy(unsigned i)
+{
+	char name[32];
+
+	makename(name, sizeof(name), i);
+	if (remove(name) < 0) {
+		err(1, "%s: remove", name);
+	}
+	present[i] = false;
+}
+
+/*
+ * Check that exactly the files marked present are there.
+ */
+static
+void
+check(const char *when)
+{
+	static bool seen[NFILES];
+	char name[32];
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	unsigned i, n;
+	const char *end;
+
+	for (i=0; i<NFILES; i++) {
+		makename(name, sizeof(name), i);
+		if (stat(name, &st) == 0) {
+			if (!present[i]) {
+				errx(1, "FAILED: %s: %s exists", when, name);
+			}
+		}
+		else if (errno != ENOENT) {
+			err(1, "%s: stat", name);
+		}
+		else if (present[i]) {
+			errx(1, "FAILED: %s: %s is missing", when, name);
+		}
+		seen[i] = false;
+	}
+
+	dir = opendir(TESTDIR);
+	if (dir == NULL) {
+		err(1, "%s: opendir", TESTDIR);
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		if (de->d_name[0] != 'f') {
+			errx(1, "FAILED: %s: stray entry %s", when, de->d_name);
+		}
+		n = 0;
+		for (end = de->d_name + 1; *end >= '0' && *end <= '9'; end++) {
+			n = n * 10 + (*end - '0');
+		}
+		if (*end != 0 || n >= NFILES || !present[n] || seen[n]) {
+			errx(1, "FAILED: %s: bad or duplicate entry %s",
+			     when, de->d_name);
+		}
+		seen[n] = true;
+	}
+	closedir(dir);
+
+	for (i=0; i<NFILES; i++) {
+		if (present[i] && !seen[i]) {
+			errx(1, "FAILED: %s: f%u not listed", when, i);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	bool keep;
+	unsigned i;
+
+	keep = argc == 2 && !strcmp(argv[1], "-k");
+	if (argc > 1 && !keep) {
+		errx(1, "Usage: hashdirtest [-k]");
+	}
+
+	if (mkdir(TESTDIR, 0775) < 0) {
+		err(1, "%s: mkdir", TESTDIR);
+	}
+
+	printf("hashdirtest: phase 1: conversion\n");
+	for (i=0; i<40; i++) {
+		create(i);
+	}
+	check("after conversion");
+
+	printf("hashdirtest: phase 2: growth\n");
+	for (; i<NFILES; i++) {
+		create(i);
+	}
+	check("after growth");
+
+	printf("hashdirtest: phase 3: removal\n");
+	for (i=0; i<NFILES; i+=2) {
+		destroy(i);
+	}
+	check("after removal");
+
+	printf("hashdirtest: phase 4: reuse\n");
+	for (i=0; i<NFILES; i+=4) {
+		create(i);
+	}
+	check("after reuse");
+
+	if (keep) {
+		printf("hashdirtest: leaving %s; now run sfsck\n", TESTDIR);
+		return 0;
+	}
+
+	for (i=0; i<NFILES; i++) {
+		if (present[i]) {
+			destroy(i);
+		}
+	}
+	check("after cleanup");
+	if (rmdir(TESTDIR) < 0) {
+		err(1, "%s: rmdir", TESTDIR);
+	}
+	printf("hashdirtest: passed\n");
+	return 0;
+}
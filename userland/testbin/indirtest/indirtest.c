@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * indirtest - check SFS indirect block mapping and truncation.
+ *
+ * Writes across each boundary between the direct, indirect, double
+ * indirect, and triple indirect regions of a file, plus a sparse
+ * write well past the double indirect range, and reads everything
+ * back. Then truncates the file back into each region in turn,
+ * checking that the data below the cut survives and that the data
+ * above it reads as zeros when the file is extended again, and
+ * finally rewrites the file from empty.
+ *
+ * Works in the current directory. With -k, leaves the file in place;
+ * then unmount the volume and run sfsck on it to check that the
+ * freed blocks and indirect blocks were accounted for.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define TESTFILE "indirfile"
+
+/* These mirror the SFS on-disk layout. */
+#define BLOCKSIZE 512
+#define NDIRECT   15
+#define DBPERIDB  128
+
+/* First block of each region after the direct blocks. */
+#define IND_START   (NDIRECT)
+#define DIND_START  (IND_START + DBPERIDB)
+#define TIND_START  (DIND_START + DBPERIDB * DBPERIDB)
+
+/* A block well into the triple indirect range. */
+#define FAR_BLOCK   (TIND_START + 3 * DBPERIDB + 17)
+
+/* Each write covers the last block before a boundary and the first after. */
+#define CHUNK (2 * BLOCKSIZE)
+
+static const off_t boundaries[] = {
+	(off_t)IND_START * BLOCKSIZE,
+	(off_t)DIND_START * BLOCKSIZE,
+	(off_t)TIND_START * BLOCKSIZE,
+};
+#define NBOUNDARIES (sizeof(boundaries) / sizeof(boundaries[0]))
+
+static int fd;
+
+/*
+ * The byte expected at file offset POS; never zero, so holes and
+ * truncated data are distinguishable from written data.
+ */
+static
+unsigned char
+pattern(off_t pos)
+{
+	unsigned p = (unsigned)pos;
+
+	return 1 + (p * 7 + p / BLOCKSIZE) % 255;
+}
+
+static
+void
+writeat(off_t pos, size_t len)
+{
+	unsigned char buf[CHUNK];
+	ssize_t r;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		buf[i] = pattern(pos + i);
+	}
+	r = pwrite(fd, buf, len, pos);
+	if (r < 0) {
+		err(1, "%s: pwrite at %lld", TESTFILE, (long long)pos);
+	}
+	if ((size_t)r != len) {
+		errx(1, "%s: pwrite at %lld: short count %zd",
+		     TESTFILE, (long long)pos, r);
+	}
+}
+
+/*
+ * Check LEN bytes at POS: either the pattern or (if ZERO) all zeros.
+ */
+static
+void
+checkat(const char *when, off_t pos, size_t len, bool zero)
+{
+	unsigned char buf[CHUNK];
+	unsigned char want;
+	ssize_t r;
+	size_t i;
+
+	r = pread(fd, buf, len, pos);
+	if (r < 0) {
+		err(1, "%s: pread at %lld", TESTFILE, (long long)pos);
+	}
+	if ((size_t)r != len) {
+		errx(1, "FAILED: %s: pread at %lld: short count %zd",
+		     when, (long long)pos, r);
+	}
+	for (i=0; i<len; i++) {
+		want = zero ? 0 : pattern(pos + i);
+		if (buf[i] != want) {
+			errx(1, "FAILED: %s: byte at %lld is %u, expected %u",
+			     when, (long long)(pos + i), buf[i], want);
+		}
+	}
+}
+
+static
+void
+checksize(const char *when, off_t size)
+{
+	off_t end;
+
+	end = lseek(fd, 0, SEEK_END);
+	if (end < 0) {
+		err(1, "%s: lseek", TESTFILE);
+	}
+	if (end != size) {
+		errx(1, "FAILED: %s: size is %lld, expected %lld",
+		     when, (long long)end, (long long)size);
+	}
+}
+
+static
+void
+settrunc(off_t size)
+{
+	if (ftruncate(fd, size) < 0) {
+		err(1, "%s: ftruncate to %lld", TESTFILE, (long long)size);
+	}
+}
+
+/*
+ * Write across every boundary and far into the triple indirect
+ * range, then check all of it and a hole in each region.
+ */
+static
+void
+fill(const char *when)
+{
+	off_t far = (off_t)FAR_BLOCK * BLOCKSIZE;
+	unsigned i;
+
+	for (i=0; i<NBOUNDARIES; i++) {
+		writeat(boundaries[i] - BLOCKSIZE, CHUNK);
+	}
+	writeat(far, CHUNK);
+
+	for (i=0; i<NBOUNDARIES; i++) {
+		checkat(when, boundaries[i] - BLOCKSIZE, CHUNK, false);
+		/* the block after each write was never written */
+		checkat(when, boundaries[i] + BLOCKSIZE, BLOCKSIZE, true);
+	}
+	checkat(when, far, CHUNK, false);
+	checkat(when, far - BLOCKSIZE, BLOCKSIZE, true);
+	checksize(when, far + CHUNK);
+}
+
+/*
+ * Cut the file to half a block below boundary I, so the write that
+ * straddles it keeps its first half. Check what survives, then grow
+ * the file back to OLDSIZE and check everything above the cut is
+ * zeros, including blocks that held data before.
+ */
+static
+void
+cutto(unsigned i, off_t oldsize)
+{
+	char when[64];
+	off_t cut = boundaries[i] - BLOCKSIZE / 2;
+	unsigned j;
+
+	snprintf(when, sizeof(when), "truncate below boundary %u", i);
+
+	settrunc(cut);
+	checksize(when, cut);
+	for (j=0; j<i; j++) {
+		checkat(when, boundaries[j] - BLOCKSIZE, CHUNK, false);
+	}
+	checkat(when, boundaries[i] - BLOCKSIZE, BLOCKSIZE / 2, false);
+
+	settrunc(oldsize);
+	checksize(when, oldsize);
+	checkat(when, cut, BLOCKSIZE / 2, true);
+	checkat(when, boundaries[i], BLOCKSIZE, true);
+	for (j=i+1; j<NBOUNDARIES; j++) {
+		checkat(when, boundaries[j] - BLOCKSIZE, CHUNK, true);
+	}
+	checkat(when, (off_t)FAR_BLOCK * BLOCKSIZE, CHUNK, true);
+
+	/* leave it cut so the next step shrinks a smaller file */
+	settrunc(cut);
+}
+
+static
+void
+reopen(void)
+{
+	if (close(fd) < 0) {
+		err(1, "%s: close", TESTFILE);
+	}
+	fd = open(TESTFILE, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s: open", TESTFILE);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	off_t fullsize = (off_t)FAR_BLOCK * BLOCKSIZE + CHUNK;
+	bool keep;
+	unsigned i;
+
+	keep = argc == 2 && !strcmp(argv[1], "-k");
+	if (argc > 1 && !keep) {
+		errx(1, "Usage: indirtest [-k]");
+	}
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", TESTFILE);
+	}
+
+	printf("indirtest: phase 1: writes across each region\n");
+	fill("after first fill");
+	reopen();
+	fill("after reopen");
+
+	printf("indirtest: phase 2: truncation into each region\n");
+	for (i=NBOUNDARIES; i-- > 0; ) {
+		cutto(i, fullsize);
+	}
+	reopen();
+	checksize("after truncation", boundaries[0] - BLOCKSIZE / 2);
+
+	printf("indirtest: phase 3: truncate to zero and refill\n");
+	settrunc(0);
+	checksize("after truncate to zero", 0);
+	fill("after refill");
+
+	if (close(fd) < 0) {
+		err(1, "%s: close", TESTFILE);
+	}
+
+	if (keep) {
+		printf("indirtest: leaving %s; now run sfsck\n", TESTFILE);
+		return 0;
+	}
+
+	if (remove(TESTFILE) < 0) {
+		err(1, "%s: remove", TESTFILE);
+	}
+	printf("indirtest: passed\n");
+	return 0;
+}
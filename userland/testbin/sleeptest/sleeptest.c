@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * sleeptest - check nanosleep().
+ *
+ * Sleeps for various amounts of time and checks, against __time(),
+ * that each sleep lasted at least as long as asked and not much
+ * longer.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/* How much oversleep to tolerate, in nanoseconds. */
+#define SLOP 200000000
+
+static
+long long
+now_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	if (__time(&secs, &nsecs) < 0) {
+		err(1, "__time");
+	}
+	return (long long)secs * 1000000000 + nsecs;
+}
+
+static
+void
+check_sleep(time_t secs, long nsecs)
+{
+	struct timespec req, rem;
+	long long start, end, want, got;
+
+	req.tv_sec = secs;
+	req.tv_nsec = nsecs;
+	want = (long long)secs * 1000000000 + nsecs;
+
+	start = now_ns();
+	if (nanosleep(&req, &rem) < 0) {
+		err(1, "nanosleep");
+	}
+	end = now_ns();
+	got = end - start;
+
+	if (got < want) {
+		errx(1, "FAILED: asked for %lld ns, slept %lld ns", want, got);
+	}
+	if (got > want + SLOP) {
+		errx(1, "FAILED: asked for %lld ns, slept %lld ns", want, got);
+	}
+	if (rem.tv_sec != 0 || rem.tv_nsec != 0) {
+		errx(1, "FAILED: nonzero remaining time");
+	}
+}
+
+static
+void
+check_errors(void)
+{
+	struct timespec req;
+
+	req.tv_sec = 0;
+	req.tv_nsec = 1000000000;
+	if (nanosleep(&req, NULL) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: nanosleep with tv_nsec out of range");
+	}
+	req.tv_sec = -1;
+	req.tv_nsec = 0;
+	if (nanosleep(&req, NULL) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: nanosleep with negative time");
+	}
+	if (nanosleep(NULL, NULL) != -1 || errno != EFAULT) {
+		errx(1, "FAILED: nanosleep with NULL request");
+	}
+}
+
+int
+main(void)
+{
+	printf("sleeptest: phase 1: short sleeps\n");
+	check_sleep(0, 0);
+	check_sleep(0, 1000);
+	check_sleep(0, 20000000);
+	check_sleep(0, 250000000);
+
+	printf("sleeptest: phase 2: long sleep\n");
+	check_sleep(1, 500000000);
+
+	printf("sleeptest: phase 3: bad arguments\n");
+	check_errors();
+
+	printf("sleeptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * uiotest - check readv, writev, pread, and pwrite.
+ *
+ * Gathers and scatters a known pattern through iovecs of assorted
+ * sizes (including empty ones), checks that the positional calls
+ * use their 64-bit offset and leave the seek position alone, and
+ * checks the error cases.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE "uiotestfile"
+
+/* Total size of the pattern, and how it's cut up into iovecs */
+#define DATASIZE 3000
+static const size_t piecesizes[] = { 0, 1, 511, 0, 512, 1000, 0, 976, 0 };
+#define NPIECES (sizeof(piecesizes) / sizeof(piecesizes[0]))
+
+static char data[DATASIZE];
+static char readback[DATASIZE];
+static struct iovec bigiov[IOV_MAX + 1];
+
+static
+void
+setup_iov(struct iovec *iov, char *buf)
+{
+	unsigned i;
+	size_t pos;
+
+	pos = 0;
+	for (i=0; i<NPIECES; i++) {
+		iov[i].iov_base = buf + pos;
+		iov[i].iov_len = piecesizes[i];
+		pos += piecesizes[i];
+	}
+	if (pos != DATASIZE) {
+		errx(1, "FAILED: piece sizes don't add up");
+	}
+}
+
+static
+off_t
+getpos(int fd)
+{
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0) {
+		err(1, "lseek");
+	}
+	return pos;
+}
+
+static
+void
+check_vectors(int fd)
+{
+	struct iovec iov[NPIECES];
+	ssize_t r;
+	unsigned i;
+
+	for (i=0; i<DATASIZE; i++) {
+		data[i] = 'a' + i % 23;
+	}
+
+	setup_iov(iov, data);
+	r = writev(fd, iov, NPIECES);
+	if (r < 0) {
+		err(1, "writev");
+	}
+	if (r != DATASIZE) {
+		errx(1, "FAILED: writev wrote %zd of %d bytes", r, DATASIZE);
+	}
+	if (getpos(fd) != DATASIZE) {
+		errx(1, "FAILED: writev didn't advance the seek position");
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	memset(readback, 0, sizeof(readback));
+	setup_iov(iov, readback);
+	r = readv(fd, iov, NPIECES);
+	if (r < 0) {
+		err(1, "readv");
+	}
+	if (r != DATASIZE) {
+		errx(1, "FAILED: readv read %zd of %d bytes", r, DATASIZE);
+	}
+	if (memcmp(data, readback, DATASIZE) != 0) {
+		errx(1, "FAILED: readv data doesn't match what writev wrote");
+	}
+
+	/* Nothing but empty iovecs */
+	iov[0].iov_len = 0;
+	r = readv(fd, iov, 1);
+	if (r != 0) {
+		errx(1, "FAILED: readv of an empty iovec returned %zd", r);
+	}
+}
+
+static
+void
+check_positional(int fd)
+{
+	char buf[16];
+	off_t pos;
+	ssize_t r;
+
+	pos = getpos(fd);
+
+	r = pwrite(fd, "XYZZY", 5, 100);
+	if (r < 0) {
+		err(1, "pwrite");
+	}
+	if (r != 5) {
+		errx(1, "FAILED: pwrite wrote %zd of 5 bytes", r);
+	}
+	r = pread(fd, buf, 7, 99);
+	if (r < 0) {
+		err(1, "pread");
+	}
+	if (r != 7 || buf[0] != data[99] || memcmp(buf+1, "XYZZY", 5) != 0 ||
+	    buf[6] != data[105]) {
+		errx(1, "FAILED: pread didn't see what pwrite wrote");
+	}
+	if (getpos(fd) != pos) {
+		errx(1, "FAILED: pread/pwrite moved the seek position");
+	}
+
+	/*
+	 * Past 2^32. If the upper half of the offset is lost, these
+	 * will read and write near the start of the file instead.
+	 */
+	r = pread(fd, buf, sizeof(buf), 0x100000000LL + 100);
+	if (r != 0) {
+		errx(1, "FAILED: pread past 2^32 returned %zd", r);
+	}
+	r = pwrite(fd, "plugh", 5, 0x100000000LL + 100);
+	if (r != -1 || errno != EFBIG) {
+		errx(1, "FAILED: pwrite past 2^32 didn't fail with EFBIG");
+	}
+	if (pread(fd, buf, 5, 100) != 5 || memcmp(buf, "XYZZY", 5) != 0) {
+		errx(1, "FAILED: pwrite past 2^32 wrote near the start");
+	}
+	if (getpos(fd) != pos) {
+		errx(1, "FAILED: pread/pwrite moved the seek position");
+	}
+}
+
+static
+void
+check_errors(int fd)
+{
+	struct iovec iov[2];
+	char buf[16];
+	int confd;
+	unsigned i;
+	ssize_t r;
+
+	if (pread(fd, buf, 1, -1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: pread at negative position");
+	}
+	if (pwrite(fd, buf, 1, -1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: pwrite at negative position");
+	}
+
+	confd = open("con:", O_WRONLY);
+	if (confd < 0) {
+		err(1, "con:");
+	}
+	if (pwrite(confd, "", 0, 0) != -1 || errno != ESPIPE) {
+		errx(1, "FAILED: pwrite on the console");
+	}
+	if (pread(confd, buf, 1, 0) != -1 || errno != ESPIPE) {
+		errx(1, "FAILED: pread on the console");
+	}
+	close(confd);
+
+	/* Exactly IOV_MAX iovecs is fine; one more is not. */
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	for (i=0; i<IOV_MAX + 1; i++) {
+		bigiov[i].iov_base = readback + i % DATASIZE;
+		bigiov[i].iov_len = 1;
+	}
+	r = readv(fd, bigiov, IOV_MAX);
+	if (r < 0) {
+		err(1, "readv of IOV_MAX iovecs");
+	}
+	if (r != IOV_MAX) {
+		errx(1, "FAILED: readv of IOV_MAX iovecs returned %zd", r);
+	}
+	if (readv(fd, bigiov, IOV_MAX + 1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: readv of IOV_MAX+1 iovecs");
+	}
+	if (writev(fd, bigiov, 0) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: writev of no iovecs");
+	}
+	if (writev(fd, bigiov, -1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: writev of negative count");
+	}
+
+	/* Total length that doesn't fit in ssize_t */
+	iov[0].iov_base = buf;
+	iov[0].iov_len = (size_t)-1 >> 1;
+	iov[1].iov_base = buf;
+	iov[1].iov_len = 2;
+	if (writev(fd, iov, 2) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: writev with total length overflow");
+	}
+	iov[0].iov_len = (size_t)-1;
+	if (readv(fd, iov, 1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: readv with huge iovec");
+	}
+}
+
+int
+main(void)
+{
+	int fd;
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+
+	printf("uiotest: phase 1: readv/writev\n");
+	check_vectors(fd);
+
+	printf("uiotest: phase 2: pread/pwrite\n");
+	check_positional(fd);
+
+	printf("uiotest: phase 3: bad arguments\n");
+	check_errors(fd);
+
+	close(fd);
+	remove(TESTFILE);
+	printf("uiotest: passed\n");
+	return 0;
+}